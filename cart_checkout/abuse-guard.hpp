@@ -0,0 +1,221 @@
+#ifndef ABUSE_GUARD_HPP
+#define ABUSE_GUARD_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <crow.h>
+
+#include "authentication.hpp"
+#include "heavy-hitters.hpp"
+#include "shared-table.hpp"
+
+/**
+ * @brief What abuse_guard counts and blocks, in memory that may be shared by the server's processes (see
+ * shared_state): zeroed, nothing was counted or blocked.
+ */
+struct abuse_guard_state
+{
+  typedef shared_table<std::atomic<int64_t>, 1024, 32> block_table; // until when, on the steady clock
+
+  heavy_hitters::sketch ips;
+  heavy_hitters::sketch emails;
+  std::atomic<int64_t> latest_block_until_ms; // nothing is blocked once it has passed, the usual case
+  block_table blocks;
+};
+
+/**
+ * @brief Middleware counting every request by client IP (and, when told, every email tried on /login and /register)
+ * in heavy hitter sketches, and temporarily blocking IPs sending more than the block threshold per window.
+ *
+ * A blocked IP is answered 429 before routing, so its requests never reach a handler, until block_duration has
+ * passed without it crossing the threshold again. Requests with the admin token are never blocked. Blocking is off
+ * until configure() sets a threshold; counting is always on. After share(), the counts and blocks are those of
+ * every process sharing the state.
+ */
+struct abuse_guard
+{
+  struct context
+  {};
+
+  abuse_guard() : ips_(32), emails_(32), own_state_(new abuse_guard_state()), state_(own_state_.get()) {}
+
+  abuse_guard(const abuse_guard &) = delete;
+  abuse_guard &operator=(const abuse_guard &) = delete;
+
+  /**
+   * @brief Blocks an IP for block_duration once it sends block_threshold requests in a window (0 never blocks).
+   */
+  void configure(uint32_t block_threshold, std::chrono::seconds block_duration)
+  {
+    block_duration_ms_.store(std::chrono::duration_cast<std::chrono::milliseconds>(block_duration).count(), std::memory_order_relaxed);
+    block_threshold_.store(block_threshold, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Counts and blocks in shared instead of state of its own. Call before the server runs.
+   */
+  void share(abuse_guard_state &shared)
+  {
+    ips_.share(shared.ips);
+    emails_.share(shared.emails);
+    state_ = &shared;
+    own_state_.reset();
+  }
+
+  void before_handle(crow::request &req, crow::response &res, context & /*ctx*/)
+  {
+    const std::string &ip_address = req.remote_ip_address;
+    uint32_t requests = ips_.add(ip_address);
+    uint32_t threshold = block_threshold_.load(std::memory_order_relaxed);
+    if (threshold && requests >= threshold)
+    {
+      block(ip_address, requests);
+    }
+
+    long long seconds_left = 0;
+    if (blocked(ip_address, &seconds_left) && !is_admin_request(req))
+    {
+      res.code = 429;
+      res.set_header("Retry-After", std::to_string(seconds_left));
+      res.end();
+    }
+  }
+
+  void after_handle(crow::request & /*req*/, crow::response & /*res*/, context & /*ctx*/)
+  {}
+
+  /**
+   * @brief Whether ip_address is blocked (for handlers not behind the middleware, e.g. websocket upgrades).
+   */
+  bool blocked(const std::string &ip_address, long long *seconds_left = nullptr)
+  {
+    int64_t now = now_ms();
+    if (state_->latest_block_until_ms.load(std::memory_order_relaxed) <= now)
+    {
+      return false;
+    }
+    block_table::slot *found = state_->blocks.find(ip_address, block_table::hash_key(ip_address));
+    int64_t until = found ? found->value.load(std::memory_order_relaxed) : 0;
+    if (until <= now)
+    {
+      return false;
+    }
+    if (seconds_left)
+    {
+      *seconds_left = (until - now) / 1000 + 1;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Counts an attempt on email (a login or registration), for the report.
+   */
+  void record_email(const std::string &email)
+  {
+    emails_.add(email);
+  }
+
+  /**
+   * @brief {"window", "blockThreshold", "ips": [{"key", "requests", "blocked"}], "emails": [{"key", "requests"}],
+   * "blocked": [{"ip", "secondsLeft"}]}, the counts being estimates over the last window.
+   */
+  crow::json::wvalue report()
+  {
+    crow::json::wvalue result;
+    result["window"] = static_cast<int64_t>(ips_.window().count());
+    result["blockThreshold"] = block_threshold_.load(std::memory_order_relaxed);
+
+    crow::json::wvalue ips(crow::json::wvalue::list{});
+    int i = 0;
+    for (const auto &ip : ips_.top())
+    {
+      crow::json::wvalue entry;
+      entry["key"] = ip.key;
+      entry["requests"] = ip.count;
+      entry["blocked"] = blocked(ip.key);
+      ips[i++] = std::move(entry);
+    }
+    result["ips"] = std::move(ips);
+
+    crow::json::wvalue emails(crow::json::wvalue::list{});
+    i = 0;
+    for (const auto &email : emails_.top())
+    {
+      crow::json::wvalue entry;
+      entry["key"] = email.key;
+      entry["requests"] = email.count;
+      emails[i++] = std::move(entry);
+    }
+    result["emails"] = std::move(emails);
+
+    crow::json::wvalue blocked_ips(crow::json::wvalue::list{});
+    i = 0;
+    int64_t now = now_ms();
+    state_->blocks.for_each([&blocked_ips, &i, now](const std::string &ip_address, const std::atomic<int64_t> &until)
+    {
+      int64_t until_ms = until.load(std::memory_order_relaxed);
+      if (until_ms > now)
+      {
+        crow::json::wvalue entry;
+        entry["ip"] = ip_address;
+        entry["secondsLeft"] = (until_ms - now) / 1000;
+        blocked_ips[i++] = std::move(entry);
+      }
+    });
+    result["blocked"] = std::move(blocked_ips);
+    return result;
+  }
+
+private:
+  typedef abuse_guard_state::block_table block_table;
+
+  static int64_t now_ms()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void block(const std::string &ip_address, uint32_t requests)
+  {
+    int64_t now = now_ms();
+    int64_t duration_ms = block_duration_ms_.load(std::memory_order_relaxed);
+    int64_t until = now + duration_ms;
+    bool claimed = false;
+    // Blocks of IPs that never came back are only taken over by new ones
+    block_table::slot *found = state_->blocks.find_or_claim(ip_address, block_table::hash_key(ip_address),
+      [now](const std::atomic<int64_t> &blocked_until) { return blocked_until.load(std::memory_order_relaxed) <= now; },
+      [until, &claimed](std::atomic<int64_t> &blocked_until)
+      {
+        blocked_until.store(until, std::memory_order_relaxed);
+        claimed = true;
+      });
+    if (!found)
+    {
+      CROW_SLOG_ERROR("ip_block_failed").kv("reason", "block table full").kv("ip", ip_address);
+      return;
+    }
+
+    int64_t previous = claimed ? 0 : found->value.exchange(until, std::memory_order_relaxed);
+    int64_t latest = state_->latest_block_until_ms.load(std::memory_order_relaxed);
+    while (latest < until && !state_->latest_block_until_ms.compare_exchange_weak(latest, until, std::memory_order_relaxed))
+    {
+    }
+    if (previous <= now)
+    {
+      CROW_SLOG_WARNING("ip_blocked").kv("ip", ip_address).kv("requests", requests).kv("seconds", duration_ms / 1000);
+    }
+  }
+
+  heavy_hitters ips_;
+  heavy_hitters emails_;
+  std::unique_ptr<abuse_guard_state> own_state_;
+  abuse_guard_state *state_;
+
+  std::atomic<uint32_t> block_threshold_{0};
+  std::atomic<int64_t> block_duration_ms_{300000};
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <mutex>
 #include <string>
@@ -15,6 +17,8 @@
 #include <bcrypt/BCrypt.hpp>
 #include <jwt-cpp/jwt.h>
 
+#include <crow.h>
+
 /**
  * @brief Verifies that the JWT token sent through the POST request is valid and
  * has not expired/been tampered with.
@@ -40,7 +44,7 @@ bool verifyToken(const std::string &token, const std::string &secret_key_string,
   }
   catch (const std::exception &e)
   {
-    std::cerr << "Token verification error: " << e.what() << std::endl;
+    CROW_SLOG_INFO("token_verification_error").kv("error", e.what());
     return false;
   }
 
@@ -69,7 +73,7 @@ std::string extractEmailFromToken(const std::string &token, const std::string &s
   }
   catch (const std::exception &e)
   {
-    std::cerr << "Token decoding/verification error: " << e.what() << std::endl;
+    CROW_SLOG_INFO("token_decoding_error").kv("error", e.what());
     return "";
   }
 }
@@ -97,7 +101,7 @@ std::string extractUidFromToken(const std::string &token, const std::string &sec
   }
   catch (const std::exception &e)
   {
-    std::cerr << "Token decoding/verification error: " << e.what() << std::endl;
+    CROW_SLOG_INFO("token_decoding_error").kv("error", e.what());
     return "";
   }
 }
@@ -141,4 +145,59 @@ bool is_rate_limited(std::unordered_map<std::string, std::pair<int, std::chrono:
 
 
 
+/**
+ * @brief Masks an email for the logs: its domain behind a short hash of the whole address, e.g. "3fa1c2d9@example.com",
+ * so attempts on one account can still be correlated without the address being stored.
+ *
+ * @param email the email as sent by the client
+ * @return std::string the masked email
+ */
+std::string email_log_tag(const std::string &email)
+{
+  // FNV-1a, the same for every process and release
+  uint32_t hash = 2166136261u;
+  for (char c : email)
+  {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+  }
+  char tag[9];
+  snprintf(tag, sizeof(tag), "%08x", hash);
+
+  size_t at = email.rfind('@');
+  return std::string(tag) + (at == std::string::npos ? std::string() : email.substr(at));
+}
+
+/**
+ * @brief Determines whether the request carries the admin token (`Authorization: Bearer <ADMIN_TOKEN>`).
+ * Admin endpoints are unreachable when the ADMIN_TOKEN environment variable is not set.
+ *
+ * @param req the incoming request
+ * @return true if the request is authorized for admin endpoints
+ */
+bool is_admin_request(const crow::request &req)
+{
+  const char *admin_token = std::getenv("ADMIN_TOKEN");
+  if (!admin_token || !*admin_token)
+  {
+    return false;
+  }
+
+  const std::string prefix = "Bearer ";
+  const std::string &authorization = req.get_header_value("Authorization");
+  if (authorization.compare(0, prefix.size(), prefix) != 0)
+  {
+    return false;
+  }
+
+  // Compare in constant time so the token cannot be guessed byte by byte
+  const std::string expected(admin_token);
+  const std::string provided = authorization.substr(prefix.size());
+  unsigned char difference = expected.size() == provided.size() ? 0 : 1;
+  for (size_t i = 0; i < provided.size(); i++)
+  {
+    difference |= static_cast<unsigned char>(provided[i] ^ expected[i % expected.size()]);
+  }
+  return difference == 0;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// authentication.hpp defines its functions out of line, so only this file in the target may include it
+#include "authentication.hpp"
+
+static const char bench_secret_key[] = "cart-checkout-bench-secret";
+
+static std::string bench_token(const std::string &issuer)
+{
+  return jwt::create()
+    .set_issuer(issuer)
+    .set_type("JWS")
+    .set_payload_claim("email", jwt::claim(std::string("golfer1@example.com")))
+    .set_payload_claim("uid", jwt::claim(std::string("652f1c9ae4b0d23a98765432")))
+    .set_issued_at(std::chrono::system_clock::now())
+    .set_expires_at(std::chrono::system_clock::now() + std::chrono::seconds{60*60*24*7})
+    .sign(jwt::algorithm::hs256{bench_secret_key});
+}
+
+/**
+ * @brief /verify-token on every page load: a valid token, and one from another issuer (rejected after the signature check).
+ */
+static void BM_VerifyToken(benchmark::State &state)
+{
+  crow::logger::setLogLevel(crow::LogLevel::Error);
+  const std::string token = bench_token(state.range(0) ? "cartapp" : "someone-else");
+  const std::string secret_key_string(bench_secret_key);
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(verifyToken(token, secret_key_string, "cartapp"));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_VerifyToken)->Arg(1)->Arg(0);
+
+/**
+ * @brief The rate limiter with as many clients as a busy morning tee sheet, cycling through their addresses.
+ */
+static void BM_IsRateLimited(benchmark::State &state)
+{
+  std::unordered_map<std::string, std::pair<int, std::chrono::time_point<std::chrono::steady_clock>>> rate_limit_map;
+  std::vector<std::string> addresses;
+  for (int i = 0; i < state.range(0); i++)
+  {
+    addresses.push_back("10." + std::to_string(i / 65536 % 256) + "." + std::to_string(i / 256 % 256) + "." + std::to_string(i % 256));
+  }
+
+  size_t i = 0;
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(is_rate_limited(rate_limit_map, addresses[i]));
+    i = (i + 1) % addresses.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_IsRateLimited)->Arg(16)->Arg(4096);
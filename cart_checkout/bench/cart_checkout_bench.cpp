@@ -0,0 +1,529 @@
+// In-process load generator: starts the cart_checkout routes on a loopback port backed by in_memory_storage
+// and drives them with keep-alive asio clients, one scenario at a time.
+//
+// usage: cart_checkout_bench [--scenario all|static|login|verify|carts|mixed] [--duration seconds] [--warmup seconds]
+//                            [--connections n] [--client-threads n] [--server-threads n] [--port n] [--output file]
+//                            [--storage-latency-us n] [--storage-jitter-us n]
+//
+// Prints one JSON document with the throughput and latency percentiles of every scenario.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include "routes.hpp"
+#include "storage.hpp"
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+/**
+ * @brief Benchmark settings, fixed defaults so runs are comparable.
+ */
+struct bench_config
+{
+  std::string scenario = "all";
+  double duration_s = 10;
+  double warmup_s = 2;
+  unsigned connections = 32;
+  unsigned client_threads = 4;
+  unsigned server_threads = 4;
+  uint16_t port = 18199;
+  std::string output;
+  long long storage_latency_us = 0;
+  long long storage_jitter_us = 0;
+};
+
+/**
+ * @brief One user seeded into the store, with the password used by the login scenario.
+ */
+struct bench_user
+{
+  std::string email;
+  std::string password;
+};
+
+/**
+ * @brief Builds the raw HTTP/1.1 requests of a scenario; each connection draws from it with its own seeded generator.
+ */
+class scenario
+{
+public:
+  scenario(std::string name) : name_(std::move(name)) {}
+
+  void add(const std::string &request, unsigned weight)
+  {
+    requests_.push_back(request);
+    total_weight_ += weight;
+    cumulative_weights_.push_back(total_weight_);
+  }
+
+  const std::string &next(std::mt19937 &rng) const
+  {
+    unsigned pick = std::uniform_int_distribution<unsigned>(0, total_weight_ - 1)(rng);
+    size_t index = std::upper_bound(cumulative_weights_.begin(), cumulative_weights_.end(), pick) - cumulative_weights_.begin();
+    return requests_[index];
+  }
+
+  const std::string &name() const
+  {
+    return name_;
+  }
+
+private:
+  std::string name_;
+  std::vector<std::string> requests_;
+  std::vector<unsigned> cumulative_weights_;
+  unsigned total_weight_ = 0;
+};
+
+std::string get_request(const std::string &path)
+{
+  return "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+}
+
+std::string post_request(const std::string &path, const std::string &body, const std::string &cookie = "")
+{
+  std::string request = "POST " + path + " HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\n";
+  if (!cookie.empty())
+  {
+    request += "Cookie: " + cookie + "\r\n";
+  }
+  request += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+  return request;
+}
+
+/**
+ * @brief Results of one scenario, merged from every connection.
+ */
+struct scenario_result
+{
+  std::vector<uint32_t> latencies_us;
+  std::map<int, uint64_t> status_counts;
+  uint64_t errors = 0;
+  double elapsed_s = 0;
+};
+
+/**
+ * @brief A keep-alive client connection sending one request at a time until the deadline.
+ */
+class bench_connection
+{
+public:
+  bench_connection(asio::io_service &io_service, const tcp::endpoint &endpoint, const scenario &load, unsigned seed)
+    : socket_(io_service), endpoint_(endpoint), scenario_(load), rng_(seed)
+  {
+  }
+
+  void start(std::chrono::steady_clock::time_point record_from, std::chrono::steady_clock::time_point deadline)
+  {
+    record_from_ = record_from;
+    deadline_ = deadline;
+    socket_.async_connect(endpoint_, [this](const boost::system::error_code &ec)
+    {
+      if (ec)
+      {
+        errors_++;
+        return;
+      }
+      socket_.set_option(tcp::no_delay(true));
+      send_next();
+    });
+  }
+
+  void collect(scenario_result &result) const
+  {
+    result.latencies_us.insert(result.latencies_us.end(), latencies_us_.begin(), latencies_us_.end());
+    for (const auto &status : status_counts_)
+    {
+      result.status_counts[status.first] += status.second;
+    }
+    result.errors += errors_;
+  }
+
+private:
+  void send_next()
+  {
+    if (std::chrono::steady_clock::now() >= deadline_)
+    {
+      boost::system::error_code ignored;
+      socket_.close(ignored);
+      return;
+    }
+
+    request_ = &scenario_.next(rng_);
+    sent_at_ = std::chrono::steady_clock::now();
+    asio::async_write(socket_, asio::buffer(*request_), [this](const boost::system::error_code &ec, std::size_t)
+    {
+      if (ec)
+      {
+        errors_++;
+        return;
+      }
+      asio::async_read_until(socket_, buffer_, "\r\n\r\n", [this](const boost::system::error_code &ec, std::size_t header_bytes)
+      {
+        on_headers(ec, header_bytes);
+      });
+    });
+  }
+
+  void on_headers(const boost::system::error_code &ec, std::size_t header_bytes)
+  {
+    if (ec)
+    {
+      errors_++;
+      return;
+    }
+
+    std::string headers(asio::buffers_begin(buffer_.data()), asio::buffers_begin(buffer_.data()) + header_bytes);
+    buffer_.consume(header_bytes);
+
+    int status = 0;
+    if (headers.size() > 12)
+    {
+      status = std::atoi(headers.c_str() + 9); // "HTTP/1.1 200 OK"
+    }
+    size_t content_length = 0;
+    size_t position = headers.find("Content-Length: ");
+    if (position == std::string::npos)
+    {
+      position = headers.find("content-length: ");
+    }
+    if (position != std::string::npos)
+    {
+      content_length = std::strtoul(headers.c_str() + position + 16, nullptr, 10);
+    }
+
+    if (buffer_.size() >= content_length)
+    {
+      buffer_.consume(content_length);
+      on_response(status);
+      return;
+    }
+
+    asio::async_read(socket_, buffer_, asio::transfer_exactly(content_length - buffer_.size()), [this, status, content_length](const boost::system::error_code &ec, std::size_t)
+    {
+      if (ec)
+      {
+        errors_++;
+        return;
+      }
+      buffer_.consume(content_length);
+      on_response(status);
+    });
+  }
+
+  void on_response(int status)
+  {
+    auto now = std::chrono::steady_clock::now();
+    if (sent_at_ >= record_from_)
+    {
+      latencies_us_.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - sent_at_).count()));
+      status_counts_[status]++;
+    }
+    send_next();
+  }
+
+  tcp::socket socket_;
+  tcp::endpoint endpoint_;
+  const scenario &scenario_;
+  std::mt19937 rng_;
+
+  asio::streambuf buffer_;
+  const std::string *request_ = nullptr;
+  std::chrono::steady_clock::time_point sent_at_;
+  std::chrono::steady_clock::time_point record_from_;
+  std::chrono::steady_clock::time_point deadline_;
+
+  std::vector<uint32_t> latencies_us_;
+  std::map<int, uint64_t> status_counts_;
+  uint64_t errors_ = 0;
+};
+
+scenario_result run_scenario(const scenario &load, const bench_config &config, const tcp::endpoint &endpoint)
+{
+  asio::io_service io_service;
+  std::vector<std::unique_ptr<bench_connection>> connections;
+  for (unsigned i = 0; i < config.connections; i++)
+  {
+    // Fixed seeds make every run send the same request sequence
+    connections.emplace_back(new bench_connection(io_service, endpoint, load, 1000 + i));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto record_from = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(config.warmup_s));
+  auto deadline = record_from + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(config.duration_s));
+  for (auto &connection : connections)
+  {
+    connection->start(record_from, deadline);
+  }
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < std::max(1u, config.client_threads); i++)
+  {
+    threads.emplace_back([&io_service] { io_service.run(); });
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  scenario_result result;
+  result.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - record_from).count();
+  for (const auto &connection : connections)
+  {
+    connection->collect(result);
+  }
+  return result;
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double quantile)
+{
+  if (sorted.empty())
+  {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(quantile * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+crow::json::wvalue report(const scenario &load, scenario_result &result)
+{
+  std::sort(result.latencies_us.begin(), result.latencies_us.end());
+  uint64_t total_us = 0;
+  for (uint32_t latency : result.latencies_us)
+  {
+    total_us += latency;
+  }
+
+  crow::json::wvalue json;
+  json["name"] = load.name();
+  json["requests"] = static_cast<uint64_t>(result.latencies_us.size());
+  json["errors"] = result.errors;
+  json["duration_s"] = result.elapsed_s;
+  json["throughput_rps"] = result.elapsed_s > 0 ? result.latencies_us.size() / result.elapsed_s : 0;
+  json["latency_us"]["mean"] = result.latencies_us.empty() ? 0 : static_cast<double>(total_us) / result.latencies_us.size();
+  json["latency_us"]["p50"] = percentile(result.latencies_us, 0.5);
+  json["latency_us"]["p99"] = percentile(result.latencies_us, 0.99);
+  json["latency_us"]["p99.9"] = percentile(result.latencies_us, 0.999);
+  json["latency_us"]["max"] = result.latencies_us.empty() ? 0 : result.latencies_us.back();
+  for (const auto &status : result.status_counts)
+  {
+    json["status"][std::to_string(status.first)] = status.second;
+  }
+  return json;
+}
+
+/**
+ * @brief Writes the frontend fixtures served by the static scenario into a temporary directory.
+ */
+std::string write_static_fixtures()
+{
+  char root_template[] = "/tmp/cart_checkout_bench.XXXXXX";
+  std::string root = mkdtemp(root_template);
+  mkdir((root + "/assets").c_str(), 0755);
+
+  std::ofstream(root + "/index.html") << "<!doctype html><html><head><script type=\"module\" src=\"/assets/index.js\"></script>"
+                                      << "<link rel=\"stylesheet\" href=\"/assets/index.css\"></head><body><div id=\"root\"></div></body></html>\n";
+  std::ofstream(root + "/manifest.json") << "{\"short_name\":\"Carts\",\"name\":\"Humboldt Hill Cart Checkout\",\"start_url\":\".\"}\n";
+  std::ofstream(root + "/assets/index.js") << std::string(160 * 1024, 'j');
+  std::ofstream(root + "/assets/index.css") << std::string(12 * 1024, 'c');
+  return root;
+}
+
+bool parse_arguments(int argc, const char *argv[], bench_config &config)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      return false;
+    }
+    std::string value = argv[++i];
+    if (arg == "--scenario") config.scenario = value;
+    else if (arg == "--duration") config.duration_s = std::atof(value.c_str());
+    else if (arg == "--warmup") config.warmup_s = std::atof(value.c_str());
+    else if (arg == "--connections") config.connections = static_cast<unsigned>(std::atoi(value.c_str()));
+    else if (arg == "--client-threads") config.client_threads = static_cast<unsigned>(std::atoi(value.c_str()));
+    else if (arg == "--server-threads") config.server_threads = static_cast<unsigned>(std::atoi(value.c_str()));
+    else if (arg == "--port") config.port = static_cast<uint16_t>(std::atoi(value.c_str()));
+    else if (arg == "--output") config.output = value;
+    else if (arg == "--storage-latency-us") config.storage_latency_us = std::atoll(value.c_str());
+    else if (arg == "--storage-jitter-us") config.storage_jitter_us = std::atoll(value.c_str());
+    else return false;
+  }
+  return true;
+}
+
+int main(int argc, const char *argv[])
+{
+  bench_config config;
+  if (!parse_arguments(argc, argv, config))
+  {
+    std::cerr << "usage: " << argv[0] << " [--scenario all|static|login|verify|carts|mixed] [--duration s] [--warmup s] [--connections n]"
+              << " [--client-threads n] [--server-threads n] [--port n] [--output file]"
+              << " [--storage-latency-us n] [--storage-jitter-us n]" << std::endl;
+    return 1;
+  }
+
+  // Same secrets on every run, so tokens and hashes behave identically
+  setenv("SECRET_KEY", "cart-checkout-bench-secret", 0);
+  setenv("SECRET_KEY_PEPPER", "cart-checkout-bench-pepper", 0);
+  std::string static_root = write_static_fixtures();
+  setenv("STATIC_CONTENT_ROOT", static_root.c_str(), 1);
+  std::string pepper = std::getenv("SECRET_KEY_PEPPER");
+
+  // Seed users (hashed exactly like /register does) and carts
+  in_memory_storage store;
+  std::vector<bench_user> users;
+  for (int i = 0; i < 8; i++)
+  {
+    bench_user user{"golfer" + std::to_string(i) + "@example.com", "password-" + std::to_string(i)};
+    user_record record;
+    record.email = user.email;
+    record.name = "Golfer " + std::to_string(i);
+    record.password_hash = BCrypt::generateHash(user.password + pepper);
+    std::string uid;
+    store.insert_user(record, uid);
+    users.push_back(user);
+  }
+  for (int i = 0; i < 40; i++)
+  {
+    cart_record cart;
+    cart.name = "Cart " + std::to_string(i + 1);
+    cart.type = i % 3;
+    cart.available = i % 4 != 0;
+    store.insert_cart(cart);
+  }
+
+  crow::logger::setLogLevel(crow::LogLevel::Error);
+  cart_checkout_app app;
+  app.enable_metrics();
+  // Stand-in for the MongoDB round trip, added on top of the in-memory lookups
+  latency_injecting_storage delayed_store(store, std::chrono::microseconds(config.storage_latency_us), std::chrono::microseconds(config.storage_jitter_us));
+  route_context context(delayed_store);
+  context.rate_limiting = false; // every client shares 127.0.0.1
+  register_routes(app, context);
+  app.bindaddr("127.0.0.1").port(config.port).concurrency(static_cast<uint16_t>(std::max(1u, config.server_threads)));
+  auto server = app.run_async();
+  app.wait_for_server_start();
+  tcp::endpoint endpoint(asio::ip::address_v4::loopback(), config.port);
+
+  // Log in once (retrying while the acceptor comes up) to get a token for the verify-token scenario
+  std::string cookie;
+  for (int attempt = 0; attempt < 50 && cookie.empty(); attempt++)
+  {
+    try
+    {
+      asio::io_service io_service;
+      tcp::socket socket(io_service);
+      socket.connect(endpoint);
+      asio::write(socket, asio::buffer(post_request("/login", "{\"email\":\"" + users[0].email + "\",\"password\":\"" + users[0].password + "\"}")));
+      asio::streambuf response;
+      asio::read_until(socket, response, "\r\n\r\n");
+      std::string headers(asio::buffers_begin(response.data()), asio::buffers_end(response.data()));
+      size_t position = headers.find("jwtToken=");
+      if (position != std::string::npos)
+      {
+        cookie = headers.substr(position, headers.find(';', position) - position);
+      }
+    }
+    catch (const std::exception &)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+  if (cookie.empty())
+  {
+    std::cerr << "Could not log in to the benchmark server" << std::endl;
+  }
+
+  std::vector<scenario> scenarios;
+
+  scenario static_storm("static_page_load");
+  static_storm.add(get_request("/"), 4);
+  static_storm.add(get_request("/assets/index.js"), 4);
+  static_storm.add(get_request("/assets/index.css"), 4);
+  static_storm.add(get_request("/manifest.json"), 1);
+  static_storm.add(get_request("/login"), 1);
+
+  scenario login_rush("login_rush");
+  for (const auto &user : users)
+  {
+    login_rush.add(post_request("/login", "{\"email\":\"" + user.email + "\",\"password\":\"" + user.password + "\"}"), 4);
+  }
+  login_rush.add(post_request("/login", "{\"email\":\"" + users[0].email + "\",\"password\":\"wrong\"}"), 1);
+  login_rush.add(post_request("/login", "{\"email\":\"nobody@example.com\",\"password\":\"wrong\"}"), 1);
+
+  scenario verify_polling("verify_token_polling");
+  verify_polling.add(post_request("/verify-token", "", cookie), 1);
+
+  scenario cart_refresh("cart_info_refresh");
+  cart_refresh.add(post_request("/cart-info", ""), 1);
+
+  // Roughly what one browser session sends: a page load, a few polls and refreshes, rarely a login
+  scenario mixed("mixed");
+  mixed.add(get_request("/"), 10);
+  mixed.add(get_request("/assets/index.js"), 10);
+  mixed.add(get_request("/assets/index.css"), 10);
+  mixed.add(post_request("/verify-token", "", cookie), 40);
+  mixed.add(post_request("/cart-info", ""), 28);
+  mixed.add(post_request("/login", "{\"email\":\"" + users[1].email + "\",\"password\":\"" + users[1].password + "\"}"), 2);
+
+  std::map<std::string, const scenario *> by_option = {
+    {"static", &static_storm}, {"login", &login_rush}, {"verify", &verify_polling}, {"carts", &cart_refresh}, {"mixed", &mixed}};
+
+  crow::json::wvalue output;
+  output["config"]["connections"] = config.connections;
+  output["config"]["client_threads"] = config.client_threads;
+  output["config"]["server_threads"] = config.server_threads;
+  output["config"]["duration_s"] = config.duration_s;
+  output["config"]["warmup_s"] = config.warmup_s;
+  output["config"]["storage_latency_us"] = config.storage_latency_us;
+  output["config"]["storage_jitter_us"] = config.storage_jitter_us;
+
+  int index = 0;
+  for (const char *option : {"static", "login", "verify", "carts", "mixed"})
+  {
+    if (config.scenario != "all" && config.scenario != option)
+    {
+      continue;
+    }
+    const scenario &load = *by_option[option];
+    std::cerr << "Running " << load.name() << "..." << std::endl;
+    scenario_result result = run_scenario(load, config, endpoint);
+    output["scenarios"][index++] = report(load, result);
+  }
+
+  app.stop();
+  server.wait();
+  boost::filesystem::remove_all(static_root);
+
+  std::string json = output.dump();
+  if (config.output.empty())
+  {
+    std::cout << json << std::endl;
+  }
+  else
+  {
+    std::ofstream(config.output) << json << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "checkout-sequencer.hpp"
+#include "storage.hpp"
+
+// A shotgun start: 1,000 members check out one of the 8 carts nearest the clubhouse at the same moment.
+// Every store round trip costs 500us, about what a checkout write to the Carts collection costs in production.
+
+static const int shotgun_members = 1000;
+static const int popular_carts = 8;
+
+static void seed_fleet(in_memory_storage &store, std::vector<std::string> &cart_ids)
+{
+  for (int i = 0; i < 96; i++)
+  {
+    cart_record cart;
+    cart.name = "Cart " + std::to_string(i + 1);
+    cart.type = i % 3 == 0 ? 4 : 2;
+    cart.available = true;
+    cart_ids.push_back(store.insert_cart(cart));
+  }
+}
+
+/**
+ * @brief Starts one thread per member, releases them together and returns how long until every member had an answer.
+ */
+template <typename Checkout>
+static double shotgun_start(Checkout checkout, std::atomic<int> &granted)
+{
+  std::atomic<bool> go{false};
+  std::atomic<int> ready{0};
+  std::vector<std::thread> members;
+  for (int member = 0; member < shotgun_members; member++)
+  {
+    members.emplace_back([&, member]
+    {
+      ready++;
+      while (!go.load(std::memory_order_acquire))
+      {
+        std::this_thread::yield();
+      }
+      if (checkout(member))
+      {
+        granted++;
+      }
+    });
+  }
+  while (ready.load() < shotgun_members)
+  {
+    std::this_thread::yield();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto &member : members)
+  {
+    member.join();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void BM_CheckoutSequencer_ShotgunStart(benchmark::State &state)
+{
+  in_memory_storage memory;
+  latency_injecting_storage store(memory, std::chrono::microseconds(500), std::chrono::microseconds(0));
+  std::vector<std::string> cart_ids;
+  seed_fleet(memory, cart_ids);
+
+  uint64_t batches = 0;
+  int granted_total = 0;
+  for (auto _ : state)
+  {
+    checkout_sequencer sequencer(store);
+    sequencer.start();
+    std::atomic<int> granted{0};
+    double seconds = shotgun_start([&](int member)
+    {
+      std::string uid = "member-" + std::to_string(member);
+      return sequencer.checkout(cart_ids[member % popular_carts], -1, uid).get().status == checkout_status::ok;
+    }, granted);
+    state.SetIterationTime(seconds);
+    batches += sequencer.batches();
+    granted_total += granted;
+
+    state.PauseTiming();
+    sequencer.stop();
+    std::vector<cart_update> reset;
+    for (const auto &id : cart_ids)
+    {
+      cart_update update;
+      update.cart_id = id;
+      update.available = true;
+      reset.push_back(update);
+    }
+    memory.update_carts(reset);
+    state.ResumeTiming();
+  }
+  state.counters["granted"] = benchmark::Counter(granted_total, benchmark::Counter::kAvgIterations);
+  state.counters["store_round_trips"] = benchmark::Counter(static_cast<double>(batches), benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * shotgun_members);
+}
+BENCHMARK(BM_CheckoutSequencer_ShotgunStart)->UseManualTime()->Unit(benchmark::kMillisecond)->Iterations(5);
+
+/**
+ * @brief Baseline: the read-then-update a handler would do on its own, serialized by a lock so no update is lost.
+ */
+static void BM_LockedReadThenUpdate_ShotgunStart(benchmark::State &state)
+{
+  in_memory_storage memory;
+  latency_injecting_storage store(memory, std::chrono::microseconds(500), std::chrono::microseconds(0));
+  std::vector<std::string> cart_ids;
+  seed_fleet(memory, cart_ids);
+
+  int granted_total = 0;
+  for (auto _ : state)
+  {
+    std::mutex lock;
+    std::atomic<int> granted{0};
+    double seconds = shotgun_start([&](int member)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for (const auto &cart : store.list_carts())
+      {
+        if (cart.id == cart_ids[member % popular_carts])
+        {
+          if (!cart.available)
+          {
+            return false;
+          }
+          cart_update update;
+          update.cart_id = cart.id;
+          update.holder = "member-" + std::to_string(member);
+          return store.update_carts({update});
+        }
+      }
+      return false;
+    }, granted);
+    state.SetIterationTime(seconds);
+    granted_total += granted;
+
+    state.PauseTiming();
+    std::vector<cart_update> reset;
+    for (const auto &id : cart_ids)
+    {
+      cart_update update;
+      update.cart_id = id;
+      update.available = true;
+      reset.push_back(update);
+    }
+    memory.update_carts(reset);
+    state.ResumeTiming();
+  }
+  state.counters["granted"] = benchmark::Counter(granted_total, benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * shotgun_members);
+}
+BENCHMARK(BM_LockedReadThenUpdate_ShotgunStart)->UseManualTime()->Unit(benchmark::kMillisecond)->Iterations(2);
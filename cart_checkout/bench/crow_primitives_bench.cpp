@@ -0,0 +1,224 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <crow.h>
+#include <crow/middlewares/cookie_parser.h>
+#ifdef CROW_ENABLE_COMPRESSION
+#include <crow/compression.h>
+#endif
+
+// Inputs mirror what the frontend actually sends: a Chromium request with the jwtToken cookie,
+// the app's route table and the /cart-info response body.
+
+static const char bench_jwt[] =
+  "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXUyJ9.eyJlbWFpbCI6ImdvbGZlcjFAZXhhbXBsZS5jb20iLCJleHAiOjE3MzA4NDU2MDAsImlhdCI6MTczMDI0MDgwMCwi"
+  "aXNzIjoiY2FydGFwcCIsInVpZCI6IjY1MmYxYzlhZTRiMGQyM2E5ODc2NTQzMiJ9.0Hq4Qm2sWJ3N1bQ7S6x4Yv3uVz9p8kR2tF5aL1cE0dM";
+
+static std::string browser_request(const std::string &method, const std::string &url, const std::string &body)
+{
+  std::string request = method + " " + url + " HTTP/1.1\r\n"
+    "Host: carts.humboldthill.golf\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Origin: https://carts.humboldthill.golf\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: cors\r\n"
+    "Sec-Fetch-Dest: empty\r\n"
+    "Referer: https://carts.humboldthill.golf/checkout\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Cookie: _ga=GA1.1.1392046713.1697062711; jwtToken=" + std::string(bench_jwt) + "; _ga_X1Y2Z3=GS1.1.1697062711.3.1.1697063012.0.0.0\r\n";
+  if (!body.empty())
+  {
+    request += "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+  }
+  return request + "\r\n" + body;
+}
+
+static std::string cart_info_body()
+{
+  crow::json::wvalue carts;
+  for (int i = 0; i < 40; i++)
+  {
+    carts[i]["id"] = "652f1c9ae4b0d23a987654" + std::to_string(10 + i);
+    carts[i]["name"] = "Cart " + std::to_string(i + 1);
+    carts[i]["type"] = i % 3;
+    carts[i]["available"] = i % 4 != 0;
+  }
+  crow::json::wvalue body;
+  body["carts"] = std::move(carts);
+  return body.dump();
+}
+
+/**
+ * @brief Connection stand-in for HTTPParser, which only calls back when headers / a message are complete.
+ */
+struct null_parser_handler
+{
+  void handle_header() {}
+  void handle() {}
+};
+
+static void BM_HTTPParser_Feed(benchmark::State &state)
+{
+  const std::string request = state.range(0) ?
+    browser_request("POST", "/login", "{\"email\":\"golfer1@example.com\",\"password\":\"correct horse battery staple\"}") :
+    browser_request("GET", "/assets/index-4f2a9c1e.js", "");
+
+  null_parser_handler handler;
+  crow::HTTPParser<null_parser_handler> parser(&handler);
+  for (auto _ : state)
+  {
+    parser.clear();
+    benchmark::DoNotOptimize(parser.feed(request.data(), static_cast<int>(request.size())));
+  }
+  state.SetBytesProcessed(state.iterations() * request.size());
+}
+BENCHMARK(BM_HTTPParser_Feed)->Arg(0)->Arg(1);
+
+/**
+ * @brief The same trie the app builds, for the static GET routes.
+ */
+static const crow::Trie &bench_trie()
+{
+  static crow::Trie trie;
+  static bool initialized = [] {
+    const char *routes[] = {"/", "/index.html", "/login", "/register", "/checkout", "/manifest.json", "/favicon.ico",
+                            "/asset-manifest.json", "/static/css/<string>", "/static/js/<string>", "/static/media/<string>",
+                            "/assets/<string>", "/<string>", "/metrics", "/debug/profile"};
+    uint16_t rule_index = 1;
+    for (const char *route : routes)
+    {
+      trie.add(route, rule_index++);
+    }
+    trie.validate();
+    return true;
+  }();
+  (void)initialized;
+  return trie;
+}
+
+static void BM_Trie_Find(benchmark::State &state)
+{
+  const crow::Trie &trie = bench_trie();
+  const std::vector<std::string> urls = {"/", "/assets/index-4f2a9c1e.js", "/checkout", "/static/css/main.8c3f1a2b.css", "/manifest.json", "/dashboard"};
+  size_t i = 0;
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(trie.find(urls[i]));
+    i = (i + 1) % urls.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Trie_Find);
+
+static void BM_CiMap_Lookup(benchmark::State &state)
+{
+  const std::string request = browser_request("POST", "/verify-token", "");
+  null_parser_handler handler;
+  crow::HTTPParser<null_parser_handler> parser(&handler);
+  parser.feed(request.data(), static_cast<int>(request.size()));
+  const crow::ci_map headers = parser.headers;
+
+  // Headers the server and middlewares look up on every request, in the case the browser sends them
+  const std::vector<std::string> keys = {"cookie", "Content-Length", "upgrade", "X-Forwarded-For", "expect", "accept-encoding"};
+  size_t i = 0;
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(headers.find(keys[i]));
+    i = (i + 1) % keys.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CiMap_Lookup);
+
+static void BM_QueryString_Construct(benchmark::State &state)
+{
+  const std::string url = state.range(0) ? "/debug/profile?seconds=10&hz=199" : "/assets/index-4f2a9c1e.js";
+  for (auto _ : state)
+  {
+    crow::query_string qs(url);
+    benchmark::DoNotOptimize(qs);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_QueryString_Construct)->Arg(0)->Arg(1);
+
+static void BM_CookieParser_BeforeHandle(benchmark::State &state)
+{
+  const std::string raw = browser_request("POST", "/verify-token", "");
+  null_parser_handler handler;
+  crow::HTTPParser<null_parser_handler> parser(&handler);
+  parser.feed(raw.data(), static_cast<int>(raw.size()));
+  const crow::request request = parser.to_request();
+
+  crow::CookieParser cookie_parser;
+  for (auto _ : state)
+  {
+    crow::request req = request;
+    crow::response res;
+    crow::CookieParser::context ctx;
+    cookie_parser.before_handle(req, res, ctx);
+    benchmark::DoNotOptimize(ctx.jar);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CookieParser_BeforeHandle);
+
+static void BM_Json_Load(benchmark::State &state)
+{
+  const std::string body = state.range(0) ? cart_info_body() : "{\"email\":\"golfer1@example.com\",\"password\":\"correct horse battery staple\"}";
+  for (auto _ : state)
+  {
+    auto json = crow::json::load(body);
+    benchmark::DoNotOptimize(json);
+  }
+  state.SetBytesProcessed(state.iterations() * body.size());
+}
+BENCHMARK(BM_Json_Load)->Arg(0)->Arg(1);
+
+static void BM_Json_Dump(benchmark::State &state)
+{
+  const crow::json::wvalue carts(crow::json::load(cart_info_body()));
+  size_t bytes = 0;
+  for (auto _ : state)
+  {
+    std::string body = carts.dump();
+    bytes += body.size();
+    benchmark::DoNotOptimize(body);
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_Json_Dump);
+
+#ifdef CROW_ENABLE_COMPRESSION
+static void BM_CompressString(benchmark::State &state)
+{
+  const std::string body = cart_info_body();
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(crow::compression::compress_string(body, crow::compression::GZIP));
+  }
+  state.SetBytesProcessed(state.iterations() * body.size());
+}
+BENCHMARK(BM_CompressString);
+#endif
+
+static void BM_Base64Encode(benchmark::State &state)
+{
+  // The size of a websocket handshake digest and of a JWT signature
+  const std::string data(static_cast<size_t>(state.range(0)), '\x5a');
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(crow::utility::base64encode(data, data.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Base64Encode)->Arg(20)->Arg(32)->Arg(1024);
@@ -0,0 +1,95 @@
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "reservation-engine.hpp"
+
+/**
+ * @brief A fleet of 96 carts (a third of them 4-seaters) with a full 210-day season of bookings:
+ * about 60% of every cart's day between 07:00 and 19:00 is taken, in 1 to 5 hour rounds.
+ */
+static reservation_engine &bench_engine()
+{
+  static in_memory_storage store;
+  static reservation_engine engine(store);
+  static bool initialized = [] {
+    for (int i = 0; i < 96; i++)
+    {
+      cart_record cart;
+      cart.name = "Cart " + std::to_string(i + 1);
+      cart.type = i % 3 == 0 ? 4 : 2;
+      cart.available = true;
+      store.insert_cart(cart);
+    }
+
+    std::mt19937 rng(42);
+    std::vector<cart_record> carts = store.list_carts();
+    for (int day = 20000; day < 20210; day++)
+    {
+      for (const auto &cart : carts)
+      {
+        int slot = 7 * 12 + static_cast<int>(rng() % 12);
+        while (slot < 19 * 12)
+        {
+          int length = 12 + static_cast<int>(rng() % 49);
+          reservation_record reservation;
+          reservation.cart_id = cart.id;
+          reservation.day = day;
+          reservation.first_slot = slot;
+          reservation.slot_count = std::min(length, static_cast<int>(reservation_engine::slots_per_day) - slot);
+          store.insert_reservation(reservation);
+          slot += length + static_cast<int>(rng() % 40);
+        }
+      }
+    }
+    engine.load(20000);
+    return true;
+  }();
+  (void)initialized;
+  return engine;
+}
+
+static void BM_Reservation_FindFree(benchmark::State &state)
+{
+  reservation_engine &engine = bench_engine();
+  int first_slot = reservation_engine::parse_slot("09:10");
+  int end_slot = reservation_engine::parse_slot("13:30", true);
+  int day = 20000;
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(engine.find_free(day, first_slot, end_slot - first_slot, 4));
+    day = day == 20209 ? 20000 : day + 1;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Reservation_FindFree);
+
+static void BM_Reservation_FindEarliestWindow(benchmark::State &state)
+{
+  reservation_engine &engine = bench_engine();
+  std::vector<cart_record> free_carts;
+  int day = 20000;
+  for (auto _ : state)
+  {
+    // A 4.5 hour round for a 4-seater, any time between 06:00 and 20:00
+    benchmark::DoNotOptimize(engine.find_earliest_window(day, 6 * 12, 20 * 12, 54, 4, free_carts));
+    day = day == 20209 ? 20000 : day + 1;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Reservation_FindEarliestWindow);
+
+static void BM_Reservation_BookConflict(benchmark::State &state)
+{
+  // Rejected bookings never reach the store, so this measures the in-memory commit path alone
+  reservation_engine &engine = bench_engine();
+  std::string cart_id = std::string(23, '0') + "1";
+  for (auto _ : state)
+  {
+    benchmark::DoNotOptimize(engine.book(cart_id, "", 20000, 0, reservation_engine::slots_per_day));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Reservation_BookConflict);
@@ -0,0 +1,95 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include <crow/task_timer.h>
+
+/**
+ * @brief The previous std::map based deadline bookkeeping, kept here as a baseline
+ * so the timing wheel can be compared against it.
+ */
+class map_task_timer
+{
+public:
+  using identifier_type = size_t;
+
+  identifier_type schedule(const std::function<void()> &task)
+  {
+    tasks_.insert({++highest_id_, {std::chrono::steady_clock::now() + std::chrono::seconds(5), task}});
+    return highest_id_;
+  }
+
+  void cancel(identifier_type id)
+  {
+    tasks_.erase(id);
+  }
+
+private:
+  std::map<identifier_type, std::pair<std::chrono::steady_clock::time_point, std::function<void()>>> tasks_;
+  identifier_type highest_id_{0};
+};
+
+/**
+ * @brief Simulates idle keep-alive connections each re-arming their deadline once per request,
+ * the way Connection::handle() and Connection::start_deadline() do.
+ */
+template <typename Timer>
+static void rearm_idle_connections(benchmark::State &state, Timer &timer)
+{
+  const size_t connections = static_cast<size_t>(state.range(0));
+  std::vector<typename Timer::identifier_type> ids(connections);
+  for (size_t i = 0; i < connections; i++)
+  {
+    ids[i] = timer.schedule([] {});
+  }
+
+  size_t next = 0;
+  for (auto _ : state)
+  {
+    timer.cancel(ids[next]);
+    ids[next] = timer.schedule([] {});
+    next = (next + 1 == connections) ? 0 : next + 1;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_TaskTimer_Rearm(benchmark::State &state)
+{
+  boost::asio::io_service io_service;
+  crow::detail::task_timer timer(io_service);
+  rearm_idle_connections(state, timer);
+}
+BENCHMARK(BM_TaskTimer_Rearm)->Arg(1000)->Arg(50000);
+
+static void BM_MapTaskTimer_Rearm(benchmark::State &state)
+{
+  map_task_timer timer;
+  rearm_idle_connections(state, timer);
+}
+BENCHMARK(BM_MapTaskTimer_Rearm)->Arg(1000)->Arg(50000);
+
+/**
+ * @brief Measures how long the io_service spends ticking the wheel while 50k idle
+ * connections are waiting on a deadline far enough away that none of them fire.
+ */
+static void BM_TaskTimer_IdleTicks(benchmark::State &state)
+{
+  boost::asio::io_service io_service;
+  crow::detail::task_timer timer(io_service, std::chrono::milliseconds(1));
+  for (int64_t i = 0; i < state.range(0); i++)
+  {
+    timer.schedule([] {}, std::chrono::hours(1));
+  }
+
+  for (auto _ : state)
+  {
+    io_service.run_one();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TaskTimer_IdleTicks)->Arg(50000)->Unit(benchmark::kMicrosecond);
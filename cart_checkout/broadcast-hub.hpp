@@ -0,0 +1,229 @@
+#ifndef BROADCAST_HUB_HPP
+#define BROADCAST_HUB_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <crow/event_stream.h>
+#include <crow/json.h>
+#include <crow/websocket.h>
+
+#include "storage.hpp"
+
+/**
+ * @brief Pushes cart availability and bookings to websocket (/ws/carts) and event stream (/events) subscribers.
+ *
+ * A subscriber first receives a snapshot of the fleet, then one message per change:
+ * {"type": "snapshot" | "delta", "version": n, "carts": [{"id", "name", "type", "available"}, ...]} or
+ * {"type": "booking", "version": n, "cartId", "date", "start", "end"}. Every message gets the next version.
+ *
+ * Each message is serialized once and the same encoded buffer is queued on every connection; a subscriber that
+ * falls max_pending messages behind is disconnected rather than buffered for. The last replay_events stream
+ * events are kept, so an EventSource reconnecting with Last-Event-ID gets what it missed instead of a snapshot.
+ * Stream event ids are "<epoch>.<version>", the epoch being when the hub was made, so an id from before a restart
+ * (when versions started again from 0) gets a snapshot.
+ */
+class cart_broadcast_hub
+{
+public:
+  explicit cart_broadcast_hub(size_t max_pending = 64, size_t replay_events = 256)
+    : max_pending_(max_pending), replay_events_(replay_events),
+      epoch_(std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()))
+  {
+  }
+
+  cart_broadcast_hub(const cart_broadcast_hub &) = delete;
+  cart_broadcast_hub &operator=(const cart_broadcast_hub &) = delete;
+
+  /**
+   * @brief Adds conn and sends it the current snapshot. Call from the connection's open handler.
+   */
+  void subscribe(crow::websocket::connection &conn)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!snapshot_frame_)
+    {
+      snapshot_frame_ = crow::websocket::encode_frame(1, encode("snapshot", carts_));
+    }
+    sockets_.insert(&conn);
+    conn.send_frame(snapshot_frame_, max_pending_);
+  }
+
+  /**
+   * @brief Adds conn and sends it the events after its Last-Event-ID if they are all still kept, else the snapshot.
+   */
+  void subscribe(crow::event_stream::connection &conn)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.insert(&conn);
+
+    const std::string &last_event_id = conn.last_event_id();
+    bool same_epoch = last_event_id.size() > epoch_.size() + 1 && last_event_id.compare(0, epoch_.size(), epoch_) == 0 &&
+                      last_event_id[epoch_.size()] == '.';
+    const char *digits = same_epoch ? last_event_id.c_str() + epoch_.size() + 1 : "";
+    char *end = nullptr;
+    uint64_t last_seen = std::strtoull(digits, &end, 10);
+    bool resumable = same_epoch && *digits >= '0' && *digits <= '9' && *end == '\0' && last_seen <= version_ &&
+                     (last_seen == version_ || (!recent_events_.empty() && recent_events_.front().first <= last_seen + 1));
+    if (resumable)
+    {
+      for (const auto &event : recent_events_)
+      {
+        if (event.first > last_seen)
+        {
+          conn.send_event(event.second, max_pending_ + recent_events_.size());
+        }
+      }
+      return;
+    }
+
+    if (!snapshot_event_)
+    {
+      snapshot_event_ = crow::event_stream::encode_event(encode("snapshot", carts_), "snapshot", event_id());
+    }
+    conn.send_event(snapshot_event_, max_pending_);
+  }
+
+  /**
+   * @brief Removes conn. Call from the connection's close handler; conn receives nothing once it returns.
+   */
+  void unsubscribe(crow::websocket::connection &conn)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sockets_.erase(&conn);
+  }
+
+  void unsubscribe(crow::event_stream::connection &conn)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.erase(&conn);
+  }
+
+  /**
+   * @brief Records the changed carts and sends them as one delta to every subscriber.
+   */
+  void publish(const std::vector<cart_record> &changed)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &cart : changed)
+    {
+      auto found = indexes_.find(cart.id);
+      if (found == indexes_.end())
+      {
+        indexes_[cart.id] = carts_.size();
+        carts_.push_back(cart);
+      }
+      else
+      {
+        carts_[found->second] = cart;
+      }
+    }
+    version_++;
+    broadcast("delta", encode("delta", changed));
+  }
+
+  /**
+   * @brief Sends a new booking of cart_id (date "YYYY-MM-DD", times "HH:MM") to every subscriber.
+   */
+  void publish_booking(const std::string &cart_id, const std::string &date, const std::string &start, const std::string &end)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    version_++;
+    crow::json::wvalue message;
+    message["type"] = "booking";
+    message["version"] = version_;
+    message["cartId"] = cart_id;
+    message["date"] = date;
+    message["start"] = start;
+    message["end"] = end;
+    broadcast("booking", message.dump());
+  }
+
+  size_t subscribers() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sockets_.size() + streams_.size();
+  }
+
+private:
+  /**
+   * @brief Queues message, version_ by now, on every subscriber, encoded once per protocol. Call with mutex_ held.
+   */
+  void broadcast(const char *kind, const std::string &message)
+  {
+    // Snapshots carry their version, so they are re-encoded after any message
+    snapshot_frame_.reset();
+    snapshot_event_.reset();
+
+    std::shared_ptr<const std::string> event = crow::event_stream::encode_event(message, kind, event_id());
+    recent_events_.emplace_back(version_, event);
+    if (recent_events_.size() > replay_events_)
+    {
+      recent_events_.pop_front();
+    }
+    for (auto *stream : streams_)
+    {
+      stream->send_event(event, max_pending_);
+    }
+
+    if (!sockets_.empty())
+    {
+      std::shared_ptr<const std::string> frame = crow::websocket::encode_frame(1, message);
+      for (auto *socket : sockets_)
+      {
+        socket->send_frame(frame, max_pending_);
+      }
+    }
+  }
+
+  std::string event_id() const
+  {
+    return epoch_ + "." + std::to_string(version_);
+  }
+
+  std::string encode(const char *kind, const std::vector<cart_record> &carts) const
+  {
+    crow::json::wvalue message;
+    message["type"] = kind;
+    message["version"] = version_;
+    crow::json::wvalue entries(crow::json::wvalue::list{});
+    int i = 0;
+    for (const auto &cart_entry : carts)
+    {
+      crow::json::wvalue cart;
+      cart["id"] = cart_entry.id;
+      cart["name"] = cart_entry.name;
+      cart["type"] = cart_entry.type;
+      cart["available"] = cart_entry.available;
+      entries[i++] = std::move(cart);
+    }
+    message["carts"] = std::move(entries);
+    return message.dump();
+  }
+
+  const size_t max_pending_;
+  const size_t replay_events_;
+  const std::string epoch_; // milliseconds since 1970 when the hub was made
+
+  // Guards everything below; connections are only removed (and then deleted) under it
+  mutable std::mutex mutex_;
+  std::unordered_set<crow::websocket::connection *> sockets_;
+  std::unordered_set<crow::event_stream::connection *> streams_;
+  std::vector<cart_record> carts_;
+  std::unordered_map<std::string, size_t> indexes_;
+  uint64_t version_ = 0;
+  std::deque<std::pair<uint64_t, std::shared_ptr<const std::string>>> recent_events_; // stream events by version
+  std::shared_ptr<const std::string> snapshot_frame_; // encoded on demand, shared until the next message
+  std::shared_ptr<const std::string> snapshot_event_;
+};
+
+#endif
@@ -0,0 +1,338 @@
+#ifndef CART_INVENTORY_HPP
+#define CART_INVENTORY_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <crow/json.h>
+
+#include "storage.hpp"
+
+/**
+ * @brief The fleet as the checkout sequencer last left it, with a version that increases on every change and a
+ * bounded log of which carts each version changed.
+ *
+ * Lets /cart-info answer a client that knows version n with only the carts changed since n (or nothing at all),
+ * falling back to the whole fleet once n has left the log.
+ *
+ * Clients see versions as "<epoch>.<n>" tokens, the epoch being when the inventory was made: n restarts at 0 with
+ * the server, so a version from before a restart has another epoch and gets the whole fleet.
+ *
+ * Filtered queries use secondary indexes kept next to the fleet: a bitmap of available carts, one bitmap per
+ * type, and the carts sorted by (name, id) for prefix ranges and cursor pagination.
+ */
+class cart_inventory
+{
+public:
+  enum class sync_kind
+  {
+    unchanged,
+    delta,
+    snapshot
+  };
+
+  struct sync_result
+  {
+    sync_kind kind = sync_kind::snapshot;
+    std::string version;
+    std::string body; // {"version": "<epoch>.<n>", "full": bool, "carts": [...]}, empty when unchanged
+  };
+
+  explicit cart_inventory(size_t log_versions = 1024)
+    : log_versions_(log_versions),
+      epoch_(std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()))
+  {
+  }
+
+  cart_inventory(const cart_inventory &) = delete;
+  cart_inventory &operator=(const cart_inventory &) = delete;
+
+  /**
+   * @brief Records a change to the given carts (new ids are added) as the next version.
+   */
+  void apply(const std::vector<cart_record> &changed)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<size_t> changed_indexes;
+    changed_indexes.reserve(changed.size());
+    for (const auto &cart : changed)
+    {
+      auto found = indexes_.find(cart.id);
+      if (found == indexes_.end())
+      {
+        found = indexes_.emplace(cart.id, carts_.size()).first;
+        carts_.push_back(cart);
+        available_bits_.resize((carts_.size() + 63) / 64, 0);
+        names_sorted_ = false;
+      }
+      else
+      {
+        cart_record &previous = carts_[found->second];
+        clear_bit(type_bits_[previous.type], found->second);
+        names_sorted_ = names_sorted_ && previous.name == cart.name;
+        previous = cart;
+      }
+      size_t index = found->second;
+      changed_indexes.push_back(index);
+
+      std::vector<uint64_t> &type_bits = type_bits_[cart.type];
+      type_bits.resize(available_bits_.size(), 0);
+      type_bits[index / 64] |= uint64_t(1) << (index % 64);
+      if (cart.available)
+      {
+        available_bits_[index / 64] |= uint64_t(1) << (index % 64);
+      }
+      else
+      {
+        clear_bit(available_bits_, index);
+      }
+    }
+    version_++;
+    log_.emplace_back(version_, std::move(changed_indexes));
+    if (log_.size() > log_versions_)
+    {
+      log_.pop_front();
+    }
+    carts_json_.reset();
+  }
+
+  uint64_t version() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return version_;
+  }
+
+  /**
+   * @brief The whole fleet as a JSON array, encoded once per version, and that version's token.
+   */
+  std::shared_ptr<const std::string> snapshot(std::string *version = nullptr)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (version)
+    {
+      *version = token(version_);
+    }
+    return encoded_fleet();
+  }
+
+  /**
+   * @brief What changed after the version token known: nothing, the changed carts, or the fleet if the log no
+   * longer covers it or the token is not one of this inventory's (e.g. from before a restart).
+   */
+  sync_result since(const std::string &known)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sync_result result;
+    result.version = token(version_);
+    uint64_t known_version = 0;
+    bool ours = parse_token(known, known_version);
+    if (ours && known_version == version_)
+    {
+      result.kind = sync_kind::unchanged;
+      return result;
+    }
+
+    bool covered = ours && known_version < version_ && !log_.empty() && log_.front().first <= known_version + 1;
+    if (!covered)
+    {
+      result.kind = sync_kind::snapshot;
+      result.body = envelope(true, *encoded_fleet());
+      return result;
+    }
+
+    std::vector<bool> seen(carts_.size(), false);
+    std::vector<const cart_record *> changed;
+    for (auto entry = log_.rbegin(); entry != log_.rend() && entry->first > known_version; ++entry)
+    {
+      for (size_t index : entry->second)
+      {
+        if (!seen[index])
+        {
+          seen[index] = true;
+          changed.push_back(&carts_[index]);
+        }
+      }
+    }
+    result.kind = sync_kind::delta;
+    result.body = envelope(false, encode(changed));
+    return result;
+  }
+
+  /**
+   * @brief The page of carts matching query, from the indexes.
+   */
+  cart_page query(const cart_query &query, std::string *version = nullptr)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (version)
+    {
+      *version = token(version_);
+    }
+    if (!names_sorted_)
+    {
+      by_name_.resize(carts_.size());
+      for (size_t i = 0; i < carts_.size(); i++)
+      {
+        by_name_[i] = i;
+      }
+      std::sort(by_name_.begin(), by_name_.end(), [this](size_t a, size_t b)
+      {
+        return cart_ordered_before(carts_[a].name, carts_[a].id, carts_[b].name, carts_[b].id);
+      });
+      names_sorted_ = true;
+    }
+
+    // Candidates passing the type and availability filters, a word of carts at a time
+    std::vector<uint64_t> candidates(available_bits_.size(), ~uint64_t(0));
+    if (query.type >= 0)
+    {
+      auto type_bits = type_bits_.find(query.type);
+      for (size_t word = 0; word < candidates.size(); word++)
+      {
+        candidates[word] = type_bits == type_bits_.end() || word >= type_bits->second.size() ? 0 : type_bits->second[word];
+      }
+    }
+    if (query.available >= 0)
+    {
+      for (size_t word = 0; word < candidates.size(); word++)
+      {
+        candidates[word] &= query.available ? available_bits_[word] : ~available_bits_[word];
+      }
+    }
+
+    // The names with the prefix are one range of the name index; the cursor moves its start
+    auto begin = std::lower_bound(by_name_.begin(), by_name_.end(), query.name_prefix, [this](size_t index, const std::string &prefix)
+    {
+      return carts_[index].name < prefix;
+    });
+    if (!query.after_id.empty())
+    {
+      auto after = std::partition_point(by_name_.begin(), by_name_.end(), [this, &query](size_t index)
+      {
+        return !cart_ordered_before(query.after_name, query.after_id, carts_[index].name, carts_[index].id);
+      });
+      begin = std::max(begin, after);
+    }
+
+    cart_page page;
+    for (auto position = begin; position != by_name_.end(); ++position)
+    {
+      size_t index = *position;
+      const cart_record &cart = carts_[index];
+      if (cart.name.compare(0, query.name_prefix.size(), query.name_prefix) != 0)
+      {
+        break;
+      }
+      if (!(candidates[index / 64] >> (index % 64) & 1))
+      {
+        continue;
+      }
+      if (page.carts.size() == query.limit)
+      {
+        page.more = true;
+        break;
+      }
+      page.carts.push_back(cart);
+    }
+    return page;
+  }
+
+private:
+  std::string token(uint64_t version) const
+  {
+    return epoch_ + "." + std::to_string(version);
+  }
+
+  /**
+   * @brief Reads n from "<epoch>.<n>"; false if the token is malformed or has another epoch.
+   */
+  bool parse_token(const std::string &version_token, uint64_t &version) const
+  {
+    if (version_token.size() <= epoch_.size() + 1 || version_token.compare(0, epoch_.size(), epoch_) != 0 || version_token[epoch_.size()] != '.')
+    {
+      return false;
+    }
+    const char *digits = version_token.c_str() + epoch_.size() + 1;
+    char *end = nullptr;
+    version = std::strtoull(digits, &end, 10);
+    return *digits >= '0' && *digits <= '9' && *end == '\0';
+  }
+
+  static void clear_bit(std::vector<uint64_t> &bits, size_t index)
+  {
+    if (index / 64 < bits.size())
+    {
+      bits[index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+  }
+
+  /**
+   * @brief Call with mutex_ held.
+   */
+  const std::shared_ptr<const std::string> &encoded_fleet()
+  {
+    if (!carts_json_)
+    {
+      std::vector<const cart_record *> all;
+      all.reserve(carts_.size());
+      for (const auto &cart : carts_)
+      {
+        all.push_back(&cart);
+      }
+      carts_json_ = std::make_shared<const std::string>(encode(all));
+    }
+    return carts_json_;
+  }
+
+  std::string envelope(bool full, const std::string &carts) const
+  {
+    std::string body = "{\"version\":\"" + token(version_) + "\",\"full\":" + (full ? "true" : "false") + ",\"carts\":";
+    body.reserve(body.size() + carts.size() + 1);
+    body += carts;
+    body += '}';
+    return body;
+  }
+
+  static std::string encode(const std::vector<const cart_record *> &carts)
+  {
+    crow::json::wvalue entries(crow::json::wvalue::list{});
+    int i = 0;
+    for (const cart_record *cart_entry : carts)
+    {
+      crow::json::wvalue cart;
+      cart["id"] = cart_entry->id;
+      cart["name"] = cart_entry->name;
+      cart["type"] = cart_entry->type;
+      cart["available"] = cart_entry->available;
+      entries[i++] = std::move(cart);
+    }
+    return entries.dump();
+  }
+
+  const size_t log_versions_;
+  const std::string epoch_; // milliseconds since 1970 when the inventory was made
+
+  mutable std::mutex mutex_;
+  std::vector<cart_record> carts_;
+  std::unordered_map<std::string, size_t> indexes_;
+  uint64_t version_ = 0;
+  std::deque<std::pair<uint64_t, std::vector<size_t>>> log_; // the carts each recent version changed
+  std::shared_ptr<const std::string> carts_json_;            // encoded on demand, shared until the next change
+
+  // Secondary indexes by position in carts_
+  std::vector<uint64_t> available_bits_;
+  std::unordered_map<int, std::vector<uint64_t>> type_bits_;
+  std::vector<size_t> by_name_; // sorted by (name, id) when names_sorted_
+  bool names_sorted_ = true;
+};
+
+#endif
@@ -0,0 +1,570 @@
+#ifndef CHECKOUT_SEQUENCER_HPP
+#define CHECKOUT_SEQUENCER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <crow/logging.h>
+
+#include "expiry-scheduler.hpp"
+#include "storage.hpp"
+
+/**
+ * @brief The outcome of a checkout or return.
+ */
+enum class checkout_status
+{
+  ok,
+  unavailable,     // the cart is already checked out (or no cart of the type is free)
+  not_holder,      // returning or confirming a cart someone else holds (or nobody does, e.g. the hold expired)
+  unknown_cart,
+  storage_failure, // the batch holding the command could not be written; nothing changed
+  stopped
+};
+
+struct checkout_result
+{
+  checkout_status status = checkout_status::stopped;
+  cart_record cart;
+  uint64_t hold_id = 0;                 // set for holds
+  std::chrono::milliseconds hold_for{0}; // how long the hold lasts unless confirmed
+};
+
+/**
+ * @brief Serializes cart checkouts and returns through one allocation thread which owns the fleet state.
+ *
+ * Handlers claim a slot of a ring buffer with one atomic increment and publish their command into it, with a
+ * callback the result is handed to on the allocation thread (or get a future for it). The allocation thread consumes every published command in sequence order, so two members can never
+ * both get the same cart and nobody retries. Each batch of consumed commands becomes one update_carts
+ * (bulk_write) round trip, and results are only published once the batch is stored; a failed batch is rolled back.
+ *
+ * Holds reserve a cart for a member in memory only (nothing is written until they are confirmed). Their expiry
+ * is a deadline in a timing wheel which, when it fires, feeds an expire command back through the ring, so the
+ * cart is free again for the very next command.
+ */
+class checkout_sequencer
+{
+public:
+  /**
+   * @brief Receives a command's result on the allocation thread; it must not block (e.g. post the result to an io_service).
+   */
+  typedef std::function<void(const checkout_result &)> result_callback;
+
+  static constexpr size_t ring_size = 4096;   // power of two
+  static constexpr size_t max_batch = 256;
+
+  explicit checkout_sequencer(storage &store) : store_(store), slots_(ring_size)
+  {
+    for (size_t i = 0; i < ring_size; i++)
+    {
+      slots_[i].sequence.store(static_cast<int64_t>(i) - static_cast<int64_t>(ring_size), std::memory_order_relaxed);
+    }
+  }
+
+  checkout_sequencer(const checkout_sequencer &) = delete;
+  checkout_sequencer &operator=(const checkout_sequencer &) = delete;
+
+  ~checkout_sequencer()
+  {
+    stop();
+  }
+
+  /**
+   * @brief Sets a listener called on the allocation thread with the whole fleet on start, then with the carts
+   * each batch changed once it is stored. It must not block, and must be set before start().
+   */
+  void on_change(std::function<void(const std::vector<cart_record> &)> listener)
+  {
+    on_change_ = std::move(listener);
+  }
+
+  /**
+   * @brief Loads the fleet from the store and starts the allocation thread.
+   */
+  void start()
+  {
+    std::vector<cart_record> carts = store_.list_carts();
+    fleet_ = std::move(carts);
+    fleet_indexes_.clear();
+    for (size_t i = 0; i < fleet_.size(); i++)
+    {
+      fleet_indexes_[fleet_[i].id] = i;
+    }
+    hold_ids_.assign(fleet_.size(), 0);
+    if (on_change_)
+    {
+      on_change_(fleet_);
+    }
+    running_.store(true, std::memory_order_release);
+    thread_ = std::thread([this] { run(); });
+    expiries_.start();
+  }
+
+  /**
+   * @brief Finishes the commands already published and stops the allocation thread. Call once producers are gone.
+   */
+  void stop()
+  {
+    if (!running_.load(std::memory_order_acquire))
+    {
+      return;
+    }
+    expiries_.stop(); // no expire commands after this
+    running_.store(false, std::memory_order_release);
+    wake();
+    thread_.join();
+  }
+
+  /**
+   * @brief Checks out cart_id for uid; with an empty cart_id, the first free cart of the given type (any type if negative).
+   */
+  void checkout(const std::string &cart_id, int type, const std::string &uid, result_callback done)
+  {
+    submit(command_kind::checkout, cart_id, type, uid, std::move(done));
+  }
+
+  std::future<checkout_result> checkout(const std::string &cart_id, int type, const std::string &uid)
+  {
+    auto result = std::make_shared<std::promise<checkout_result>>();
+    checkout(cart_id, type, uid, promise_callback(result));
+    return result->get_future();
+  }
+
+  /**
+   * @brief Holds cart_id (or the first free cart of the given type) for uid during hold_for. Holding a cart
+   * uid already holds extends the hold.
+   */
+  void hold(const std::string &cart_id, int type, const std::string &uid, std::chrono::milliseconds hold_for, result_callback done)
+  {
+    submit(command_kind::hold, cart_id, type, uid, std::move(done), 0, hold_for);
+  }
+
+  std::future<checkout_result> hold(const std::string &cart_id, int type, const std::string &uid, std::chrono::milliseconds hold_for)
+  {
+    auto result = std::make_shared<std::promise<checkout_result>>();
+    hold(cart_id, type, uid, hold_for, promise_callback(result));
+    return result->get_future();
+  }
+
+  /**
+   * @brief Turns uid's hold on cart_id into a checkout.
+   */
+  void confirm(const std::string &cart_id, const std::string &uid, result_callback done)
+  {
+    submit(command_kind::confirm, cart_id, -1, uid, std::move(done));
+  }
+
+  std::future<checkout_result> confirm(const std::string &cart_id, const std::string &uid)
+  {
+    auto result = std::make_shared<std::promise<checkout_result>>();
+    confirm(cart_id, uid, promise_callback(result));
+    return result->get_future();
+  }
+
+  /**
+   * @brief Returns cart_id, which uid must be holding (checked out or on hold).
+   */
+  void release(const std::string &cart_id, const std::string &uid, result_callback done)
+  {
+    submit(command_kind::release, cart_id, -1, uid, std::move(done));
+  }
+
+  std::future<checkout_result> release(const std::string &cart_id, const std::string &uid)
+  {
+    auto result = std::make_shared<std::promise<checkout_result>>();
+    release(cart_id, uid, promise_callback(result));
+    return result->get_future();
+  }
+
+  /**
+   * @brief Number of batches written to the store so far.
+   */
+  uint64_t batches() const
+  {
+    return batches_.load(std::memory_order_relaxed);
+  }
+
+private:
+  enum class command_kind
+  {
+    checkout,
+    hold,
+    confirm,
+    release,
+    expire
+  };
+
+  struct command
+  {
+    command_kind kind = command_kind::checkout;
+    std::string cart_id;
+    int type = -1;
+    std::string uid;
+    uint64_t hold_id = 0;
+    std::chrono::milliseconds hold_for{0};
+    result_callback done; // empty for expire commands
+  };
+
+  /**
+   * @brief A ring buffer entry; sequence is the command's sequence number once it is published.
+   */
+  struct slot
+  {
+    std::atomic<int64_t> sequence{0};
+    command entry;
+  };
+
+  static result_callback promise_callback(std::shared_ptr<std::promise<checkout_result>> result)
+  {
+    return [result](const checkout_result &value) { result->set_value(value); };
+  }
+
+  void submit(command_kind kind, const std::string &cart_id, int type, const std::string &uid, result_callback done,
+              uint64_t hold_id = 0, std::chrono::milliseconds hold_for = std::chrono::milliseconds(0))
+  {
+    if (!running_.load(std::memory_order_acquire))
+    {
+      if (done)
+      {
+        done(checkout_result());
+      }
+      return;
+    }
+
+    int64_t sequence = claimed_.fetch_add(1, std::memory_order_relaxed);
+    // Wait for the allocation thread to free the slot from the previous lap
+    while (sequence - consumed_.load(std::memory_order_acquire) >= static_cast<int64_t>(ring_size))
+    {
+      std::this_thread::yield();
+    }
+
+    slot &claimed = slots_[static_cast<size_t>(sequence) & (ring_size - 1)];
+    claimed.entry.kind = kind;
+    claimed.entry.cart_id = cart_id;
+    claimed.entry.type = type;
+    claimed.entry.uid = uid;
+    claimed.entry.hold_id = hold_id;
+    claimed.entry.hold_for = hold_for;
+    claimed.entry.done = std::move(done);
+    claimed.sequence.store(sequence, std::memory_order_release);
+
+    if (sleeping_.load(std::memory_order_acquire))
+    {
+      wake();
+    }
+  }
+
+  void wake()
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    wake_.notify_one();
+  }
+
+  bool published(int64_t sequence) const
+  {
+    return slots_[static_cast<size_t>(sequence) & (ring_size - 1)].sequence.load(std::memory_order_acquire) == sequence;
+  }
+
+  void run()
+  {
+    int64_t next = 0;
+    std::vector<command> batch;
+    batch.reserve(max_batch);
+    while (true)
+    {
+      int64_t end = next;
+      while (end - next < static_cast<int64_t>(max_batch) && published(end))
+      {
+        end++;
+      }
+
+      if (end == next)
+      {
+        if (!running_.load(std::memory_order_acquire))
+        {
+          return;
+        }
+        // Spin briefly, then sleep until a producer wakes us (the timeout covers a wake racing with sleeping_)
+        bool found = false;
+        for (int spin = 0; spin < 1000 && !(found = published(next)); spin++)
+        {
+          std::this_thread::yield();
+        }
+        if (!found)
+        {
+          std::unique_lock<std::mutex> lock(wake_mutex_);
+          sleeping_.store(true, std::memory_order_release);
+          if (!published(next) && running_.load(std::memory_order_acquire))
+          {
+            wake_.wait_for(lock, std::chrono::milliseconds(1));
+          }
+          sleeping_.store(false, std::memory_order_release);
+        }
+        continue;
+      }
+
+      batch.clear();
+      for (int64_t sequence = next; sequence < end; sequence++)
+      {
+        batch.push_back(std::move(slots_[static_cast<size_t>(sequence) & (ring_size - 1)].entry));
+      }
+      consumed_.store(end, std::memory_order_release);
+      next = end;
+
+      process(batch);
+    }
+  }
+
+  /**
+   * @brief Finds the first free cart of the given type (any type if negative), or fleet_.size().
+   */
+  size_t first_available(int type) const
+  {
+    size_t cart = 0;
+    while (cart < fleet_.size() && !(fleet_[cart].available && (type < 0 || fleet_[cart].type == type)))
+    {
+      cart++;
+    }
+    return cart;
+  }
+
+  void process(std::vector<command> &batch)
+  {
+    struct previous_state
+    {
+      size_t cart;
+      cart_record record;
+      uint64_t hold_id;
+    };
+
+    std::vector<checkout_result> results(batch.size());
+    std::vector<cart_update> updates;
+    std::vector<previous_state> previous; // fleet entries to restore if the batch is not stored
+    std::vector<std::pair<size_t, uint64_t>> holds_placed; // command index, hold id
+    std::vector<uint64_t> holds_ended;
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      const command &entry = batch[i];
+      size_t cart = fleet_.size();
+      if (!entry.cart_id.empty())
+      {
+        auto found = fleet_indexes_.find(entry.cart_id);
+        if (found == fleet_indexes_.end())
+        {
+          results[i].status = checkout_status::unknown_cart;
+          continue;
+        }
+        cart = found->second;
+      }
+      else if (entry.kind == command_kind::checkout || entry.kind == command_kind::hold)
+      {
+        cart = first_available(entry.type);
+        if (cart == fleet_.size())
+        {
+          results[i].status = checkout_status::unavailable;
+          continue;
+        }
+      }
+      else
+      {
+        results[i].status = checkout_status::unknown_cart;
+        continue;
+      }
+
+      cart_record &state = fleet_[cart];
+      uint64_t &hold_id = hold_ids_[cart];
+      bool held_by_member = !state.available && hold_id != 0 && state.holder == entry.uid;
+      bool write = false;
+      switch (entry.kind)
+      {
+        case command_kind::checkout:
+        case command_kind::confirm:
+          // Checking out a cart the member holds confirms the hold
+          if ((!state.available && !held_by_member) || (entry.kind == command_kind::confirm && !held_by_member))
+          {
+            results[i].status = entry.kind == command_kind::confirm ? checkout_status::not_holder : checkout_status::unavailable;
+            continue;
+          }
+          previous.push_back({cart, state, hold_id});
+          if (hold_id)
+          {
+            holds_ended.push_back(hold_id);
+          }
+          state.available = false;
+          state.holder = entry.uid;
+          hold_id = 0;
+          write = true;
+          break;
+
+        case command_kind::hold:
+          if (!state.available && !held_by_member)
+          {
+            results[i].status = checkout_status::unavailable;
+            continue;
+          }
+          previous.push_back({cart, state, hold_id});
+          if (!hold_id)
+          {
+            hold_id = ++last_hold_id_;
+          }
+          state.available = false;
+          state.holder = entry.uid;
+          holds_placed.emplace_back(i, hold_id);
+          results[i].hold_id = hold_id;
+          results[i].hold_for = entry.hold_for;
+          break;
+
+        case command_kind::release:
+          if (state.available || state.holder != entry.uid)
+          {
+            results[i].status = checkout_status::not_holder;
+            continue;
+          }
+          previous.push_back({cart, state, hold_id});
+          // A hold was never written, so releasing one only changes the in-memory state
+          write = hold_id == 0;
+          if (hold_id)
+          {
+            holds_ended.push_back(hold_id);
+          }
+          state.available = true;
+          state.holder.clear();
+          hold_id = 0;
+          break;
+
+        case command_kind::expire:
+          if (hold_id == 0 || hold_id != entry.hold_id)
+          {
+            results[i].status = checkout_status::not_holder; // confirmed or released in the meantime
+            continue;
+          }
+          previous.push_back({cart, state, hold_id});
+          CROW_LOG_DEBUG << "Hold " << hold_id << " on cart " << state.id << " expired";
+          state.available = true;
+          state.holder.clear();
+          hold_id = 0;
+          break;
+      }
+
+      if (write)
+      {
+        cart_update update;
+        update.cart_id = state.id;
+        update.available = state.available;
+        update.holder = state.holder;
+        updates.push_back(std::move(update));
+      }
+      results[i].status = checkout_status::ok;
+      results[i].cart = state;
+    }
+
+    bool stored = true;
+    if (!updates.empty())
+    {
+      try
+      {
+        stored = store_.update_carts(updates);
+      }
+      catch (const std::exception &e)
+      {
+        CROW_LOG_ERROR << "Checkout batch could not be stored: " << e.what();
+        stored = false;
+      }
+      batches_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (!stored)
+    {
+      for (auto entry = previous.rbegin(); entry != previous.rend(); ++entry)
+      {
+        fleet_[entry->cart] = entry->record;
+        hold_ids_[entry->cart] = entry->hold_id;
+      }
+      for (auto &result : results)
+      {
+        if (result.status == checkout_status::ok)
+        {
+          result.status = checkout_status::storage_failure;
+        }
+      }
+    }
+    else
+    {
+      for (uint64_t hold_id : holds_ended)
+      {
+        expiries_.cancel(hold_id);
+      }
+      for (const auto &placed : holds_placed)
+      {
+        const command &entry = batch[placed.first];
+        std::string cart_id = results[placed.first].cart.id;
+        uint64_t hold_id = placed.second;
+        expiries_.schedule(hold_id, entry.hold_for, [this, cart_id, hold_id]
+        {
+          submit(command_kind::expire, cart_id, -1, "", nullptr, hold_id);
+        });
+      }
+
+      if (on_change_ && !previous.empty())
+      {
+        std::vector<cart_record> changed;
+        std::vector<bool> seen(fleet_.size(), false);
+        for (const auto &entry : previous)
+        {
+          if (!seen[entry.cart])
+          {
+            seen[entry.cart] = true;
+            changed.push_back(fleet_[entry.cart]);
+          }
+        }
+        on_change_(changed);
+      }
+    }
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      if (batch[i].done)
+      {
+        batch[i].done(results[i]);
+      }
+    }
+  }
+
+  storage &store_;
+  std::vector<slot> slots_;
+  // Producers hammer claimed_ while the allocation thread writes consumed_; keep them on separate cache lines
+  char padding_before_claimed_[64];
+  std::atomic<int64_t> claimed_{0};
+  char padding_before_consumed_[64];
+  std::atomic<int64_t> consumed_{0};
+  char padding_after_consumed_[64];
+  std::atomic<bool> running_{false};
+  std::atomic<bool> sleeping_{false};
+  std::atomic<uint64_t> batches_{0};
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  std::thread thread_;
+
+  // Only touched by the allocation thread once started
+  std::vector<cart_record> fleet_;
+  std::unordered_map<std::string, size_t> fleet_indexes_;
+  std::vector<uint64_t> hold_ids_; // per cart, 0 unless it is on hold
+  uint64_t last_hold_id_ = 0;
+
+  expiry_scheduler expiries_;
+  std::function<void(const std::vector<cart_record> &)> on_change_;
+};
+
+#endif
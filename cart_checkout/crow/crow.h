@@ -8,11 +8,17 @@
 #include "crow/json.h"
 #include "crow/mustache.h"
 #include "crow/logging.h"
+#include "crow/async_logging.h"
 #include "crow/task_timer.h"
 #include "crow/utility.h"
 #include "crow/common.h"
 #include "crow/http_request.h"
+#include "crow/request_timing.h"
+#include "crow/instrumentation.h"
+#include "crow/trace.h"
+#include "crow/profiler.h"
 #include "crow/websocket.h"
+#include "crow/event_stream.h"
 #include "crow/parser.h"
 #include "crow/http_response.h"
 #include "crow/multipart.h"
@@ -20,6 +26,7 @@
 #include "crow/middleware.h"
 #include "crow/middleware_context.h"
 #include "crow/compression.h"
+#include "crow/access_log.h"
 #include "crow/http_connection.h"
 #include "crow/http_server.h"
 #include "crow/app.h"
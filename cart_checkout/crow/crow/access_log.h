@@ -0,0 +1,264 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crow/logging.h"
+
+namespace crow
+{
+    /// One request in the binary access log. Records are fixed-size and little-endian (host order).
+    struct access_log_record
+    {
+        std::uint64_t timestamp_us;   ///< Wall clock time the request was received, in microseconds since the epoch.
+        std::uint32_t latency_us;     ///< Time from the request being parsed to the response being ready.
+        std::uint32_t bytes_sent;     ///< Response size including headers.
+        std::uint32_t bytes_received; ///< Request size including headers.
+        std::uint16_t route_id;       ///< Index into the route table (0 means no route matched).
+        std::uint16_t status;
+        std::uint8_t method;          ///< crow::HTTPMethod
+        std::uint8_t ip_version;      ///< 4 or 6
+        std::uint8_t http_version;    ///< major * 10 + minor
+        std::uint8_t reserved[5];
+        std::uint8_t ip[16];          ///< IPv4 addresses use the first 4 bytes.
+    };
+    static_assert(sizeof(access_log_record) == 48, "access_log_record must stay 48 bytes");
+
+    /// Header at the start of each access log file.
+    struct access_log_header
+    {
+        char magic[8];             ///< "CROWALOG"
+        std::uint32_t version;     ///< Format version (1).
+        std::uint32_t record_size; ///< sizeof(access_log_record)
+        std::uint64_t created_us;  ///< When the file was created, in microseconds since the epoch.
+        std::uint8_t reserved[40];
+    };
+    static_assert(sizeof(access_log_header) == 64, "access_log_header must stay 64 bytes");
+
+    /// Writes \ref access_log_record entries into memory-mapped, size-rotated files.
+
+    ///
+    /// Files are named `<path>.<sequence>` and pre-sized so writers only reserve a slot with an atomic
+    /// increment and copy 48 bytes; nothing is formatted or flushed on the request path. The sequence carries
+    /// on after the files left by earlier runs, which are never overwritten.
+    /// Records never written (e.g. after a crash) are left zeroed and skipped by the decoder.
+    /// The route table is written next to the logs as `<path>.routes` (one `id<TAB>rule` per line).
+    class access_log_writer
+    {
+    public:
+        access_log_writer() = default;
+        access_log_writer(const access_log_writer&) = delete;
+        access_log_writer& operator=(const access_log_writer&) = delete;
+
+        ~access_log_writer() { close(); }
+
+        /// Start logging to `<path>.<sequence>` files of at most \p file_size bytes, keeping the newest \p keep_files.
+
+        ///
+        /// Numbering resumes after the highest sequence already on disk, so the files of a previous run (say a
+        /// process that crashed) are kept and pruned with the new ones.
+        bool open(const std::string& path, size_t file_size = 64 * 1024 * 1024, unsigned keep_files = 8)
+        {
+            std::lock_guard<std::mutex> lock(rotate_mutex_);
+            path_ = path;
+            file_size_ = file_size < sizeof(access_log_header) + sizeof(access_log_record) ? sizeof(access_log_header) + sizeof(access_log_record) : file_size;
+            keep_files_ = keep_files ? keep_files : 1;
+            sequence_ = last_sequence_on_disk();
+
+            segment* s = map_segment();
+            if (!s)
+                return false;
+            current_.store(s, std::memory_order_release);
+            return true;
+        }
+
+        /// Unmap and truncate every open file to the records actually written.
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(rotate_mutex_);
+            unmap_segment(retired_);
+            retired_ = nullptr;
+            unmap_segment(current_.exchange(nullptr));
+        }
+
+        bool is_open() const { return current_.load(std::memory_order_acquire) != nullptr; }
+
+        /// Append a record. Lock-free unless the current file is full and has to be rotated.
+        void write(const access_log_record& record)
+        {
+            while (true)
+            {
+                segment* s = current_.load(std::memory_order_acquire);
+                if (!s)
+                    return;
+                size_t index = s->next.fetch_add(1, std::memory_order_relaxed);
+                if (index < s->capacity)
+                {
+                    std::memcpy(s->base + sizeof(access_log_header) + index * sizeof(access_log_record), &record, sizeof(access_log_record));
+                    return;
+                }
+                rotate(s);
+            }
+        }
+
+        /// Write the route table used by the decoder to turn route ids back into rules.
+        void write_routes(const std::vector<std::string>& routes)
+        {
+            FILE* f = fopen((path_ + ".routes").c_str(), "w");
+            if (!f)
+            {
+                CROW_LOG_ERROR << "Could not write access log route table: " << path_ << ".routes";
+                return;
+            }
+            for (size_t i = 0; i < routes.size(); i++)
+                fprintf(f, "%zu\t%s\n", i, routes[i].c_str());
+            fclose(f);
+        }
+
+    private:
+        struct segment
+        {
+            char* base{nullptr};
+            size_t capacity{0};
+            std::atomic<size_t> next{0};
+            int fd{-1};
+            std::string path;
+        };
+
+        std::string segment_path(std::uint64_t sequence) const
+        {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), ".%06llu", static_cast<unsigned long long>(sequence));
+            return path_ + suffix;
+        }
+
+        /// Highest `<path>.NNNNNN` sequence in the log directory, 0 if there is none.
+        std::uint64_t last_sequence_on_disk() const
+        {
+            size_t slash = path_.rfind('/');
+            std::string directory = slash == std::string::npos ? "." : path_.substr(0, slash + 1);
+            std::string prefix = (slash == std::string::npos ? path_ : path_.substr(slash + 1)) + ".";
+
+            std::uint64_t last = 0;
+            DIR* dir = ::opendir(directory.c_str());
+            if (!dir)
+                return last;
+            while (dirent* entry = ::readdir(dir))
+            {
+                std::string name = entry->d_name;
+                if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+                    continue;
+                std::string digits = name.substr(prefix.size());
+                if (digits.size() < 6 || digits.find_first_not_of("0123456789") != std::string::npos)
+                    continue;
+                std::uint64_t sequence = std::strtoull(digits.c_str(), nullptr, 10);
+                if (sequence > last)
+                    last = sequence;
+            }
+            ::closedir(dir);
+            return last;
+        }
+
+        segment* map_segment()
+        {
+            // O_EXCL: a file appearing meanwhile (another process logging to the same path) is skipped, never truncated
+            std::string path = segment_path(++sequence_);
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            for (int attempts = 0; fd < 0 && errno == EEXIST && attempts < 100; attempts++)
+            {
+                path = segment_path(++sequence_);
+                fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            }
+            if (fd < 0 || ::ftruncate(fd, static_cast<off_t>(file_size_)) != 0)
+            {
+                CROW_LOG_ERROR << "Could not create access log file: " << path;
+                if (fd >= 0) ::close(fd);
+                return nullptr;
+            }
+
+            void* base = ::mmap(nullptr, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED)
+            {
+                CROW_LOG_ERROR << "Could not map access log file: " << path;
+                ::close(fd);
+                return nullptr;
+            }
+
+            access_log_header header{};
+            std::memcpy(header.magic, "CROWALOG", 8);
+            header.version = 1;
+            header.record_size = sizeof(access_log_record);
+            header.created_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            std::memcpy(base, &header, sizeof(header));
+
+            segment* s = new segment();
+            s->base = static_cast<char*>(base);
+            s->capacity = (file_size_ - sizeof(access_log_header)) / sizeof(access_log_record);
+            s->fd = fd;
+            s->path = path;
+
+            if (sequence_ > keep_files_)
+                ::unlink(segment_path(sequence_ - keep_files_).c_str());
+            return s;
+        }
+
+        void unmap_segment(segment* s)
+        {
+            if (!s)
+                return;
+            size_t used = s->next.load(std::memory_order_relaxed);
+            if (used > s->capacity) used = s->capacity;
+            ::munmap(s->base, file_size_);
+            if (::ftruncate(s->fd, static_cast<off_t>(sizeof(access_log_header) + used * sizeof(access_log_record))) != 0)
+                CROW_LOG_WARNING << "Could not truncate access log file: " << s->path;
+            ::close(s->fd);
+            delete s;
+        }
+
+        /// Swap in a new file. The full one stays mapped until the next rotation so that writers which
+        /// reserved a slot just before the swap can still finish copying their record.
+        void rotate(segment* full)
+        {
+            std::lock_guard<std::mutex> lock(rotate_mutex_);
+            if (current_.load(std::memory_order_acquire) != full)
+                return;
+
+            segment* fresh = map_segment();
+            if (!fresh)
+            {
+                current_.store(nullptr, std::memory_order_release);
+                CROW_LOG_ERROR << "Access log disabled after failing to rotate";
+                unmap_segment(retired_);
+                retired_ = full;
+                return;
+            }
+            unmap_segment(retired_);
+            retired_ = full;
+            current_.store(fresh, std::memory_order_release);
+        }
+
+    private:
+        std::string path_;
+        size_t file_size_{0};
+        unsigned keep_files_{8};
+        std::uint64_t sequence_{0};
+
+        std::atomic<segment*> current_{nullptr};
+        segment* retired_{nullptr};
+        std::mutex rotate_mutex_;
+    };
+} // namespace crow
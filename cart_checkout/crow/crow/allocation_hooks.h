@@ -0,0 +1,89 @@
+#pragma once
+
+// Replaces the global operator new / delete to count allocations per thread (see crow/instrumentation.h).
+// Include this header from exactly one translation unit of the executable.
+
+#include <cstdlib>
+#include <new>
+
+#include "crow/instrumentation.h"
+
+namespace crow
+{
+    namespace detail
+    {
+        inline void* counted_allocation(std::size_t size)
+        {
+            void* p = std::malloc(size ? size : 1);
+            if (p)
+            {
+                allocation_counters& counters = thread_allocation_counters();
+                counters.allocations++;
+                counters.bytes += size;
+            }
+            return p;
+        }
+
+        inline void* counted_allocation_or_throw(std::size_t size)
+        {
+            while (true)
+            {
+                void* p = counted_allocation(size);
+                if (p)
+                    return p;
+                std::new_handler handler = std::get_new_handler();
+                if (!handler)
+                    throw std::bad_alloc();
+                handler();
+            }
+        }
+
+        inline void counted_deallocation(void* p)
+        {
+            if (!p)
+                return;
+            thread_allocation_counters().deallocations++;
+            std::free(p);
+        }
+    } // namespace detail
+} // namespace crow
+
+void* operator new(std::size_t size)
+{
+    return crow::detail::counted_allocation_or_throw(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return crow::detail::counted_allocation_or_throw(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return crow::detail::counted_allocation(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return crow::detail::counted_allocation(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    crow::detail::counted_deallocation(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    crow::detail::counted_deallocation(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    crow::detail::counted_deallocation(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    crow::detail::counted_deallocation(p);
+}
@@ -19,6 +19,8 @@
 #include "crow/http_request.h"
 #include "crow/http_server.h"
 #include "crow/task_timer.h"
+#include "crow/access_log.h"
+#include "crow/metrics.h"
 #ifdef CROW_ENABLE_COMPRESSION
 #include "crow/compression.h"
 #endif
@@ -68,6 +70,12 @@ namespace crow
             router_.handle_upgrade(req, res, adaptor);
         }
 
+        /// Whether the request is for an event stream route, which takes the socket over like an upgrade
+        bool is_event_stream(const request& req)
+        {
+            return router_.is_event_stream(req);
+        }
+
         /// Process the request and generate a response for it
         void handle(request& req, response& res)
         {
@@ -149,6 +157,16 @@ namespace crow
             return *this;
         }
 
+        /// Let other processes listen on the same address and port (SO_REUSEPORT), the kernel spreading new connections among them
+
+        ///
+        /// For running several processes of one server on a host. Every process must enable it.
+        self_t& reuse_port(bool enabled = true)
+        {
+            reuse_port_ = enabled;
+            return *this;
+        }
+
         /// Run the server on multiple threads using all available threads
         self_t& multithreaded()
         {
@@ -195,6 +213,94 @@ namespace crow
             return res_stream_threshold_;
         }
 
+        /// Write a binary access log record for every request to memory-mapped files (see \ref access_log_writer)
+
+        ///
+        /// \param path Files are created as `<path>.000001`, `<path>.000002`, ... and `<path>.routes`.
+        /// \param file_size Size at which a file is rotated.
+        /// \param keep_files How many of the newest files to keep.
+        self_t& access_log(const std::string& path, size_t file_size = 64 * 1024 * 1024, unsigned keep_files = 8)
+        {
+            if (!access_log_.open(path, file_size, keep_files))
+                CROW_LOG_ERROR << "Access log disabled: could not open " << path;
+            return *this;
+        }
+
+        /// Get the access log writer, or nullptr if access logging is disabled
+        access_log_writer* get_access_log()
+        {
+            return access_log_.is_open() ? &access_log_ : nullptr;
+        }
+
+        /// Record per-route latency histograms, byte counters and connection gauges
+        self_t& enable_metrics()
+        {
+            metrics_.enable();
+            return *this;
+        }
+
+        /// Get the metrics registry, or nullptr if metrics are disabled
+        metrics_registry* get_metrics()
+        {
+            return metrics_.enabled() ? &metrics_ : nullptr;
+        }
+
+        /// Add a `Server-Timing` header with the per-phase breakdown to one in every \p every_n responses (0 disables it)
+
+        ///
+        /// Requires metrics to be enabled, the phases are always fed into the metrics registry.
+        self_t& server_timing(unsigned every_n)
+        {
+            server_timing_every_ = every_n;
+            return *this;
+        }
+
+        unsigned server_timing_every() const
+        {
+            return server_timing_every_;
+        }
+
+        /// Count heap allocations and perf counters around every handler and report them per route in the metrics
+
+        ///
+        /// Requires metrics to be enabled. Allocations are only counted when crow/allocation_hooks.h is included
+        /// in the executable, hardware counters only when `perf_event_open` is permitted.
+        self_t& instrument_handlers(bool enabled = true)
+        {
+            instrument_handlers_ = enabled;
+            return *this;
+        }
+
+        bool handlers_instrumented() const
+        {
+            return instrument_handlers_;
+        }
+
+        /// Render all metrics in the Prometheus text format (serve it with `Content-Type: text/plain; version=0.0.4`)
+        std::string metrics_text()
+        {
+            std::string out;
+            std::vector<unsigned int> queue_lengths;
+#ifdef CROW_ENABLE_SSL
+            if (ssl_used_)
+            {
+                if (ssl_server_) queue_lengths = ssl_server_->queue_lengths();
+            }
+            else
+#endif
+            {
+                if (server_) queue_lengths = server_->queue_lengths();
+            }
+            metrics_.render(out, router_.route_names(), queue_lengths);
+            return out;
+        }
+
+        /// The rule of every route, indexed by `request::route_id`
+        const std::vector<std::string>& route_names() const
+        {
+            return router_.route_names();
+        }
+
         self_t& register_blueprint(Blueprint& blueprint)
         {
             router_.register_blueprint(blueprint);
@@ -264,6 +370,11 @@ namespace crow
 
                 router_.validate();
                 validated_ = true;
+
+                if (access_log_.is_open())
+                    access_log_.write_routes(router_.route_names());
+                if (metrics_.enabled())
+                    metrics_.resize(router_.route_names().size());
             }
         }
 
@@ -284,7 +395,7 @@ namespace crow
 #ifdef CROW_ENABLE_SSL
             if (ssl_used_)
             {
-                ssl_server_ = std::move(std::unique_ptr<ssl_server_t>(new ssl_server_t(this, bindaddr_, port_, server_name_, &middlewares_, concurrency_, timeout_, &ssl_context_)));
+                ssl_server_ = std::move(std::unique_ptr<ssl_server_t>(new ssl_server_t(this, bindaddr_, port_, server_name_, &middlewares_, concurrency_, timeout_, &ssl_context_, reuse_port_)));
                 ssl_server_->set_tick_function(tick_interval_, tick_function_);
                 ssl_server_->signal_clear();
                 for (auto snum : signals_)
@@ -297,7 +408,7 @@ namespace crow
             else
 #endif
             {
-                server_ = std::move(std::unique_ptr<server_t>(new server_t(this, bindaddr_, port_, server_name_, &middlewares_, concurrency_, timeout_, nullptr)));
+                server_ = std::move(std::unique_ptr<server_t>(new server_t(this, bindaddr_, port_, server_name_, &middlewares_, concurrency_, timeout_, nullptr, reuse_port_)));
                 server_->set_tick_function(tick_interval_, tick_function_);
                 server_->signal_clear();
                 for (auto snum : signals_)
@@ -464,8 +575,13 @@ namespace crow
         bool validated_ = false;
         std::string server_name_ = std::string("Crow/") + VERSION;
         std::string bindaddr_ = "0.0.0.0";
+        bool reuse_port_{false};
         size_t res_stream_threshold_ = 1048576;
         Router router_;
+        access_log_writer access_log_;
+        metrics_registry metrics_;
+        unsigned server_timing_every_{0};
+        bool instrument_handlers_{false};
 
 #ifdef CROW_ENABLE_COMPRESSION
         compression::algorithm comp_algorithm_;
@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "crow/settings.h"
+#include "crow/logging.h"
+
+namespace crow
+{
+    namespace detail
+    {
+        /// A message waiting in a thread's log ring.
+        struct log_entry
+        {
+            std::int64_t time_us{0};
+            LogLevel level{LogLevel::Info};
+            std::string message;
+        };
+
+        /// Single producer / single consumer ring of log entries. Each logging thread owns one.
+        class log_ring
+        {
+        public:
+            explicit log_ring(size_t capacity):
+              entries_(capacity), mask_(capacity - 1)
+            {}
+
+            /// Called by the owning thread only. Returns false (and drops the entry) if the ring is full.
+            bool push(log_entry&& entry)
+            {
+                size_t tail = tail_.load(std::memory_order_relaxed);
+                if (tail - head_.load(std::memory_order_acquire) > mask_)
+                    return false;
+                entries_[tail & mask_] = std::move(entry);
+                tail_.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            /// Called by the writer thread only.
+            template<typename Func>
+            size_t drain(Func&& f)
+            {
+                size_t head = head_.load(std::memory_order_relaxed);
+                size_t tail = tail_.load(std::memory_order_acquire);
+                for (size_t i = head; i != tail; i++)
+                    f(entries_[i & mask_]);
+                head_.store(tail, std::memory_order_release);
+                return tail - head;
+            }
+
+            bool empty() const
+            {
+                return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+            }
+
+            /// Set once the owning thread has exited, the ring is discarded after its last drain.
+            std::atomic<bool> orphaned{false};
+
+        private:
+            std::vector<log_entry> entries_;
+            size_t mask_;
+            std::atomic<size_t> head_{0};
+            std::atomic<size_t> tail_{0};
+        };
+
+        /// Per-thread limiter that lets at most N identical messages through every second.
+        class log_rate_limiter
+        {
+        public:
+            /// \return true if the message should be written. \p suppressed receives how many copies of
+            /// the message were dropped in the previous window, so it can be reported once.
+            bool allow(std::uint64_t key, std::int64_t now_s, std::uint32_t limit, std::uint32_t& suppressed)
+            {
+                suppressed = 0;
+                if (limit == 0)
+                    return true;
+
+                slot& s = slots_[key & (slot_count - 1)];
+                if (s.key != key || s.window != now_s)
+                {
+                    if (s.key == key)
+                        suppressed = s.suppressed;
+                    s.key = key;
+                    s.window = now_s;
+                    s.count = 0;
+                    s.suppressed = 0;
+                }
+                if (++s.count > limit)
+                {
+                    s.suppressed++;
+                    return false;
+                }
+                return true;
+            }
+
+        private:
+            static constexpr size_t slot_count = 64;
+
+            struct slot
+            {
+                std::uint64_t key{0};
+                std::int64_t window{-1};
+                std::uint32_t count{0};
+                std::uint32_t suppressed{0};
+            };
+            slot slots_[slot_count];
+        };
+
+        inline log_rate_limiter& thread_rate_limiter()
+        {
+            static thread_local log_rate_limiter limiter;
+            return limiter;
+        }
+
+        inline std::int64_t log_now_us()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+    } // namespace detail
+
+    /// Asynchronous log writer.
+
+    ///
+    /// Logging threads only move their message into a thread-local ring buffer, a single background
+    /// thread formats timestamps and writes everything out in batches. Messages are dropped (and
+    /// counted) rather than blocking when a ring is full.
+    class async_logger
+    {
+    public:
+        static async_logger& instance()
+        {
+            static async_logger logger;
+            return logger;
+        }
+
+        ~async_logger() { stop(); }
+
+        /// Queue a message. Safe to call from any thread.
+        void write(LogLevel level, std::string message)
+        {
+            detail::log_entry entry;
+            entry.time_us = detail::log_now_us();
+            entry.level = level;
+            entry.message = std::move(message);
+
+            if (!local_ring().push(std::move(entry)))
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Block until every message queued before this call has been written.
+        void flush()
+        {
+            std::unique_lock<std::mutex> lock(flush_mutex_);
+            std::uint64_t target = ++flush_requested_;
+            wake_.notify_one();
+            flushed_cv_.wait_for(lock, std::chrono::seconds(1), [&] {
+                return flush_completed_ >= target || !running_;
+            });
+        }
+
+        /// Stop the writer thread after writing everything still queued.
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(flush_mutex_);
+                if (!running_)
+                    return;
+                running_ = false;
+            }
+            wake_.notify_one();
+            if (writer_.joinable())
+                writer_.join();
+        }
+
+        /// Set where log lines are written to (Default: stderr).
+        void set_output(FILE* output) { output_ = output; }
+
+        /// Maximum number of identical messages written per thread each second, 0 disables the limit (Default: 20).
+        void set_repeat_limit(std::uint32_t limit) { repeat_limit_ = limit; }
+        std::uint32_t repeat_limit() const { return repeat_limit_; }
+
+        /// Number of messages dropped because a thread's ring buffer was full.
+        std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        static constexpr size_t ring_capacity = 4096;
+
+        struct ring_owner
+        {
+            std::shared_ptr<detail::log_ring> ring;
+            ~ring_owner()
+            {
+                if (ring) ring->orphaned = true;
+            }
+        };
+
+        async_logger():
+          writer_(&async_logger::run, this)
+        {}
+
+        detail::log_ring& local_ring()
+        {
+            static thread_local ring_owner owner;
+            if (!owner.ring)
+            {
+                owner.ring = std::make_shared<detail::log_ring>(static_cast<size_t>(ring_capacity));
+                std::lock_guard<std::mutex> lock(rings_mutex_);
+                rings_.push_back(owner.ring);
+            }
+            return *owner.ring;
+        }
+
+        static const char* level_prefix(LogLevel level)
+        {
+            switch (level)
+            {
+                case LogLevel::Debug: return "DEBUG   ";
+                case LogLevel::Info: return "INFO    ";
+                case LogLevel::Warning: return "WARNING ";
+                case LogLevel::Error: return "ERROR   ";
+                case LogLevel::Critical: return "CRITICAL";
+            }
+            return "";
+        }
+
+        /// Format "(YYYY-mm-dd HH:MM:SS.mmm)", only calling strftime when the second changes.
+        void append_timestamp(std::string& out, std::int64_t time_us)
+        {
+            std::int64_t seconds = time_us / 1000000;
+            if (seconds != cached_second_)
+            {
+                time_t t = static_cast<time_t>(seconds);
+                tm my_tm;
+#ifdef CROW_USE_LOCALTIMEZONE
+                localtime_r(&t, &my_tm);
+#else
+                gmtime_r(&t, &my_tm);
+#endif
+                char date[32];
+                size_t sz = strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &my_tm);
+                cached_date_.assign(date, sz);
+                cached_second_ = seconds;
+            }
+            char millis[8];
+            snprintf(millis, sizeof(millis), ".%03d", static_cast<int>((time_us / 1000) % 1000));
+            out += '(';
+            out += cached_date_;
+            out += millis;
+            out += ") [";
+        }
+
+        bool drain_all()
+        {
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex_);
+                snapshot_.assign(rings_.begin(), rings_.end());
+            }
+
+            batch_.clear();
+            for (auto& ring : snapshot_)
+            {
+                ring->drain([this](detail::log_entry& entry) {
+                    batch_.push_back(std::move(entry));
+                });
+            }
+
+            // Rings of exited threads are removed once they are empty.
+            {
+                std::lock_guard<std::mutex> lock(rings_mutex_);
+                rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<detail::log_ring>& ring) {
+                                 return ring->orphaned && ring->empty();
+                             }),
+                             rings_.end());
+            }
+            snapshot_.clear();
+
+            std::uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+            if (batch_.empty() && dropped == reported_dropped_)
+                return false;
+
+            // Interleave the threads' messages back into time order.
+            std::stable_sort(batch_.begin(), batch_.end(), [](const detail::log_entry& a, const detail::log_entry& b) {
+                return a.time_us < b.time_us;
+            });
+
+            buffer_.clear();
+            for (auto& entry : batch_)
+            {
+                append_timestamp(buffer_, entry.time_us);
+                buffer_ += level_prefix(entry.level);
+                buffer_ += "] ";
+                buffer_ += entry.message;
+                buffer_ += '\n';
+            }
+            if (dropped != reported_dropped_)
+            {
+                append_timestamp(buffer_, detail::log_now_us());
+                buffer_ += level_prefix(LogLevel::Warning);
+                buffer_ += "] async_logger dropped=" + std::to_string(dropped - reported_dropped_) + '\n';
+                reported_dropped_ = dropped;
+            }
+            fwrite(buffer_.data(), 1, buffer_.size(), output_);
+            fflush(output_);
+            batch_.clear();
+            return true;
+        }
+
+        void run()
+        {
+            while (true)
+            {
+                std::uint64_t flush_target;
+                bool running;
+                {
+                    std::lock_guard<std::mutex> lock(flush_mutex_);
+                    flush_target = flush_requested_;
+                    running = running_;
+                }
+
+                bool wrote = drain_all();
+
+                {
+                    std::unique_lock<std::mutex> lock(flush_mutex_);
+                    if (flush_target > flush_completed_)
+                    {
+                        flush_completed_ = flush_target;
+                        flushed_cv_.notify_all();
+                    }
+                    if (!running)
+                        break;
+                    if (!wrote)
+                        wake_.wait_for(lock, std::chrono::milliseconds(5));
+                }
+            }
+            drain_all();
+        }
+
+    private:
+        FILE* output_{stderr};
+        std::atomic<std::uint32_t> repeat_limit_{20};
+        std::atomic<std::uint64_t> dropped_{0};
+        std::uint64_t reported_dropped_{0};
+
+        std::mutex rings_mutex_;
+        std::vector<std::shared_ptr<detail::log_ring>> rings_;
+
+        // Only touched by the writer thread
+        std::vector<std::shared_ptr<detail::log_ring>> snapshot_;
+        std::vector<detail::log_entry> batch_;
+        std::string buffer_;
+        std::string cached_date_;
+        std::int64_t cached_second_{-1};
+
+        std::mutex flush_mutex_;
+        std::condition_variable wake_;
+        std::condition_variable flushed_cv_;
+        std::uint64_t flush_requested_{0};
+        std::uint64_t flush_completed_{0};
+        bool running_{true};
+
+        std::thread writer_;
+    };
+
+    /// Log handler sending every `CROW_LOG_*` message to the \ref async_logger, rate limiting repeated messages.
+    class AsyncLogHandler : public ILogHandler
+    {
+    public:
+        void log(std::string message, LogLevel level) override
+        {
+            async_logger& logger = async_logger::instance();
+            std::uint32_t suppressed;
+            if (!detail::thread_rate_limiter().allow(std::hash<std::string>()(message), detail::log_now_us() / 1000000, logger.repeat_limit(), suppressed))
+                return;
+            if (suppressed)
+                message += " (suppressed " + std::to_string(suppressed) + " repeats)";
+            logger.write(level, std::move(message));
+        }
+    };
+
+    /// A log line made of an event name followed by `key=value` fields (logfmt).
+
+    ///
+    /// Use through the `CROW_SLOG_*` macros, e.g. `CROW_SLOG_INFO("login").kv("uid", uid).kv("success", true);`
+    /// Repeats of a line (the same event with the same fields) are rate limited, the line is sent to the current
+    /// log handler on destruction.
+    class structured_log
+    {
+    public:
+        structured_log(LogLevel level, const char* event):
+          level_(level)
+        {
+            line_ = "event=";
+            line_ += event;
+        }
+
+        ~structured_log()
+        {
+            // Salted so the line does not share a limiter slot with the same message seen by AsyncLogHandler
+            std::uint64_t key = std::hash<std::string>()(line_) ^ 0x9e3779b97f4a7c15ULL;
+            std::uint32_t suppressed;
+            if (!detail::thread_rate_limiter().allow(key, detail::log_now_us() / 1000000, async_logger::instance().repeat_limit(), suppressed))
+                return;
+            if (suppressed)
+                kv("suppressed", suppressed);
+            logger(level_) << line_;
+        }
+
+        structured_log& kv(const char* key, const std::string& value)
+        {
+            line_ += ' ';
+            line_ += key;
+            line_ += '=';
+            append_quoted(value);
+            return *this;
+        }
+
+        structured_log& kv(const char* key, const char* value)
+        {
+            return kv(key, std::string(value));
+        }
+
+        structured_log& kv(const char* key, bool value)
+        {
+            line_ += ' ';
+            line_ += key;
+            line_ += value ? "=true" : "=false";
+            return *this;
+        }
+
+        template<typename T>
+        typename std::enable_if<std::is_arithmetic<T>::value, structured_log&>::type kv(const char* key, T value)
+        {
+            line_ += ' ';
+            line_ += key;
+            line_ += '=';
+            line_ += std::to_string(value);
+            return *this;
+        }
+
+    private:
+        void append_quoted(const std::string& value)
+        {
+            if (!value.empty() && value.find_first_of(" =\"\\\t\r\n") == std::string::npos)
+            {
+                line_ += value;
+                return;
+            }
+            line_ += '"';
+            for (char c : value)
+            {
+                switch (c)
+                {
+                    case '"': line_ += "\\\""; break;
+                    case '\\': line_ += "\\\\"; break;
+                    case '\n': line_ += "\\n"; break;
+                    case '\r': line_ += "\\r"; break;
+                    case '\t': line_ += "\\t"; break;
+                    default: line_ += c;
+                }
+            }
+            line_ += '"';
+        }
+
+        LogLevel level_;
+        std::string line_;
+    };
+} // namespace crow
+
+#define CROW_SLOG_CRITICAL(event)                                                                    \
+    if (CROW_LOG_COMPILE_LEVEL <= 4 && crow::logger::get_current_log_level() <= crow::LogLevel::Critical) \
+    crow::structured_log(crow::LogLevel::Critical, event)
+#define CROW_SLOG_ERROR(event)                                                                    \
+    if (CROW_LOG_COMPILE_LEVEL <= 3 && crow::logger::get_current_log_level() <= crow::LogLevel::Error) \
+    crow::structured_log(crow::LogLevel::Error, event)
+#define CROW_SLOG_WARNING(event)                                                                    \
+    if (CROW_LOG_COMPILE_LEVEL <= 2 && crow::logger::get_current_log_level() <= crow::LogLevel::Warning) \
+    crow::structured_log(crow::LogLevel::Warning, event)
+#define CROW_SLOG_INFO(event)                                                                    \
+    if (CROW_LOG_COMPILE_LEVEL <= 1 && crow::logger::get_current_log_level() <= crow::LogLevel::Info) \
+    crow::structured_log(crow::LogLevel::Info, event)
+#define CROW_SLOG_DEBUG(event)                                                                    \
+    if (CROW_LOG_COMPILE_LEVEL <= 0 && crow::logger::get_current_log_level() <= crow::LogLevel::Debug) \
+    crow::structured_log(crow::LogLevel::Debug, event)
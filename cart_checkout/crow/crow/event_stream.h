@@ -0,0 +1,269 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/array.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "crow/http_request.h"
+#include "crow/logging.h"
+#include "crow/socket_adaptors.h"
+
+namespace crow
+{
+    namespace event_stream
+    {
+        /// Encode a server-sent event, ready for connection::send_event.
+
+        ///
+        /// Multi-line data becomes one `data:` line per line. Encoding a broadcast once and sharing the result
+        /// avoids formatting and copying it per connection.
+        inline std::shared_ptr<const std::string> encode_event(const std::string& data, const std::string& event = {}, const std::string& id = {})
+        {
+            auto encoded = std::make_shared<std::string>();
+            encoded->reserve(data.size() + event.size() + id.size() + 24);
+            if (!id.empty())
+                encoded->append("id: ").append(id).append("\n");
+            if (!event.empty())
+                encoded->append("event: ").append(event).append("\n");
+            size_t start = 0;
+            while (true)
+            {
+                size_t end = data.find('\n', start);
+                encoded->append("data: ").append(data, start, end == std::string::npos ? std::string::npos : end - start).append("\n");
+                if (end == std::string::npos)
+                    break;
+                start = end + 1;
+            }
+            encoded->append("\n");
+            return encoded;
+        }
+
+        /// A base class for event stream connections.
+        struct connection
+        {
+            virtual void send_event(std::shared_ptr<const std::string> event, size_t max_pending_events) = 0;
+            virtual void close() = 0;
+            virtual std::string get_remote_ip() = 0;
+            virtual const std::string& last_event_id() const = 0;
+            virtual ~connection() {}
+
+            void userdata(void* u) { userdata_ = u; }
+            void* userdata() { return userdata_; }
+
+        private:
+            void* userdata_;
+        };
+
+        /// A long-lived `text/event-stream` response.
+
+        ///
+        /// Takes the socket over from the HTTP connection, like a websocket does, so no thread is held while it is open:
+        /// events are queued and written asynchronously on the connection's io_service.<br>
+        /// A comment line is sent when nothing else was written during a heartbeat interval, which keeps proxies from timing the stream out.
+        template<typename Adaptor>
+        class Connection : public connection
+        {
+        public:
+            /// Constructor for a connection.
+
+            ///
+            /// Answers 503 and closes if the accept handler refuses the request (an EventSource does not reconnect after that).
+            Connection(const crow::request& req, Adaptor&& adaptor, std::chrono::milliseconds heartbeat,
+                       std::function<void(crow::event_stream::connection&)> open_handler,
+                       std::function<void(crow::event_stream::connection&)> close_handler,
+                       std::function<bool(const crow::request&)> accept_handler):
+              adaptor_(std::move(adaptor)),
+              heartbeat_timer_(adaptor_.get_io_service()),
+              heartbeat_(heartbeat),
+              last_event_id_(req.get_header_value("Last-Event-ID")),
+              open_handler_(std::move(open_handler)), close_handler_(std::move(close_handler))
+            {
+                if (accept_handler && !accept_handler(req))
+                {
+                    static auto refused = std::make_shared<const std::string>("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+                    close_after_write_ = true;
+                    write_buffers_.emplace_back(refused);
+                    do_write();
+                    return;
+                }
+
+                static auto header = std::make_shared<const std::string>("HTTP/1.1 200 OK\r\n"
+                                                                         "Content-Type: text/event-stream\r\n"
+                                                                         "Cache-Control: no-cache\r\n"
+                                                                         "Connection: keep-alive\r\n"
+                                                                         "X-Accel-Buffering: no\r\n\r\n");
+                write_buffers_.emplace_back(header);
+                do_write();
+                if (open_handler_)
+                    open_handler_(*this);
+                do_read();
+                schedule_heartbeat();
+            }
+
+            /// Send an event made by encode_event, without copying it.
+
+            ///
+            /// Safe to call from any thread, as long as the connection's close handler has not returned yet.<br>
+            /// If max_pending_events events are already waiting behind the write in progress, the client is not keeping up
+            /// and the connection is closed instead of letting its queue grow without bound.
+            void send_event(std::shared_ptr<const std::string> event, size_t max_pending_events) override
+            {
+                std::weak_ptr<char> alive = alive_;
+                adaptor_.get_io_service().post([this, alive, event, max_pending_events] {
+                    if (alive.expired() || closed_)
+                        return;
+                    if (pending_events_ >= max_pending_events)
+                    {
+                        CROW_LOG_WARNING << "Dropping slow event stream consumer with " << pending_events_ << " events pending";
+                        close_socket();
+                        return;
+                    }
+                    pending_events_++;
+                    write_buffers_.emplace_back(event);
+                    do_write();
+                });
+            }
+
+            /// Close the stream; the client is expected to reconnect.
+            void close() override
+            {
+                std::weak_ptr<char> alive = alive_;
+                adaptor_.get_io_service().post([this, alive] {
+                    if (!alive.expired())
+                        close_socket();
+                });
+            }
+
+            std::string get_remote_ip() override
+            {
+                return adaptor_.remote_endpoint().address().to_string();
+            }
+
+            /// The Last-Event-ID header a reconnecting EventSource sent (empty on a first connection).
+            const std::string& last_event_id() const override
+            {
+                return last_event_id_;
+            }
+
+        private:
+            /// Wait for the client to go away; it has nothing to send on an event stream.
+            void do_read()
+            {
+                is_reading_ = true;
+                adaptor_.socket().async_read_some(
+                  boost::asio::buffer(read_buffer_),
+                  [this](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
+                      is_reading_ = false;
+                      if (!ec && !closed_)
+                          do_read();
+                      else
+                          close_socket();
+                  });
+            }
+
+            void do_write()
+            {
+                if (is_writing_ || write_buffers_.empty())
+                    return;
+                sending_buffers_.swap(write_buffers_);
+                pending_events_ = 0;
+                std::vector<boost::asio::const_buffer> buffers;
+                buffers.reserve(sending_buffers_.size());
+                for (auto& s : sending_buffers_)
+                {
+                    buffers.emplace_back(boost::asio::buffer(*s));
+                }
+                is_writing_ = true;
+                boost::asio::async_write(
+                  adaptor_.socket(), buffers,
+                  [this](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
+                      is_writing_ = false;
+                      sending_buffers_.clear();
+                      written_since_heartbeat_ = true;
+                      if (ec || closed_ || close_after_write_)
+                          close_socket();
+                      else
+                          do_write();
+                  });
+            }
+
+            void schedule_heartbeat()
+            {
+                if (heartbeat_.count() <= 0)
+                    return;
+                heartbeat_pending_ = true;
+                heartbeat_timer_.expires_from_now(heartbeat_);
+                heartbeat_timer_.async_wait([this](const boost::system::error_code& ec) {
+                    heartbeat_pending_ = false;
+                    if (ec || closed_)
+                    {
+                        check_destroy();
+                        return;
+                    }
+                    if (!written_since_heartbeat_)
+                    {
+                        static auto comment = std::make_shared<const std::string>(":\n\n");
+                        write_buffers_.emplace_back(comment);
+                        do_write();
+                    }
+                    written_since_heartbeat_ = false;
+                    schedule_heartbeat();
+                });
+            }
+
+            void close_socket()
+            {
+                if (!closed_)
+                {
+                    closed_ = true;
+                    adaptor_.shutdown_readwrite();
+                    adaptor_.close();
+                    boost::system::error_code ec;
+                    heartbeat_timer_.cancel(ec);
+                }
+                check_destroy();
+            }
+
+            /// Destroy the Connection once no asynchronous operation refers to it anymore.
+            void check_destroy()
+            {
+                if (!closed_)
+                    return;
+                if (!is_close_handler_called_)
+                {
+                    is_close_handler_called_ = true;
+                    if (close_handler_ && !close_after_write_)
+                        close_handler_(*this);
+                }
+                if (!is_reading_ && !is_writing_ && !heartbeat_pending_)
+                    delete this;
+            }
+
+            Adaptor adaptor_;
+            boost::asio::steady_timer heartbeat_timer_;
+            std::chrono::milliseconds heartbeat_;
+            std::string last_event_id_;
+
+            std::vector<std::shared_ptr<const std::string>> sending_buffers_;
+            std::vector<std::shared_ptr<const std::string>> write_buffers_;
+            size_t pending_events_{0};
+            boost::array<char, 512> read_buffer_;
+
+            bool is_reading_{false};
+            bool is_writing_{false};
+            bool heartbeat_pending_{false};
+            bool written_since_heartbeat_{false};
+            bool closed_{false};
+            bool close_after_write_{false};
+            bool is_close_handler_called_{false};
+            // Expires when the connection is deleted, so events posted from other threads can tell
+            std::shared_ptr<char> alive_{std::make_shared<char>()};
+
+            std::function<void(crow::event_stream::connection&)> open_handler_;
+            std::function<void(crow::event_stream::connection&)> close_handler_;
+        };
+    } // namespace event_stream
+} // namespace crow
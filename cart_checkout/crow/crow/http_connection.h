@@ -18,6 +18,11 @@
 #include "crow/middleware.h"
 #include "crow/socket_adaptors.h"
 #include "crow/compression.h"
+#include "crow/access_log.h"
+#include "crow/metrics.h"
+#include "crow/instrumentation.h"
+#include "crow/request_timing.h"
+#include "crow/trace.h"
 
 namespace crow
 {
@@ -53,8 +58,12 @@ namespace crow
           get_cached_date_str(get_cached_date_str_f),
           task_timer_(task_timer),
           res_stream_threshold_(handler->stream_threshold()),
-          queue_length_(queue_length)
+          queue_length_(queue_length),
+          metrics_(handler->get_metrics()),
+          server_timing_every_(handler->server_timing_every()),
+          instrument_handlers_(metrics_ && handler->handlers_instrumented())
         {
+            if (metrics_) metrics_->connection_opened();
 #ifdef CROW_ENABLE_DEBUG
             connectionCount++;
             CROW_LOG_DEBUG << "Connection (" << this << ") allocated, total: " << connectionCount;
@@ -65,6 +74,7 @@ namespace crow
         {
             res.complete_request_handler_ = nullptr;
             cancel_deadline_timer();
+            if (metrics_) metrics_->connection_closed();
 #ifdef CROW_ENABLE_DEBUG
             connectionCount--;
             CROW_LOG_DEBUG << "Connection (" << this << ") freed, total: " << connectionCount;
@@ -110,13 +120,23 @@ namespace crow
         void handle()
         {
             cancel_deadline_timer();
+            request_start_ = std::chrono::steady_clock::now();
             bool is_invalid_request = false;
             add_keep_alive_ = false;
 
             req_ = std::move(parser_.to_request());
             request& req = req_;
 
-            req.remote_ip_address = adaptor_.remote_endpoint().address().to_string();
+            if (metrics_)
+            {
+                timing_.clear();
+                timing_.add(timing_phase::parse, elapsed_us(read_start_, request_start_));
+                timing_.sampled = should_sample_server_timing();
+                req.timing = &timing_;
+            }
+
+            remote_address_ = adaptor_.remote_endpoint().address();
+            req.remote_ip_address = remote_address_.to_string();
 
             add_keep_alive_ = req.keep_alive;
             close_connection_ = req.close_connection;
@@ -145,7 +165,15 @@ namespace crow
                 }
             }
 
-            CROW_LOG_INFO << "Request: " << boost::lexical_cast<std::string>(adaptor_.remote_endpoint()) << " " << this << " HTTP/" << (char)(req.http_ver_major + '0') << "." << (char)(req.http_ver_minor + '0') << ' ' << method_name(req.method) << " " << req.url;
+            // Event streams stay open; they are handed the socket so this connection does not hold a thread writing them
+            if (!is_invalid_request && !req.upgrade && req.get_header_value("accept").find("text/event-stream") != std::string::npos && handler_->is_event_stream(req))
+            {
+                close_connection_ = true;
+                handler_->handle_upgrade(req, res, std::move(adaptor_));
+                return;
+            }
+
+            CROW_LOG_DEBUG << "Request: " << req.remote_ip_address << " " << this << " HTTP/" << (char)(req.http_ver_major + '0') << "." << (char)(req.http_ver_minor + '0') << ' ' << method_name(req.method) << " " << req.url;
 
 
             need_to_call_after_handlers_ = false;
@@ -161,8 +189,11 @@ namespace crow
                 req.middleware_container = static_cast<void*>(middlewares_);
                 req.io_service = &adaptor_.get_io_service();
 
-                detail::middleware_call_helper<detail::middleware_call_criteria_only_global,
-                                               0, decltype(ctx_), decltype(*middlewares_)>(*middlewares_, req, res, ctx_);
+                {
+                    scoped_phase_timer timer(req, timing_phase::middleware);
+                    detail::middleware_call_helper<detail::middleware_call_criteria_only_global,
+                                                   0, decltype(ctx_), decltype(*middlewares_)>(*middlewares_, req, res, ctx_);
+                }
 
                 if (!res.completed_)
                 {
@@ -170,7 +201,16 @@ namespace crow
                         this->complete_request();
                     };
                     need_to_call_after_handlers_ = true;
-                    handler_->handle(req, res);
+                    if (instrument_handlers_)
+                    {
+                        // Only the synchronous part of the handler is measured
+                        handler_instrumentation instrumentation;
+                        instrumentation.begin();
+                        handler_->handle(req, res);
+                        metrics_->record_resources(req.route_id, instrumentation.end());
+                    }
+                    else
+                        handler_->handle(req, res);
                     if (add_keep_alive_)
                         res.set_header("connection", "Keep-Alive");
                 }
@@ -188,13 +228,14 @@ namespace crow
         /// Call the after handle middleware and send the write the response to the connection.
         void complete_request()
         {
-            CROW_LOG_INFO << "Response: " << this << ' ' << req_.raw_url << ' ' << res.code << ' ' << close_connection_;
+            CROW_LOG_DEBUG << "Response: " << this << ' ' << req_.raw_url << ' ' << res.code << ' ' << close_connection_;
 
             if (need_to_call_after_handlers_)
             {
                 need_to_call_after_handlers_ = false;
 
                 // call all after_handler of middlewares
+                scoped_phase_timer timer(req_, timing_phase::middleware);
                 detail::after_handlers_call_helper<
                   detail::middleware_call_criteria_only_global,
                   (static_cast<int>(sizeof...(Middlewares)) - 1),
@@ -242,7 +283,14 @@ namespace crow
                 res.set_header("location", location);
             }
 
-            prepare_buffers();
+            if (metrics_ && timing_.sampled)
+                res.set_header("Server-Timing", timing_.server_timing_header(elapsed_us(request_start_, std::chrono::steady_clock::now())));
+
+            {
+                scoped_phase_timer timer(req_, timing_phase::serialization);
+                prepare_buffers();
+            }
+            record_request();
 
             if (res.is_static_type())
             {
@@ -368,8 +416,86 @@ namespace crow
             buffers_.emplace_back(crlf.data(), crlf.size());
         }
 
+        /// Feed the finished request into the binary access log and the metrics registry, if enabled.
+        void record_request()
+        {
+            access_log_writer* access_log = handler_->get_access_log();
+            if (!access_log && !metrics_)
+            {
+                bytes_received_ = 0;
+                return;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            std::uint64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(now - request_start_).count();
+
+            size_t bytes_sent = res.is_static_type() && res.file_info.statResult == 0 ? static_cast<size_t>(res.file_info.statbuf.st_size) : res.body.size();
+            for (auto& buffer : buffers_)
+                bytes_sent += boost::asio::buffer_size(buffer);
+
+            if (metrics_)
+            {
+                metrics_->record_request(req_.route_id, res.code, latency_us, bytes_received_, bytes_sent);
+                metrics_->record_phases(req_.route_id, timing_);
+            }
+
+            if (access_log)
+            {
+                access_log_record record{};
+                record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count() - latency_us;
+                record.latency_us = static_cast<std::uint32_t>(latency_us);
+                record.bytes_received = static_cast<std::uint32_t>(bytes_received_);
+                record.bytes_sent = static_cast<std::uint32_t>(bytes_sent);
+                record.route_id = req_.route_id;
+                record.status = static_cast<std::uint16_t>(res.code);
+                record.method = static_cast<std::uint8_t>(req_.method);
+                record.http_version = static_cast<std::uint8_t>(req_.http_ver_major * 10 + req_.http_ver_minor);
+
+                if (remote_address_.is_v4())
+                {
+                    auto bytes = remote_address_.to_v4().to_bytes();
+                    record.ip_version = 4;
+                    std::memcpy(record.ip, bytes.data(), bytes.size());
+                }
+                else
+                {
+                    auto bytes = remote_address_.to_v6().to_bytes();
+                    record.ip_version = 6;
+                    std::memcpy(record.ip, bytes.data(), bytes.size());
+                }
+
+                access_log->write(record);
+            }
+            bytes_received_ = 0;
+        }
+
+        static std::uint32_t elapsed_us(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+        {
+            return to > from ? static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(to - from).count()) : 0;
+        }
+
+        /// Whether this thread's next response should carry a `Server-Timing` header.
+        bool should_sample_server_timing()
+        {
+            if (!server_timing_every_)
+                return false;
+            static thread_local unsigned counter = 0;
+            if (++counter < server_timing_every_)
+                return false;
+            counter = 0;
+            return true;
+        }
+
+        /// Report the time spent writing a response, which is only known after the response was recorded.
+        void record_write(std::uint16_t route_id, std::chrono::steady_clock::time_point write_start)
+        {
+            if (metrics_)
+                metrics_->record_phase(route_id, timing_phase::write, elapsed_us(write_start, std::chrono::steady_clock::now()));
+        }
+
         void do_write_static()
         {
+            auto write_start = std::chrono::steady_clock::now();
             is_writing = true;
             boost::asio::write(adaptor_.socket(), buffers_);
 
@@ -386,6 +512,8 @@ namespace crow
                     is.read(buf, sizeof(buf));
                 }
             }
+            record_write(req_.route_id, write_start);
+            CROW_TRACE3(write_complete, this, req_.route_id, 0);
             is_writing = false;
             if (close_connection_)
             {
@@ -419,6 +547,7 @@ namespace crow
             }
             else
             {
+                auto write_start = std::chrono::steady_clock::now();
                 is_writing = true;
                 boost::asio::write(adaptor_.socket(), buffers_); // Write the response start / headers
                 if (res.body.length() > 0)
@@ -444,6 +573,8 @@ namespace crow
                     buffers.push_back(boost::asio::buffer(buf));
                     do_write_sync(buffers);
                 }
+                record_write(req_.route_id, write_start);
+                CROW_TRACE3(write_complete, this, req_.route_id, 0);
                 is_writing = false;
                 if (close_connection_)
                 {
@@ -470,6 +601,9 @@ namespace crow
                   bool error_while_reading = true;
                   if (!ec)
                   {
+                      if (bytes_received_ == 0 && metrics_)
+                          read_start_ = std::chrono::steady_clock::now();
+                      bytes_received_ += bytes_transferred;
                       bool ret = parser_.feed(buffer_.data(), bytes_transferred);
                       if (ret && adaptor_.is_open())
                       {
@@ -512,10 +646,15 @@ namespace crow
         {
             //auto self = this->shared_from_this();
             is_writing = true;
+            std::uint16_t route_id = req_.route_id;
+            auto write_start = metrics_ ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
             boost::asio::async_write(
               adaptor_.socket(), buffers_,
-              [&](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
+              [&, route_id, write_start](const boost::system::error_code& ec, std::size_t /*bytes_transferred*/) {
                   is_writing = false;
+                  CROW_TRACE3(write_complete, this, route_id, ec.value());
+                  if (!ec)
+                      record_write(route_id, write_start);
                   res.clear();
                   res_body_copy_.clear();
                   parser_.clear();
@@ -606,7 +745,7 @@ namespace crow
         std::string date_str_;
         std::string res_body_copy_;
 
-        detail::task_timer::identifier_type task_id_;
+        detail::task_timer::identifier_type task_id_{};
 
         bool is_reading{};
         bool is_writing{};
@@ -622,7 +761,16 @@ namespace crow
 
         size_t res_stream_threshold_;
 
+        std::chrono::steady_clock::time_point read_start_;
+        std::chrono::steady_clock::time_point request_start_;
+        request_timing timing_;
+        boost::asio::ip::address remote_address_;
+        size_t bytes_received_{0};
+
         std::atomic<unsigned int>& queue_length_;
+        metrics_registry* metrics_;
+        unsigned server_timing_every_;
+        bool instrument_handlers_;
     };
 
 } // namespace crow
@@ -8,6 +8,8 @@
 
 namespace crow
 {
+    struct request_timing;
+
     /// Find and return the value associated with the key. (returns an empty string if nothing is found)
     template<typename T>
     inline const std::string& get_header_value(const T& headers, const std::string& key)
@@ -32,10 +34,12 @@ namespace crow
         std::string remote_ip_address; ///< The IP address from which the request was sent.
         unsigned char http_ver_major, http_ver_minor;
         bool keep_alive, close_connection, upgrade;
+        std::uint16_t route_id{}; ///< The id of the route that handled this request (0 if none matched).
 
         void* middleware_context{};
         void* middleware_container{};
         boost::asio::io_service* io_service{};
+        request_timing* timing{}; ///< Per-phase timing of this request (null when metrics are disabled), see \ref scoped_phase_timer.
 
         /// Construct an empty request. (sets the method to `GET`)
         request():
@@ -16,6 +16,8 @@
 #include "crow/http_connection.h"
 #include "crow/logging.h"
 #include "crow/task_timer.h"
+#include "crow/profiler.h"
+#include "crow/trace.h"
 
 namespace crow
 {
@@ -26,8 +28,8 @@ namespace crow
     class Server
     {
     public:
-        Server(Handler* handler, std::string bindaddr, uint16_t port, std::string server_name = std::string("Crow/") + VERSION, std::tuple<Middlewares...>* middlewares = nullptr, uint16_t concurrency = 1, uint8_t timeout = 5, typename Adaptor::context* adaptor_ctx = nullptr):
-          acceptor_(io_service_, tcp::endpoint(boost::asio::ip::address::from_string(bindaddr), port)),
+        Server(Handler* handler, std::string bindaddr, uint16_t port, std::string server_name = std::string("Crow/") + VERSION, std::tuple<Middlewares...>* middlewares = nullptr, uint16_t concurrency = 1, uint8_t timeout = 5, typename Adaptor::context* adaptor_ctx = nullptr, bool reuse_port = false):
+          acceptor_(io_service_),
           signals_(io_service_),
           tick_timer_(io_service_),
           handler_(handler),
@@ -39,7 +41,22 @@ namespace crow
           task_queue_length_pool_(concurrency_ - 1),
           middlewares_(middlewares),
           adaptor_ctx_(adaptor_ctx)
-        {}
+        {
+            // What the acceptor's endpoint constructor does, with SO_REUSEPORT set before binding when asked
+            tcp::endpoint endpoint(boost::asio::ip::address::from_string(bindaddr), port);
+            acceptor_.open(endpoint.protocol());
+            acceptor_.set_option(tcp::acceptor::reuse_address(true));
+            if (reuse_port)
+            {
+#ifdef SO_REUSEPORT
+                acceptor_.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#else
+                CROW_LOG_WARNING << "SO_REUSEPORT is not supported on this platform";
+#endif
+            }
+            acceptor_.bind(endpoint);
+            acceptor_.listen();
+        }
 
         void set_tick_function(std::chrono::milliseconds d, std::function<void()> f)
         {
@@ -105,6 +122,8 @@ namespace crow
                         task_timer_pool_[i] = &task_timer;
                         task_queue_length_pool_[i] = 0;
 
+                        sampling_profiler::thread_registration profiler_registration("crow-worker-" + std::to_string(i));
+
                         init_count++;
                         while (1)
                         {
@@ -153,6 +172,7 @@ namespace crow
 
             std::thread(
               [this] {
+                  sampling_profiler::thread_registration profiler_registration("crow-acceptor");
                   io_service_.run();
                   CROW_LOG_INFO << "Exiting.";
               })
@@ -166,6 +186,16 @@ namespace crow
                 io_service->stop();
         }
 
+        /// Number of connections currently assigned to each worker thread
+        std::vector<unsigned int> queue_lengths() const
+        {
+            std::vector<unsigned int> lengths;
+            lengths.reserve(task_queue_length_pool_.size());
+            for (auto& length : task_queue_length_pool_)
+                lengths.push_back(length.load(std::memory_order_relaxed));
+            return lengths;
+        }
+
         void signal_clear()
         {
             signals_.clear();
@@ -207,6 +237,7 @@ namespace crow
               [this, p, &is, service_idx](boost::system::error_code ec) {
                   if (!ec)
                   {
+                      CROW_TRACE2(accept, p, service_idx);
                       is.post(
                         [p] {
                             p->start();
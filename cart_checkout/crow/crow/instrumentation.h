@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "crow/logging.h"
+
+namespace crow
+{
+    namespace detail
+    {
+        /// Heap activity of one thread, maintained by the hooks in crow/allocation_hooks.h (all zero without them).
+        struct allocation_counters
+        {
+            std::uint64_t allocations;
+            std::uint64_t deallocations;
+            std::uint64_t bytes;
+        };
+
+        /// Plain data, so thread_local access needs no initialization guard (it runs inside operator new).
+        inline allocation_counters& thread_allocation_counters()
+        {
+            static thread_local allocation_counters counters;
+            return counters;
+        }
+    } // namespace detail
+
+    /// Resources used by one handler invocation.
+    struct resource_usage
+    {
+        enum counter : unsigned
+        {
+            allocations,
+            allocated_bytes,
+            instructions,
+            cycles,
+            cache_misses,
+            context_switches,
+
+            counter_count
+        };
+
+        std::uint64_t values[counter_count]{};
+    };
+
+    /// Hardware / software perf counters of the calling thread, read with one `read()` on a counter group.
+
+    ///
+    /// Needs `perf_event_open` to be permitted (`kernel.perf_event_paranoid` <= 2 for counting a thread's
+    /// own user space); when it is not, or on other platforms, the counters stay at zero.
+    class perf_counter_group
+    {
+    public:
+        static constexpr unsigned event_count = 4;
+
+        perf_counter_group()
+        {
+#ifdef __linux__
+            // Order matches read(): instructions, cycles, cache misses, context switches
+            static const std::uint32_t types[event_count] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+            static const std::uint64_t configs[event_count] = {PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES};
+
+            for (unsigned i = 0; i < event_count; i++)
+            {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = types[i];
+                attr.config = configs[i];
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.disabled = leader_ < 0;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+
+                // The first event which opens leads the group; not every PMU exposes every event (e.g. virtual machines)
+                int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader_ < 0 ? -1 : fds_[leader_], 0));
+                if (fd < 0)
+                {
+                    CROW_LOG_DEBUG << "perf_event_open failed for counter " << i << ": " << std::strerror(errno);
+                    continue;
+                }
+                fds_[i] = fd;
+                if (leader_ < 0)
+                    leader_ = static_cast<int>(i);
+            }
+            if (leader_ < 0)
+            {
+                CROW_LOG_WARNING << "perf_event_open is not permitted, per-route perf counters are disabled on this thread";
+                return;
+            }
+            ioctl(fds_[leader_], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+        }
+
+        perf_counter_group(const perf_counter_group&) = delete;
+        perf_counter_group& operator=(const perf_counter_group&) = delete;
+
+        ~perf_counter_group()
+        {
+#ifdef __linux__
+            for (int fd : fds_)
+                if (fd >= 0)
+                    close(fd);
+#endif
+        }
+
+        bool available() const { return leader_ >= 0; }
+
+        /// Current counter values (instructions, cycles, cache misses, context switches).
+        void read(std::uint64_t values[event_count]) const
+        {
+            std::memset(values, 0, sizeof(std::uint64_t) * event_count);
+#ifdef __linux__
+            if (!available())
+                return;
+            // PERF_FORMAT_GROUP: the number of events followed by their values, in the order they were opened
+            std::uint64_t buffer[1 + event_count];
+            ssize_t size = ::read(fds_[leader_], buffer, sizeof(buffer));
+            if (size < static_cast<ssize_t>(sizeof(std::uint64_t)))
+                return;
+            unsigned value = 1;
+            for (unsigned i = 0; i < event_count && value <= buffer[0]; i++)
+            {
+                if (fds_[i] >= 0)
+                    values[i] = buffer[value++];
+            }
+#endif
+        }
+
+    private:
+        int fds_[event_count]{-1, -1, -1, -1};
+        int leader_{-1};
+    };
+
+    /// Measures the resources used by the calling thread between \ref begin and \ref end.
+    class handler_instrumentation
+    {
+    public:
+        void begin()
+        {
+            start_ = snapshot();
+        }
+
+        resource_usage end() const
+        {
+            resource_usage now = snapshot();
+            for (unsigned i = 0; i < resource_usage::counter_count; i++)
+                now.values[i] -= start_.values[i];
+            return now;
+        }
+
+    private:
+        static resource_usage snapshot()
+        {
+            resource_usage usage;
+            const detail::allocation_counters& allocations = detail::thread_allocation_counters();
+            usage.values[resource_usage::allocations] = allocations.allocations;
+            usage.values[resource_usage::allocated_bytes] = allocations.bytes;
+
+            static thread_local perf_counter_group counters;
+            counters.read(usage.values + resource_usage::instructions);
+            return usage;
+        }
+
+        resource_usage start_;
+    };
+} // namespace crow
@@ -147,17 +147,17 @@ namespace crow
 } // namespace crow
 
 #define CROW_LOG_CRITICAL                                                  \
-    if (crow::logger::get_current_log_level() <= crow::LogLevel::Critical) \
+    if (CROW_LOG_COMPILE_LEVEL <= 4 && crow::logger::get_current_log_level() <= crow::LogLevel::Critical) \
     crow::logger(crow::LogLevel::Critical)
 #define CROW_LOG_ERROR                                                  \
-    if (crow::logger::get_current_log_level() <= crow::LogLevel::Error) \
+    if (CROW_LOG_COMPILE_LEVEL <= 3 && crow::logger::get_current_log_level() <= crow::LogLevel::Error) \
     crow::logger(crow::LogLevel::Error)
 #define CROW_LOG_WARNING                                                  \
-    if (crow::logger::get_current_log_level() <= crow::LogLevel::Warning) \
+    if (CROW_LOG_COMPILE_LEVEL <= 2 && crow::logger::get_current_log_level() <= crow::LogLevel::Warning) \
     crow::logger(crow::LogLevel::Warning)
 #define CROW_LOG_INFO                                                  \
-    if (crow::logger::get_current_log_level() <= crow::LogLevel::Info) \
+    if (CROW_LOG_COMPILE_LEVEL <= 1 && crow::logger::get_current_log_level() <= crow::LogLevel::Info) \
     crow::logger(crow::LogLevel::Info)
 #define CROW_LOG_DEBUG                                                  \
-    if (crow::logger::get_current_log_level() <= crow::LogLevel::Debug) \
+    if (CROW_LOG_COMPILE_LEVEL <= 0 && crow::logger::get_current_log_level() <= crow::LogLevel::Debug) \
     crow::logger(crow::LogLevel::Debug)
@@ -0,0 +1,569 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crow/instrumentation.h"
+#include "crow/request_timing.h"
+
+namespace crow
+{
+    /// A lock-free latency histogram with HDR-style log-linear buckets.
+
+    ///
+    /// Values are microseconds. Every power of two is split into 8 sub-buckets, so any recorded value
+    /// is reported with at most 12.5% error, from 1us up to ~71 minutes (larger values are clamped).
+    class latency_histogram
+    {
+    public:
+        static constexpr unsigned sub_bucket_bits = 3;
+        static constexpr unsigned sub_bucket_count = 1u << sub_bucket_bits;
+        static constexpr unsigned max_value_bits = 32;
+        static constexpr unsigned bucket_count = (max_value_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+        static unsigned bucket_index(std::uint64_t value)
+        {
+            if (value < sub_bucket_count)
+                return static_cast<unsigned>(value);
+            if (value >> max_value_bits)
+                return bucket_count - 1;
+            unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(value));
+            unsigned shift = msb - sub_bucket_bits;
+            return (msb - sub_bucket_bits + 1) * sub_bucket_count + static_cast<unsigned>((value >> shift) & (sub_bucket_count - 1));
+        }
+
+        /// Exclusive upper bound of the values counted in a bucket.
+        static std::uint64_t bucket_upper_bound(unsigned index)
+        {
+            if (index < sub_bucket_count)
+                return index + 1;
+            unsigned shift = index / sub_bucket_count - 1;
+            std::uint64_t sub = index % sub_bucket_count;
+            return (sub_bucket_count + sub + 1) << shift;
+        }
+
+        /// Value below which a fraction \p q of the samples in \p counts fall.
+        static std::uint64_t value_at_quantile(const std::vector<std::uint64_t>& counts, double q)
+        {
+            std::uint64_t total = 0;
+            for (auto c : counts)
+                total += c;
+            if (total == 0)
+                return 0;
+
+            std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+            if (rank == 0) rank = 1;
+            std::uint64_t seen = 0;
+            for (unsigned i = 0; i < counts.size(); i++)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                    return bucket_upper_bound(i);
+            }
+            return bucket_upper_bound(bucket_count - 1);
+        }
+
+        latency_histogram()
+        {
+            for (auto& count : counts_)
+                count.store(0, std::memory_order_relaxed);
+        }
+
+        void record(std::uint64_t value)
+        {
+            counts_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+            sum_.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        /// Add this histogram's buckets to \p counts (which must hold \ref bucket_count entries) and \p sum.
+        void merge_into(std::vector<std::uint64_t>& counts, std::uint64_t& sum) const
+        {
+            for (unsigned i = 0; i < bucket_count; i++)
+                counts[i] += counts_[i].load(std::memory_order_relaxed);
+            sum += sum_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<std::uint64_t> counts_[bucket_count];
+        std::atomic<std::uint64_t> sum_{0};
+    };
+
+    /// Request metrics for every route, exported in the Prometheus text format.
+
+    ///
+    /// Every recording thread writes to its own shard (picked once per thread) so that workers never
+    /// contend on the same cache lines; shards are only merged when the metrics are rendered.
+    class metrics_registry
+    {
+    public:
+        static constexpr unsigned shard_count = 8;
+        /// Status classes: 0 = other, 1 = 1xx ... 5 = 5xx
+        static constexpr unsigned status_class_count = 6;
+
+        void enable() { enabled_ = true; }
+        bool enabled() const { return enabled_; }
+
+        /// Histograms kept per route: one per status class followed by one per \ref timing_phase.
+        static constexpr unsigned histograms_per_route = status_class_count + timing_phase_count;
+
+        /// Most operations that can be registered with \ref operation.
+        static constexpr unsigned max_operations = 32;
+
+        /// Counters kept per route for instrumented handlers: invocations followed by every \ref resource_usage counter.
+        static constexpr unsigned resource_counters_per_route = 1 + resource_usage::counter_count;
+
+        /// Bytes of memory \ref share needs to hold the metrics of \p routes routes.
+        static size_t shared_size(size_t routes)
+        {
+            return round_up(sizeof(memory_header)) + shard_count * shard_size(routes);
+        }
+
+        /// Keep the metrics in \p memory (\p size bytes, zeroed before its first use) instead of the heap.
+
+        ///
+        /// Call before the app runs. Every registry sharing the memory (e.g. one per process of a preforked server,
+        /// the memory being mapped shared before forking) records into and renders the same counters, so /metrics
+        /// covers every process whichever answers it (their threads then share the shards). The first registry to
+        /// start lays the memory out; the others must have the same routes, or keep their metrics on the heap.
+        void share(void* memory, size_t size)
+        {
+            shared_memory_ = memory;
+            shared_size_ = size;
+        }
+
+        /// Allocate histograms for \p routes routes, must be called before any request is recorded.
+        void resize(size_t routes)
+        {
+            routes_ = routes;
+            if (shared_memory_ && attach_shared(routes))
+                return;
+            if (shared_memory_)
+                CROW_LOG_WARNING << "Metrics kept by this process only: the shared memory does not fit or does not match its " << routes << " routes";
+
+            owned_memory_.reset(new char[shared_size(routes) + 64]);
+            char* aligned = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(owned_memory_.get()) + 63) & ~std::uintptr_t(63));
+            lay_out(aligned, routes, true);
+        }
+
+        /// Id of the operation called \p name (e.g. a database call) for \ref scoped_operation_timer, registering it if needed.
+
+        ///
+        /// Register every operation before the server starts. Past \ref max_operations, the id returned is not recorded.
+        unsigned operation(const std::string& name)
+        {
+            for (unsigned i = 0; i < operation_names_.size(); i++)
+            {
+                if (operation_names_[i] == name)
+                    return i;
+            }
+            if (operation_names_.size() == max_operations)
+                return max_operations;
+            operation_names_.push_back(name);
+            return static_cast<unsigned>(operation_names_.size() - 1);
+        }
+
+        /// Record one call of an operation.
+        void record_operation(unsigned operation, std::uint64_t us)
+        {
+            if (operation < operation_names_.size() && routes_)
+                local_shard().operations[operation].record(us);
+        }
+
+        /// Record a finished request: a few relaxed increments on this thread's own shard.
+        void record_request(std::uint16_t route_id, int status, std::uint64_t latency_us, size_t bytes_in, size_t bytes_out)
+        {
+            shard& s = local_shard();
+            if (route_id < routes_)
+                s.histograms[route_id * histograms_per_route + status_class(status)].record(latency_us);
+            if (s.bytes)
+            {
+                s.bytes[0].fetch_add(bytes_in, std::memory_order_relaxed);
+                s.bytes[1].fetch_add(bytes_out, std::memory_order_relaxed);
+            }
+        }
+
+        /// Record the time a request spent in one phase.
+        void record_phase(std::uint16_t route_id, timing_phase phase, std::uint64_t us)
+        {
+            if (route_id < routes_)
+                local_shard().histograms[route_id * histograms_per_route + status_class_count + static_cast<unsigned>(phase)].record(us);
+        }
+
+        /// Add the resources one handler invocation used to its route's counters.
+        void record_resources(std::uint16_t route_id, const resource_usage& usage)
+        {
+            if (route_id >= routes_)
+                return;
+            std::atomic<std::uint64_t>* counters = &local_shard().resources[route_id * resource_counters_per_route];
+            counters[0].fetch_add(1, std::memory_order_relaxed);
+            for (unsigned i = 0; i < resource_usage::counter_count; i++)
+                counters[1 + i].fetch_add(usage.values[i], std::memory_order_relaxed);
+        }
+
+        /// Record every phase the request spent any time in.
+        void record_phases(std::uint16_t route_id, const request_timing& timing)
+        {
+            if (route_id >= routes_)
+                return;
+            shard& s = local_shard();
+            for (unsigned i = 0; i < timing_phase_count; i++)
+            {
+                if (timing.phase_us[i])
+                    s.histograms[route_id * histograms_per_route + status_class_count + i].record(timing.phase_us[i]);
+            }
+        }
+
+        void connection_opened()
+        {
+            if (header_)
+                header_->active_connections.fetch_add(1, std::memory_order_relaxed);
+        }
+        void connection_closed()
+        {
+            if (header_)
+                header_->active_connections.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        /// Merged latency buckets and sum for a route / status class.
+        void snapshot(std::uint16_t route_id, unsigned status_class, std::vector<std::uint64_t>& counts, std::uint64_t& sum) const
+        {
+            snapshot_histogram(route_id, status_class, counts, sum);
+        }
+
+        /// Merged buckets and sum for the time a route spent in a phase.
+        void snapshot(std::uint16_t route_id, timing_phase phase, std::vector<std::uint64_t>& counts, std::uint64_t& sum) const
+        {
+            snapshot_histogram(route_id, status_class_count + static_cast<unsigned>(phase), counts, sum);
+        }
+
+        /// Append every metric to \p out in the Prometheus text exposition format (version 0.0.4).
+        void render(std::string& out, const std::vector<std::string>& route_names, const std::vector<unsigned int>& queue_lengths) const
+        {
+            std::vector<std::uint64_t> counts;
+            std::uint64_t sum;
+
+            out += "# HELP crow_request_duration_seconds Time from a request being parsed to its response being ready.\n";
+            out += "# TYPE crow_request_duration_seconds histogram\n";
+            for (size_t route = 0; route < routes_; route++)
+            {
+                for (unsigned cls = 0; cls < status_class_count; cls++)
+                {
+                    snapshot_histogram(static_cast<std::uint16_t>(route), cls, counts, sum);
+                    append_histogram(out, "crow_request_duration_seconds", route_label(route_names, route) + ",status=\"" + status_label(cls) + "\"", counts, sum);
+                }
+            }
+
+            out += "# HELP crow_request_phase_duration_seconds Time spent in each phase of a request.\n";
+            out += "# TYPE crow_request_phase_duration_seconds histogram\n";
+            for (size_t route = 0; route < routes_; route++)
+            {
+                for (unsigned phase = 0; phase < timing_phase_count; phase++)
+                {
+                    snapshot_histogram(static_cast<std::uint16_t>(route), status_class_count + phase, counts, sum);
+                    append_histogram(out, "crow_request_phase_duration_seconds", route_label(route_names, route) + ",phase=\"" + timing_phase_name(static_cast<timing_phase>(phase)) + "\"", counts, sum);
+                }
+            }
+
+            out += "# HELP crow_operation_duration_seconds Time spent in each call of an operation, e.g. a database call.\n";
+            out += "# TYPE crow_operation_duration_seconds histogram\n";
+            for (unsigned operation = 0; operation < operation_names_.size() && routes_; operation++)
+            {
+                counts.assign(latency_histogram::bucket_count, 0);
+                sum = 0;
+                for (auto& shard : shards_)
+                    shard.operations[operation].merge_into(counts, sum);
+                append_histogram(out, "crow_operation_duration_seconds", "operation=\"" + escape_label(operation_names_[operation]) + "\"", counts, sum);
+            }
+
+            render_resources(out, route_names);
+
+            std::uint64_t bytes_in = 0, bytes_out = 0;
+            for (auto& shard : shards_)
+            {
+                if (shard.bytes)
+                {
+                    bytes_in += shard.bytes[0].load(std::memory_order_relaxed);
+                    bytes_out += shard.bytes[1].load(std::memory_order_relaxed);
+                }
+            }
+            out += "# HELP crow_received_bytes_total Bytes read from clients.\n# TYPE crow_received_bytes_total counter\n";
+            append_sample(out, "crow_received_bytes_total", "", bytes_in);
+            out += "# HELP crow_sent_bytes_total Bytes written to clients.\n# TYPE crow_sent_bytes_total counter\n";
+            append_sample(out, "crow_sent_bytes_total", "", bytes_out);
+
+            out += "# HELP crow_active_connections Open client connections.\n# TYPE crow_active_connections gauge\n";
+            append_sample(out, "crow_active_connections", "", static_cast<std::uint64_t>(header_ ? header_->active_connections.load(std::memory_order_relaxed) : 0));
+
+            out += "# HELP crow_worker_queue_length Connections assigned to each worker thread of the process answering.\n# TYPE crow_worker_queue_length gauge\n";
+            for (size_t i = 0; i < queue_lengths.size(); i++)
+                append_sample(out, "crow_worker_queue_length", "worker=\"" + std::to_string(i) + "\"", queue_lengths[i]);
+        }
+
+        /// Append one histogram in the Prometheus format, skipping it if it has no samples.
+        static void append_histogram(std::string& out, const char* name, const std::string& labels, const std::vector<std::uint64_t>& counts, std::uint64_t sum_us)
+        {
+            static const double bounds_seconds[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+            std::uint64_t total = 0;
+            for (auto c : counts)
+                total += c;
+            if (total == 0)
+                return;
+
+            std::string bucket_name = std::string(name) + "_bucket";
+
+            // Fine buckets are folded into the closest exported bound they fit under.
+            unsigned bucket = 0;
+            std::uint64_t cumulative = 0;
+            for (double bound : bounds_seconds)
+            {
+                std::uint64_t bound_us = static_cast<std::uint64_t>(bound * 1e6);
+                while (bucket < latency_histogram::bucket_count && latency_histogram::bucket_upper_bound(bucket) <= bound_us + 1)
+                    cumulative += counts[bucket++];
+                append_sample(out, bucket_name.c_str(), labels + ",le=\"" + format_double(bound) + "\"", cumulative);
+            }
+            append_sample(out, bucket_name.c_str(), labels + ",le=\"+Inf\"", total);
+            out += std::string(name) + "_sum{" + labels + "} " + format_double(static_cast<double>(sum_us) / 1e6) + "\n";
+            append_sample(out, (std::string(name) + "_count").c_str(), labels, total);
+        }
+
+        static unsigned status_class(int status)
+        {
+            return status >= 100 && status < 600 ? static_cast<unsigned>(status / 100) : 0;
+        }
+
+        static std::string escape_label(const std::string& value)
+        {
+            std::string escaped;
+            escaped.reserve(value.size());
+            for (char c : value)
+            {
+                if (c == '\\' || c == '"')
+                    escaped += '\\';
+                if (c == '\n')
+                {
+                    escaped += "\\n";
+                    continue;
+                }
+                escaped += c;
+            }
+            return escaped;
+        }
+
+        static std::string format_double(double value)
+        {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%g", value);
+            return buffer;
+        }
+
+        static void append_sample(std::string& out, const char* name, const std::string& labels, std::uint64_t value)
+        {
+            out += name;
+            if (!labels.empty())
+            {
+                out += '{';
+                out += labels;
+                out += '}';
+            }
+            out += ' ';
+            out += std::to_string(value);
+            out += '\n';
+        }
+
+    private:
+        void render_resources(std::string& out, const std::vector<std::string>& route_names) const
+        {
+            static const char* names[resource_counters_per_route] = {
+              "crow_handler_invocations_total", "crow_handler_allocations_total", "crow_handler_allocated_bytes_total",
+              "crow_handler_instructions_total", "crow_handler_cycles_total", "crow_handler_cache_misses_total", "crow_handler_context_switches_total"};
+            static const char* help[resource_counters_per_route] = {
+              "Instrumented handler invocations.", "Heap allocations made by handlers.", "Bytes allocated by handlers.",
+              "Instructions retired in handlers.", "CPU cycles spent in handlers.", "Cache misses in handlers.", "Context switches during handlers."};
+
+            for (unsigned counter = 0; counter < resource_counters_per_route; counter++)
+            {
+                bool header = false;
+                for (size_t route = 0; route < routes_; route++)
+                {
+                    std::uint64_t invocations = 0, value = 0;
+                    for (auto& shard : shards_)
+                    {
+                        invocations += shard.resources[route * resource_counters_per_route].load(std::memory_order_relaxed);
+                        value += shard.resources[route * resource_counters_per_route + counter].load(std::memory_order_relaxed);
+                    }
+                    if (!invocations)
+                        continue;
+                    if (!header)
+                    {
+                        out += std::string("# HELP ") + names[counter] + " " + help[counter] + "\n# TYPE " + names[counter] + " counter\n";
+                        header = true;
+                    }
+                    append_sample(out, names[counter], route_label(route_names, route), value);
+                }
+            }
+        }
+
+        void snapshot_histogram(std::uint16_t route_id, unsigned index, std::vector<std::uint64_t>& counts, std::uint64_t& sum) const
+        {
+            counts.assign(latency_histogram::bucket_count, 0);
+            sum = 0;
+            if (route_id >= routes_)
+                return;
+            for (auto& shard : shards_)
+                shard.histograms[route_id * histograms_per_route + index].merge_into(counts, sum);
+        }
+
+        static std::string route_label(const std::vector<std::string>& route_names, size_t route)
+        {
+            return "route=\"" + escape_label(route < route_names.size() ? route_names[route] : std::to_string(route)) + "\"";
+        }
+
+        static const char* status_label(unsigned cls)
+        {
+            static const char* labels[] = {"other", "1xx", "2xx", "3xx", "4xx", "5xx"};
+            return labels[cls];
+        }
+
+        /// Pointers into the memory holding the metrics, one shard per \ref shard_count.
+        struct shard
+        {
+            latency_histogram* histograms;
+            std::atomic<std::uint64_t>* resources;
+            latency_histogram* operations;
+            std::atomic<std::uint64_t>* bytes; // received, sent
+        };
+
+        /// Starts the memory holding the metrics; the shards follow it.
+        struct memory_header
+        {
+            std::atomic<std::uint32_t> state; // 0 = not laid out, 1 = being laid out, 2 = ready
+            std::atomic<std::uint32_t> routes;
+            std::atomic<std::int64_t> active_connections;
+        };
+
+        static size_t round_up(size_t bytes)
+        {
+            return (bytes + 63) & ~size_t(63);
+        }
+
+        static size_t shard_size(size_t routes)
+        {
+            return round_up(routes * histograms_per_route * sizeof(latency_histogram)) +
+                   round_up(routes * resource_counters_per_route * sizeof(std::atomic<std::uint64_t>)) +
+                   round_up(max_operations * sizeof(latency_histogram)) +
+                   round_up(2 * sizeof(std::atomic<std::uint64_t>));
+        }
+
+        /// Point the shards into \p memory, constructing what it holds if \p construct.
+        void lay_out(char* memory, size_t routes, bool construct)
+        {
+            header_ = reinterpret_cast<memory_header*>(memory);
+            if (construct)
+                new (memory) memory_header();
+            char* next = memory + round_up(sizeof(memory_header));
+            for (auto& shard : shards_)
+            {
+                shard.histograms = reinterpret_cast<latency_histogram*>(next);
+                next += round_up(routes * histograms_per_route * sizeof(latency_histogram));
+                shard.resources = reinterpret_cast<std::atomic<std::uint64_t>*>(next);
+                next += round_up(routes * resource_counters_per_route * sizeof(std::atomic<std::uint64_t>));
+                shard.operations = reinterpret_cast<latency_histogram*>(next);
+                next += round_up(max_operations * sizeof(latency_histogram));
+                shard.bytes = reinterpret_cast<std::atomic<std::uint64_t>*>(next);
+                next += round_up(2 * sizeof(std::atomic<std::uint64_t>));
+                if (!construct)
+                    continue;
+                for (size_t i = 0; i < routes * histograms_per_route; i++)
+                    new (&shard.histograms[i]) latency_histogram();
+                for (size_t i = 0; i < routes * resource_counters_per_route; i++)
+                    new (&shard.resources[i]) std::atomic<std::uint64_t>(0);
+                for (size_t i = 0; i < max_operations; i++)
+                    new (&shard.operations[i]) latency_histogram();
+                for (size_t i = 0; i < 2; i++)
+                    new (&shard.bytes[i]) std::atomic<std::uint64_t>(0);
+            }
+        }
+
+        /// Use the shared memory, laying it out if no registry has yet; false if it cannot hold \p routes routes.
+        bool attach_shared(size_t routes)
+        {
+            if (shared_size(routes) > shared_size_)
+                return false;
+            char* memory = static_cast<char*>(shared_memory_);
+            auto* header = reinterpret_cast<memory_header*>(memory);
+            std::uint32_t state = 0;
+            if (header->state.compare_exchange_strong(state, 1, std::memory_order_acquire))
+            {
+                lay_out(memory, routes, true);
+                header->routes.store(static_cast<std::uint32_t>(routes), std::memory_order_relaxed);
+                header->state.store(2, std::memory_order_release);
+                return true;
+            }
+
+            // Laid out by another process, which might have died halfway through
+            for (int waits = 0; state != 2 && waits < 1000; waits++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                state = header->state.load(std::memory_order_acquire);
+            }
+            if (state != 2 || header->routes.load(std::memory_order_relaxed) != routes)
+                return false;
+            lay_out(memory, routes, false);
+            return true;
+        }
+
+        shard& local_shard()
+        {
+            static std::atomic<unsigned> next_shard{0};
+            static thread_local unsigned index = next_shard.fetch_add(1, std::memory_order_relaxed) % shard_count;
+            return shards_[index];
+        }
+
+        bool enabled_{false};
+        size_t routes_{0};
+        std::vector<std::string> operation_names_;
+        shard shards_[shard_count]{};
+        memory_header* header_{nullptr};
+        std::unique_ptr<char[]> owned_memory_;
+        void* shared_memory_{nullptr};
+        size_t shared_size_{0};
+    };
+
+    /// Records the time between its construction and destruction as one call of an operation.
+
+    ///
+    /// Does nothing when \p metrics is null (metrics disabled).
+    /// Usage: `{ crow::scoped_operation_timer timer(app.get_metrics(), insert_user); collection.insert_one(...); }`
+    class scoped_operation_timer
+    {
+    public:
+        scoped_operation_timer(metrics_registry* metrics, unsigned operation):
+          metrics_(metrics), operation_(operation)
+        {
+            if (metrics_)
+                start_ = std::chrono::steady_clock::now();
+        }
+
+        scoped_operation_timer(const scoped_operation_timer&) = delete;
+        scoped_operation_timer& operator=(const scoped_operation_timer&) = delete;
+
+        ~scoped_operation_timer()
+        {
+            if (metrics_)
+                metrics_->record_operation(operation_, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count());
+        }
+
+    private:
+        metrics_registry* metrics_;
+        unsigned operation_;
+        std::chrono::steady_clock::time_point start_;
+    };
+} // namespace crow
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "crow/http_request.h"
+#include "crow/http_response.h"
+#include "crow/json.h"
+#include "crow/logging.h"
+
+namespace crow
+{
+    /// Header at the start of a traffic capture file. Multi-byte fields are little-endian (host order).
+    struct traffic_capture_header
+    {
+        char magic[8];            ///< "CROWCAPT"
+        std::uint32_t version;    ///< Format version (1).
+        std::uint32_t reserved0;
+        std::uint64_t started_us; ///< Wall clock time the capture started, in microseconds since the epoch.
+        std::uint8_t reserved[40];
+    };
+    static_assert(sizeof(traffic_capture_header) == 64, "traffic_capture_header must stay 64 bytes");
+
+    /// Fixed part of one captured request; followed by the url, the headers (each a `uint16 name length,
+    /// uint16 value length, name, value`) and the body.
+    struct traffic_capture_record
+    {
+        std::uint32_t size;         ///< Size of the whole record, this struct included.
+        std::uint32_t body_size;
+        std::uint64_t offset_us;    ///< Time since the capture started.
+        std::uint16_t url_size;
+        std::uint16_t header_count;
+        std::uint8_t method;        ///< crow::HTTPMethod
+        std::uint8_t reserved[3];
+    };
+    static_assert(sizeof(traffic_capture_record) == 24, "traffic_capture_record must stay 24 bytes");
+
+    /// Records the incoming request stream into a compact binary file, for replaying production traffic shape.
+
+    ///
+    /// Requests are captured sanitized:
+    /// - only the headers which change how a request is served are kept (content type, accept, encoding, cookies)
+    /// - cookie values are replaced by `x`s of the same length, so tokens never reach the file
+    /// - every string in a JSON body (emails, passwords, names) is replaced the same way; other bodies entirely
+    ///
+    /// Each request costs one `fwrite` of an already serialized record. Capture is off until \ref open is called.
+    struct TrafficCapture
+    {
+        struct context
+        {};
+
+        TrafficCapture() = default;
+        TrafficCapture(const TrafficCapture&) = delete;
+        TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+        ~TrafficCapture() { close(); }
+
+        /// Start capturing one in every \p sample_every requests into \p path (truncated).
+        bool open(const std::string& path, unsigned sample_every = 1)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (file_)
+                std::fclose(file_);
+            file_ = std::fopen(path.c_str(), "wb");
+            if (!file_)
+            {
+                CROW_LOG_ERROR << "Could not create traffic capture file: " << path;
+                return false;
+            }
+            std::setvbuf(file_, nullptr, _IOFBF, 1 << 16);
+
+            traffic_capture_header header{};
+            std::memcpy(header.magic, "CROWCAPT", 8);
+            header.version = 1;
+            header.started_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            std::fwrite(&header, sizeof(header), 1, file_);
+
+            started_ = std::chrono::steady_clock::now();
+            sample_every_ = sample_every ? sample_every : 1;
+            counter_ = 0;
+            enabled_.store(true, std::memory_order_release);
+            return true;
+        }
+
+        /// Stop capturing and flush the file.
+        void close()
+        {
+            enabled_.store(false, std::memory_order_release);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (file_)
+            {
+                std::fclose(file_);
+                file_ = nullptr;
+            }
+        }
+
+        bool is_open() const { return enabled_.load(std::memory_order_acquire); }
+
+        void before_handle(request& req, response& /*res*/, context& /*ctx*/)
+        {
+            if (!enabled_.load(std::memory_order_acquire))
+                return;
+            if (counter_.fetch_add(1, std::memory_order_relaxed) % sample_every_ != 0)
+                return;
+
+            std::string record = serialize(req);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (file_)
+                std::fwrite(record.data(), record.size(), 1, file_);
+        }
+
+        void after_handle(request& /*req*/, response& /*res*/, context& /*ctx*/)
+        {}
+
+        /// Whether a header is kept in captures (compared case-insensitively).
+        static bool is_captured_header(const std::string& name)
+        {
+            static const char* const kept[] = {"Content-Type", "Accept", "Accept-Encoding", "Cookie"};
+            for (const char* header : kept)
+            {
+                if (name.size() == std::strlen(header) && boost::iequals(name, header))
+                    return true;
+            }
+            return false;
+        }
+
+        /// Replace every cookie value by `x`s of the same length.
+        static std::string redact_cookies(const std::string& cookies)
+        {
+            std::string redacted = cookies;
+            bool in_value = false;
+            for (char& c : redacted)
+            {
+                if (c == '=' && !in_value)
+                    in_value = true;
+                else if (c == ';')
+                    in_value = false;
+                else if (in_value && c != ' ')
+                    c = 'x';
+            }
+            return redacted;
+        }
+
+        /// Replace every string of a JSON body by `x`s of the same length, or the whole body if it is not JSON.
+        static std::string redact_body(const std::string& body)
+        {
+            if (body.empty())
+                return body;
+            json::rvalue parsed = json::load(body);
+            if (!parsed)
+                return std::string(body.size(), 'x');
+            return redact_json(parsed).dump();
+        }
+
+    private:
+        static json::wvalue redact_json(const json::rvalue& value)
+        {
+            switch (value.t())
+            {
+                case json::type::String:
+                    return std::string(value.s().size(), 'x');
+                case json::type::List:
+                {
+                    json::wvalue::list items;
+                    for (const auto& item : value)
+                        items.emplace_back(redact_json(item));
+                    return json::wvalue(items);
+                }
+                case json::type::Object:
+                {
+                    json::wvalue object;
+                    for (const auto& item : value)
+                        object[std::string(item.key())] = redact_json(item);
+                    return object;
+                }
+                default:
+                    return json::wvalue(value);
+            }
+        }
+
+        std::string serialize(const request& req) const
+        {
+            const std::string& url = req.raw_url.size() > 0xffff ? req.url : req.raw_url;
+            std::string body = redact_body(req.body);
+
+            traffic_capture_record record{};
+            record.offset_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started_).count();
+            record.method = static_cast<std::uint8_t>(req.method);
+            record.url_size = static_cast<std::uint16_t>(std::min<size_t>(url.size(), 0xffff));
+            record.body_size = static_cast<std::uint32_t>(body.size());
+
+            std::string out(sizeof(record), '\0');
+            out.append(url, 0, record.url_size);
+            for (const auto& header : req.headers)
+            {
+                if (!is_captured_header(header.first) || header.first.size() > 0xffff || header.second.size() > 0xffff)
+                    continue;
+                std::string value = boost::iequals(header.first, "Cookie") ? redact_cookies(header.second) : header.second;
+                std::uint16_t sizes[2] = {static_cast<std::uint16_t>(header.first.size()), static_cast<std::uint16_t>(value.size())};
+                out.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+                out += header.first;
+                out += value;
+                record.header_count++;
+            }
+            out += body;
+
+            record.size = static_cast<std::uint32_t>(out.size());
+            std::memcpy(&out[0], &record, sizeof(record));
+            return out;
+        }
+
+        std::atomic<bool> enabled_{false};
+        std::atomic<std::uint64_t> counter_{0};
+        unsigned sample_every_{1};
+        std::chrono::steady_clock::time_point started_;
+        std::mutex mutex_;
+        std::FILE* file_{nullptr};
+    };
+} // namespace crow
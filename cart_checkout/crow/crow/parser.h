@@ -7,6 +7,7 @@
 
 #include "crow/http_request.h"
 #include "crow/http_parser_merged.h"
+#include "crow/trace.h"
 
 namespace crow
 {
@@ -89,6 +90,7 @@ namespace crow
             self->url = self->raw_url.substr(0, self->qs_point != 0 ? self->qs_point : std::string::npos);
             self->url_params = query_string(self->raw_url);
 
+            CROW_TRACE3(parse_complete, self, static_cast<int>(self->method), self->url.c_str());
             self->process_message();
             return 0;
         }
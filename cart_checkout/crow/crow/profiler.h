@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "crow/logging.h"
+
+// Older glibc headers only expose the raw union member
+#if defined(__linux__) && !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace crow
+{
+    namespace detail
+    {
+        /// One stack captured by the SIGPROF handler.
+        struct profile_sample
+        {
+            static constexpr unsigned max_frames = 48;
+
+            std::uint32_t thread;
+            std::uint32_t depth;
+            void* frames[max_frames];
+        };
+    } // namespace detail
+
+    /// In-process sampling CPU profiler producing folded stacks (the input of flamegraph.pl / speedscope).
+
+    ///
+    /// Threads opt in through \ref thread_registration (the server registers its acceptor and worker threads).
+    /// While a profile runs, each registered thread gets a POSIX timer on its own CPU clock that sends it SIGPROF
+    /// at the requested frequency. The handler only calls `backtrace()` into a preallocated buffer, so the
+    /// overhead is bounded by the frequency, and stacks are symbolized once the profile is over.
+    /// Function names of the executable itself are only available when it is linked with `-rdynamic`.
+    /// Only supported on Linux.
+    class sampling_profiler
+    {
+    public:
+        static constexpr unsigned max_threads = 256;
+        static constexpr unsigned max_seconds = 60;
+        static constexpr unsigned max_frequency = 1000;
+        static constexpr size_t max_samples = 65536;
+
+        /// Registers the calling thread for profiling for as long as it exists.
+        class thread_registration
+        {
+        public:
+            explicit thread_registration(const std::string& name):
+              slot_(sampling_profiler::instance().register_thread(name))
+            {}
+
+            thread_registration(const thread_registration&) = delete;
+            thread_registration& operator=(const thread_registration&) = delete;
+
+            ~thread_registration()
+            {
+                sampling_profiler::instance().unregister_thread(slot_);
+            }
+
+        private:
+            int slot_;
+        };
+
+        static sampling_profiler& instance()
+        {
+            static sampling_profiler profiler;
+            return profiler;
+        }
+
+        /// Sample every registered thread for \p seconds at \p frequency Hz and write the folded stacks to \p out.
+
+        ///
+        /// Blocks the calling thread for the duration of the profile, call it off the worker threads.
+        /// Returns false if another profile is already running or profiling is not supported.
+        bool profile(unsigned seconds, unsigned frequency, std::string& out)
+        {
+#ifdef __linux__
+            bool expected = false;
+            if (!running_.compare_exchange_strong(expected, true))
+                return false;
+
+            // static_cast avoids odr-using the constants (std::min takes references)
+            seconds = std::max(1u, std::min(seconds, static_cast<unsigned>(max_seconds)));
+            frequency = std::max(1u, std::min(frequency, static_cast<unsigned>(max_frequency)));
+            install_handler();
+
+            std::vector<timer_t> timers;
+            std::vector<std::string> names;
+            {
+                std::lock_guard<std::mutex> lock(threads_mutex_);
+                names.resize(max_threads);
+                size_t thread_count = 0;
+                for (unsigned i = 0; i < max_threads; i++)
+                {
+                    if (threads_[i].registered)
+                    {
+                        names[i] = threads_[i].name;
+                        thread_count++;
+                    }
+                }
+
+                samples_.resize(std::min(static_cast<size_t>(max_samples), static_cast<size_t>(seconds) * frequency * std::max<size_t>(thread_count, 1)));
+                next_sample_ = 0;
+                capacity_ = samples_.size();
+                buffer_.store(samples_.data());
+
+                long interval_ns = 1000000000L / frequency;
+                for (unsigned i = 0; i < max_threads; i++)
+                {
+                    if (!threads_[i].registered)
+                        continue;
+                    timer_t timer;
+                    if (start_timer(threads_[i], i, interval_ns, timer))
+                        timers.push_back(timer);
+                }
+            }
+
+            std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+            for (auto timer : timers)
+                timer_delete(timer);
+            // Wait for handlers already running to finish writing before reading the buffer
+            buffer_.store(nullptr);
+            while (in_handler_.load() != 0)
+                std::this_thread::yield();
+
+            size_t taken = std::min(next_sample_.load(), capacity_);
+            if (next_sample_.load() > capacity_)
+                CROW_LOG_WARNING << "Profiler buffer full, dropped " << (next_sample_.load() - capacity_) << " samples";
+            fold(taken, names, out);
+
+            samples_.clear();
+            samples_.shrink_to_fit();
+            running_.store(false);
+            return true;
+#else
+            (void)seconds;
+            (void)frequency;
+            (void)out;
+            return false;
+#endif
+        }
+
+        bool running() const { return running_.load(); }
+
+    private:
+        struct registered_thread
+        {
+            bool registered{false};
+#ifdef __linux__
+            pid_t tid{0};
+            pthread_t handle{};
+#endif
+            std::string name;
+        };
+
+        sampling_profiler() = default;
+
+        int register_thread(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(threads_mutex_);
+            for (unsigned i = 0; i < max_threads; i++)
+            {
+                if (!threads_[i].registered)
+                {
+                    threads_[i].registered = true;
+                    threads_[i].name = name;
+#ifdef __linux__
+                    threads_[i].tid = static_cast<pid_t>(syscall(SYS_gettid));
+                    threads_[i].handle = pthread_self();
+#endif
+                    return static_cast<int>(i);
+                }
+            }
+            return -1;
+        }
+
+        void unregister_thread(int slot)
+        {
+            if (slot < 0)
+                return;
+            std::lock_guard<std::mutex> lock(threads_mutex_);
+            threads_[slot].registered = false;
+        }
+
+#ifdef __linux__
+        void install_handler()
+        {
+            std::call_once(handler_installed_, [] {
+                // backtrace() loads libgcc on first use, which is not safe inside a signal handler
+                void* warmup[1];
+                backtrace(warmup, 1);
+
+                struct sigaction action;
+                std::memset(&action, 0, sizeof(action));
+                action.sa_sigaction = &sampling_profiler::on_sigprof;
+                action.sa_flags = SA_SIGINFO | SA_RESTART;
+                sigemptyset(&action.sa_mask);
+                sigaction(SIGPROF, &action, nullptr);
+            });
+        }
+
+        static bool start_timer(const registered_thread& thread, unsigned slot, long interval_ns, timer_t& timer)
+        {
+            clockid_t clock;
+            if (pthread_getcpuclockid(thread.handle, &clock) != 0)
+                return false;
+
+            struct sigevent event;
+            std::memset(&event, 0, sizeof(event));
+            event.sigev_notify = SIGEV_THREAD_ID;
+            event.sigev_signo = SIGPROF;
+            event.sigev_value.sival_int = static_cast<int>(slot);
+            event.sigev_notify_thread_id = thread.tid;
+            if (timer_create(clock, &event, &timer) != 0)
+            {
+                CROW_LOG_WARNING << "Could not create profiling timer for " << thread.name << ": " << std::strerror(errno);
+                return false;
+            }
+
+            struct itimerspec spec;
+            spec.it_interval.tv_sec = interval_ns / 1000000000L;
+            spec.it_interval.tv_nsec = interval_ns % 1000000000L;
+            spec.it_value = spec.it_interval;
+            timer_settime(timer, 0, &spec, nullptr);
+            return true;
+        }
+
+        static void on_sigprof(int, siginfo_t* info, void*)
+        {
+            int saved_errno = errno;
+            sampling_profiler& self = instance();
+            self.in_handler_.fetch_add(1);
+            detail::profile_sample* buffer = self.buffer_.load();
+            if (buffer)
+            {
+                size_t index = self.next_sample_.fetch_add(1);
+                if (index < self.capacity_)
+                {
+                    detail::profile_sample& sample = buffer[index];
+                    sample.thread = static_cast<std::uint32_t>(info->si_value.sival_int);
+                    int depth = backtrace(sample.frames, detail::profile_sample::max_frames);
+                    sample.depth = depth > 0 ? static_cast<std::uint32_t>(depth) : 0;
+                }
+            }
+            self.in_handler_.fetch_sub(1);
+            errno = saved_errno;
+        }
+
+        /// Name of the function containing \p address, falling back to `module+offset`.
+        static std::string symbolize(void* address)
+        {
+            Dl_info info;
+            if (!dladdr(address, &info) || !info.dli_fname)
+            {
+                char hex[32];
+                snprintf(hex, sizeof(hex), "%p", address);
+                return hex;
+            }
+            if (info.dli_sname)
+            {
+                int status = 0;
+                char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+                std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+                std::free(demangled);
+                std::replace(name.begin(), name.end(), ';', ':');
+                return name;
+            }
+            const char* module = std::strrchr(info.dli_fname, '/');
+            char offset[32];
+            snprintf(offset, sizeof(offset), "+0x%lx", static_cast<unsigned long>(static_cast<char*>(address) - static_cast<char*>(info.dli_fbase)));
+            return std::string(module ? module + 1 : info.dli_fname) + offset;
+        }
+
+        /// Aggregate identical stacks into `thread;outermost;...;innermost count` lines.
+        void fold(size_t taken, const std::vector<std::string>& names, std::string& out)
+        {
+            // The first two frames are on_sigprof and the kernel's signal trampoline
+            static const unsigned skipped_frames = 2;
+
+            std::map<std::pair<std::uint32_t, std::vector<void*>>, size_t> stacks;
+            for (size_t i = 0; i < taken; i++)
+            {
+                const detail::profile_sample& sample = samples_[i];
+                if (sample.depth <= skipped_frames)
+                    continue;
+                std::vector<void*> frames(sample.frames + skipped_frames, sample.frames + sample.depth);
+                stacks[std::make_pair(sample.thread, std::move(frames))]++;
+            }
+
+            // Different return addresses within the same functions fold into the same line
+            std::unordered_map<void*, std::string> symbols;
+            std::map<std::string, size_t> folded;
+            for (auto& stack : stacks)
+            {
+                std::string line = stack.first.first < names.size() && !names[stack.first.first].empty() ? names[stack.first.first] : "unknown";
+                const std::vector<void*>& frames = stack.first.second;
+                for (size_t i = frames.size(); i-- > 0;)
+                {
+                    // Return addresses point after the call, step back into it (except for the interrupted frame)
+                    void* address = i == 0 ? frames[i] : static_cast<void*>(static_cast<char*>(frames[i]) - 1);
+                    auto symbol = symbols.find(address);
+                    if (symbol == symbols.end())
+                        symbol = symbols.emplace(address, symbolize(address)).first;
+                    line += ';';
+                    line += symbol->second;
+                }
+                folded[line] += stack.second;
+            }
+
+            for (auto& line : folded)
+            {
+                out += line.first;
+                out += ' ';
+                out += std::to_string(line.second);
+                out += '\n';
+            }
+        }
+#endif
+
+    private:
+        std::mutex threads_mutex_;
+        registered_thread threads_[max_threads];
+
+        std::atomic<bool> running_{false};
+        std::once_flag handler_installed_;
+
+        std::vector<detail::profile_sample> samples_;
+        std::atomic<detail::profile_sample*> buffer_{nullptr};
+        std::atomic<size_t> next_sample_{0};
+        size_t capacity_{0};
+        std::atomic<int> in_handler_{0};
+    };
+} // namespace crow
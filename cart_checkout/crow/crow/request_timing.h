@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "crow/http_request.h"
+
+namespace crow
+{
+    /// The phases a request's time is split into.
+    enum class timing_phase : std::uint8_t
+    {
+        parse = 0,     ///< From the first byte read to the request being parsed.
+        middleware,    ///< before_handle and after_handle of global middlewares.
+        rate_limit,    ///< Rate limiting / abuse checks done by the handler.
+        database,      ///< Database calls made by the handler.
+        password_hash, ///< Password hashing and verification.
+        token,         ///< Token signing and verification.
+        serialization, ///< Building the response body and headers.
+        write,         ///< Writing the response to the socket (only reported in metrics).
+
+        count
+    };
+
+    constexpr unsigned timing_phase_count = static_cast<unsigned>(timing_phase::count);
+
+    inline const char* timing_phase_name(timing_phase phase)
+    {
+        static const char* names[] = {"parse", "middleware", "rate_limit", "database", "password_hash", "token", "serialization", "write"};
+        return names[static_cast<unsigned>(phase)];
+    }
+
+    /// Microseconds spent in each \ref timing_phase while handling one request.
+    struct request_timing
+    {
+        std::uint32_t phase_us[timing_phase_count]{};
+        bool sampled{false}; ///< Whether a `Server-Timing` header is added to the response.
+
+        void add(timing_phase phase, std::uint32_t us)
+        {
+            phase_us[static_cast<unsigned>(phase)] += us;
+        }
+
+        void clear()
+        {
+            for (auto& us : phase_us)
+                us = 0;
+            sampled = false;
+        }
+
+        /// Build a `Server-Timing` header value from the phases that took any time, followed by the total.
+        std::string server_timing_header(std::uint64_t total_us) const
+        {
+            std::string header;
+            char dur[32];
+            for (unsigned i = 0; i < timing_phase_count; i++)
+            {
+                if (!phase_us[i])
+                    continue;
+                snprintf(dur, sizeof(dur), ";dur=%.3f, ", phase_us[i] / 1000.0);
+                header += timing_phase_name(static_cast<timing_phase>(i));
+                header += dur;
+            }
+            snprintf(dur, sizeof(dur), "total;dur=%.3f", total_us / 1000.0);
+            header += dur;
+            return header;
+        }
+    };
+
+    /// Adds the time between its construction and destruction to a phase of the request.
+
+    ///
+    /// Does nothing (not even reading the clock) when request timing is disabled.
+    /// Usage: `{ crow::scoped_phase_timer timer(req, crow::timing_phase::database); collection.find_one(...); }`
+    class scoped_phase_timer
+    {
+    public:
+        scoped_phase_timer(const request& req, timing_phase phase):
+          timing_(req.timing), phase_(phase)
+        {
+            if (timing_)
+                start_ = std::chrono::steady_clock::now();
+        }
+
+        scoped_phase_timer(const scoped_phase_timer&) = delete;
+        scoped_phase_timer& operator=(const scoped_phase_timer&) = delete;
+
+        ~scoped_phase_timer()
+        {
+            if (timing_)
+                timing_->add(phase_, static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count()));
+        }
+
+    private:
+        request_timing* timing_;
+        timing_phase phase_;
+        std::chrono::steady_clock::time_point start_;
+    };
+} // namespace crow
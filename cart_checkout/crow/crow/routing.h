@@ -14,8 +14,10 @@
 #include "crow/utility.h"
 #include "crow/logging.h"
 #include "crow/websocket.h"
+#include "crow/event_stream.h"
 #include "crow/mustache.h"
 #include "crow/middleware.h"
+#include "crow/trace.h"
 
 namespace crow
 {
@@ -46,6 +48,13 @@ namespace crow
         }
 
         virtual void handle(request&, response&, const routing_params&) = 0;
+
+        /// Whether requests asking for `text/event-stream` take the socket over through handle_upgrade.
+        virtual bool is_event_stream() const
+        {
+            return false;
+        }
+
         virtual void handle_upgrade(const request&, response& res, SocketAdaptor&&)
         {
             res = response(404);
@@ -79,6 +88,9 @@ namespace crow
 
         const std::string& rule() { return rule_; }
 
+        /// Position of this rule in the router's route table, assigned during validation (0 until then).
+        uint16_t route_id() const { return route_id_; }
+
     protected:
         uint32_t methods_{1 << static_cast<int>(HTTPMethod::Get)};
 
@@ -87,6 +99,8 @@ namespace crow
 
         std::unique_ptr<BaseRule> rule_to_upgrade_;
 
+        uint16_t route_id_{0};
+
         friend class Router;
         friend class Blueprint;
         template<typename T>
@@ -440,6 +454,79 @@ namespace crow
         std::function<bool(const crow::request&)> accept_handler_;
     };
 
+    /// A rule serving a server-sent event stream.
+
+    ///
+    /// Requests accepting `text/event-stream` are handed the socket, like websockets; others get a 400.
+    class EventStreamRule : public BaseRule
+    {
+        using self_t = EventStreamRule;
+
+    public:
+        EventStreamRule(std::string rule):
+          BaseRule(std::move(rule))
+        {}
+
+        void validate() override
+        {}
+
+        bool is_event_stream() const override
+        {
+            return true;
+        }
+
+        void handle(request&, response& res, const routing_params&) override
+        {
+            res = response(400, "This route serves text/event-stream");
+            res.end();
+        }
+
+        void handle_upgrade(const request& req, response&, SocketAdaptor&& adaptor) override
+        {
+            new crow::event_stream::Connection<SocketAdaptor>(req, std::move(adaptor), heartbeat_, open_handler_, close_handler_, accept_handler_);
+        }
+#ifdef CROW_ENABLE_SSL
+        void handle_upgrade(const request& req, response&, SSLAdaptor&& adaptor) override
+        {
+            new crow::event_stream::Connection<SSLAdaptor>(req, std::move(adaptor), heartbeat_, open_handler_, close_handler_, accept_handler_);
+        }
+#endif
+
+        template<typename Func>
+        self_t& onopen(Func f)
+        {
+            open_handler_ = f;
+            return *this;
+        }
+
+        template<typename Func>
+        self_t& onclose(Func f)
+        {
+            close_handler_ = f;
+            return *this;
+        }
+
+        template<typename Func>
+        self_t& onaccept(Func f)
+        {
+            accept_handler_ = f;
+            return *this;
+        }
+
+        /// Send a comment after this long without events (0 disables heartbeats).
+        self_t& heartbeat(std::chrono::milliseconds interval)
+        {
+            heartbeat_ = interval;
+            return *this;
+        }
+
+    protected:
+        std::chrono::milliseconds heartbeat_{std::chrono::seconds(15)};
+        std::function<void(crow::event_stream::connection&)> open_handler_;
+        std::function<void(crow::event_stream::connection&)> close_handler_;
+        std::function<bool(const crow::request&)> accept_handler_;
+    };
+
     /// Allows the user to assign parameters using functions.
 
     ///
@@ -455,6 +542,13 @@ namespace crow
             return *p;
         }
 
+        EventStreamRule& event_stream()
+        {
+            auto p = new EventStreamRule(static_cast<self_t*>(this)->rule_);
+            static_cast<self_t*>(this)->rule_to_upgrade_.reset(p);
+            return *p;
+        }
+
         self_t& name(std::string name) noexcept
         {
             static_cast<self_t*>(this)->name_ = std::move(name);
@@ -1199,6 +1293,12 @@ namespace crow
                 rule_without_trailing_slash.pop_back();
             }
 
+            if (!ruleObject->route_id_)
+            {
+                ruleObject->route_id_ = static_cast<uint16_t>(route_names_.size());
+                route_names_.emplace_back(rule);
+            }
+
             ruleObject->foreach_method([&](int method) {
                 per_methods_[method].rules.emplace_back(ruleObject);
                 per_methods_[method].trie.add(rule, per_methods_[method].rules.size() - 1, BP_index != INVALID_BP_ID ? blueprints[BP_index]->prefix().length() : 0, BP_index);
@@ -1296,6 +1396,17 @@ namespace crow
             }
         }
 
+        /// Whether req is for an event stream route (and should be passed to handle_upgrade).
+        bool is_event_stream(const request& req)
+        {
+            if (req.method >= HTTPMethod::InternalMethodCount)
+                return false;
+
+            auto& per_method = per_methods_[static_cast<int>(req.method)];
+            unsigned rule_index = std::get<0>(per_method.trie.find(req.url));
+            return rule_index && rule_index != RULE_SPECIAL_REDIRECT_SLASH && rule_index < per_method.rules.size() && per_method.rules[rule_index]->is_event_stream();
+        }
+
         // TODO maybe add actual_method
         template<typename Adaptor>
         void handle_upgrade(const request& req, response& res, Adaptor&& adaptor)
@@ -1548,8 +1659,11 @@ namespace crow
             }
 
             CROW_LOG_DEBUG << "Matched rule '" << rules[rule_index]->rule_ << "' " << static_cast<uint32_t>(req.method) << " / " << rules[rule_index]->get_methods();
+            req.route_id = rules[rule_index]->route_id_;
+            CROW_TRACE4(route_matched, static_cast<int>(req.method), req.url.c_str(), req.route_id, rules[rule_index]->rule_.c_str());
 
             // any uncaught exceptions become 500s
+            CROW_TRACE1(handler_start, req.route_id);
             try
             {
                 rules[rule_index]->handle(req, res, std::get<2>(found));
@@ -1559,15 +1673,15 @@ namespace crow
                 CROW_LOG_ERROR << "An uncaught exception occurred: " << e.what();
                 res = response(500);
                 res.end();
-                return;
             }
             catch (...)
             {
                 CROW_LOG_ERROR << "An uncaught exception occurred. The type was unknown so no information was available.";
                 res = response(500);
                 res.end();
-                return;
             }
+            // Handlers that complete the response asynchronously fire this before the response is ready
+            CROW_TRACE2(handler_end, req.route_id, res.code);
         }
 
         void debug_print()
@@ -1584,6 +1698,12 @@ namespace crow
             return blueprints_;
         }
 
+        /// The rule of every validated route, indexed by route id. Index 0 stands for requests that matched no route.
+        const std::vector<std::string>& route_names() const
+        {
+            return route_names_;
+        }
+
     private:
         CatchallRule catchall_rule_;
 
@@ -1599,5 +1719,6 @@ namespace crow
         std::array<PerMethod, static_cast<int>(HTTPMethod::InternalMethodCount)> per_methods_;
         std::vector<std::unique_ptr<BaseRule>> all_rules_;
         std::vector<Blueprint*> blueprints_;
+        std::vector<std::string> route_names_{"<unmatched>"};
     };
 } // namespace crow
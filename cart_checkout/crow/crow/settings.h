@@ -11,6 +11,9 @@
 /* #ifdef - enables ssl */
 //#define CROW_ENABLE_SSL
 
+/* #ifdef - compiles in USDT (sys/sdt.h) tracepoints, see crow/trace.h */
+//#define CROW_ENABLE_USDT
+
 /* #ifdef - enforces section 5.2 and 6.1 of RFC6455 (only accepting masked messages from clients) */
 //#define CROW_ENFORCE_WS_SPEC
 
@@ -28,6 +31,17 @@
 #define CROW_LOG_LEVEL 1
 #endif
 
+/* #define - specifies the lowest log level compiled in */
+/*
+    Log statements below this level are removed at compile time,
+    regardless of the level set at runtime.
+
+    default to DEBUG (everything is compiled in)
+*/
+#ifndef CROW_LOG_COMPILE_LEVEL
+#define CROW_LOG_COMPILE_LEVEL 0
+#endif
+
 #ifndef CROW_STATIC_DIRECTORY
 #define CROW_STATIC_DIRECTORY "static/"
 #endif
@@ -1,9 +1,10 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <chrono>
+#include <cstdint>
 #include <functional>
-#include <map>
 #include <vector>
 
 #include "crow/logging.h"
@@ -13,7 +14,12 @@ namespace crow
     namespace detail
     {
 
-        /// A class for scheduling functions to be called after a specific amount of ticks. A tick is equal to 1 second.
+        /// A class for scheduling functions to be called after a specific amount of time.
+
+        ///
+        /// Tasks are kept in a hierarchical timing wheel (4 levels of 64 slots) so that scheduling and
+        /// cancelling are O(1) regardless of how many connections are waiting on a deadline.
+        /// The wheel advances once per tick (100ms by default), timeouts are still given in seconds.
         class task_timer
         {
         public:
@@ -24,96 +30,218 @@ namespace crow
             using clock_type = std::chrono::steady_clock;
             using time_type = clock_type::time_point;
 
+            static constexpr unsigned wheel_bits = 6;
+            static constexpr unsigned wheel_levels = 4;
+            static constexpr std::uint32_t wheel_size = 1u << wheel_bits;
+            static constexpr std::uint32_t wheel_mask = wheel_size - 1;
+            static constexpr std::uint64_t max_ticks = (std::uint64_t(1) << (wheel_bits * wheel_levels)) - 1;
+            static constexpr std::uint32_t npos = 0xffffffffu;
+
+            struct node
+            {
+                task_type task;
+                std::uint64_t expires{0};
+                std::uint32_t prev{npos};
+                std::uint32_t next{npos};
+                std::uint32_t slot{npos};
+                std::uint32_t generation{0};
+            };
+
         public:
-            task_timer(boost::asio::io_service& io_service):
-              io_service_(io_service), deadline_timer_(io_service_)
+            task_timer(boost::asio::io_service& io_service, std::chrono::milliseconds tick = std::chrono::milliseconds(100)):
+              io_service_(io_service), deadline_timer_(io_service_), tick_(tick.count() > 0 ? tick : std::chrono::milliseconds(1))
             {
-                deadline_timer_.expires_from_now(boost::posix_time::seconds(1));
+                for (auto& head : slots_)
+                    head = npos;
+
+                next_tick_time_ = clock_type::now() + tick_;
+                deadline_timer_.expires_at(next_tick_time_);
                 deadline_timer_.async_wait(
                   std::bind(&task_timer::tick_handler, this, std::placeholders::_1));
             }
 
             ~task_timer() { deadline_timer_.cancel(); }
 
+            /// Cancel a scheduled task. Unknown, expired or already cancelled identifiers are ignored.
             void cancel(identifier_type id)
             {
-                tasks_.erase(id);
+                std::uint32_t index = static_cast<std::uint32_t>(id & 0xffffffffu);
+                std::uint32_t generation = static_cast<std::uint32_t>(static_cast<std::uint64_t>(id) >> 32);
+                if (index == 0 || index > nodes_.size())
+                    return;
+
+                node& n = nodes_[index - 1];
+                if (n.generation != generation || n.slot == npos)
+                    return;
+
+                unlink(index - 1);
+                release(index - 1);
                 CROW_LOG_DEBUG << "task_timer cancelled: " << this << ' ' << id;
             }
 
-            /// Schedule the given task to be executed after the default amount of ticks.
+            /// Schedule the given task to be executed after the default amount of seconds.
 
             ///
             /// \return identifier_type Used to cancel the thread.
-            /// It is not bound to this task_timer instance and in some cases could lead to
-            /// undefined behavior if used with other task_timer objects or after the task
-            /// has been successfully executed.
+            /// It is not bound to this task_timer instance and should not be used with other task_timer objects.
+            /// Cancelling an identifier whose task has already run is a no-op.
             identifier_type schedule(const task_type& task)
             {
-                tasks_.insert(
-                  {++highest_id_,
-                   {clock_type::now() + std::chrono::seconds(get_default_timeout()),
-                    task}});
-                CROW_LOG_DEBUG << "task_timer scheduled: " << this << ' ' << highest_id_;
-                return highest_id_;
+                return schedule(task, std::chrono::seconds(get_default_timeout()));
             }
 
             /// Schedule the given task to be executed after the given time.
 
             ///
-            /// \param timeout The amount of ticks (seconds) to wait before execution.
+            /// \param timeout The amount of seconds to wait before execution.
             ///
             /// \return identifier_type Used to cancel the thread.
-            /// It is not bound to this task_timer instance and in some cases could lead to
-            /// undefined behavior if used with other task_timer objects or after the task
-            /// has been successfully executed.
+            /// It is not bound to this task_timer instance and should not be used with other task_timer objects.
+            /// Cancelling an identifier whose task has already run is a no-op.
             identifier_type schedule(const task_type& task, std::uint8_t timeout)
             {
-                tasks_.insert({++highest_id_,
-                               {clock_type::now() + std::chrono::seconds(timeout), task}});
-                CROW_LOG_DEBUG << "task_timer scheduled: " << this << ' ' << highest_id_;
-                return highest_id_;
+                return schedule(task, std::chrono::seconds(timeout));
+            }
+
+            /// Schedule the given task to be executed after the given duration, rounded up to the tick resolution.
+
+            ///
+            /// \return identifier_type Used to cancel the thread.
+            template<typename Rep, typename Period>
+            identifier_type schedule(const task_type& task, std::chrono::duration<Rep, Period> timeout)
+            {
+                auto timeout_ms = std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count();
+                // The current tick is already partially elapsed, one extra tick ensures the task never runs early.
+                std::uint64_t ticks = timeout_ms > 0 ? static_cast<std::uint64_t>((timeout_ms + tick_.count() - 1) / tick_.count()) + 1 : 1;
+                if (ticks > max_ticks) ticks = max_ticks;
+
+                std::uint32_t index = acquire();
+                node& n = nodes_[index];
+                n.task = task;
+                n.expires = current_tick_ + ticks;
+                link(index);
+
+                identifier_type id = (static_cast<identifier_type>(n.generation) << 32) | (index + 1);
+                CROW_LOG_DEBUG << "task_timer scheduled: " << this << ' ' << id;
+                return id;
             }
 
             /// Set the default timeout for this task_timer instance. (Default: 5)
 
             ///
-            /// \param timeout The amount of ticks (seconds) to wait before execution.
+            /// \param timeout The amount of seconds to wait before execution.
             void set_default_timeout(std::uint8_t timeout) { default_timeout_ = timeout; }
 
             /// Get the default timeout. (Default: 5)
             std::uint8_t get_default_timeout() const { return default_timeout_; }
 
+            /// Get the wheel resolution.
+            std::chrono::milliseconds get_tick() const { return tick_; }
+
+            /// Get the number of tasks currently waiting to be executed.
+            size_t size() const { return nodes_.size() - free_.size(); }
+
         private:
-            void process_tasks()
+            std::uint32_t acquire()
             {
-                time_type current_time = clock_type::now();
-                std::vector<identifier_type> finished_tasks;
+                if (!free_.empty())
+                {
+                    std::uint32_t index = free_.back();
+                    free_.pop_back();
+                    return index;
+                }
+                nodes_.emplace_back();
+                return static_cast<std::uint32_t>(nodes_.size() - 1);
+            }
 
-                for (const auto& task : tasks_)
+            void release(std::uint32_t index)
+            {
+                node& n = nodes_[index];
+                n.task = nullptr;
+                n.generation++; // Invalidates any identifier still held for this node
+                free_.push_back(index);
+            }
+
+            /// Put the node in the slot matching its expiry, relative to the current tick.
+            void link(std::uint32_t index)
+            {
+                node& n = nodes_[index];
+                std::uint64_t delta = n.expires > current_tick_ ? n.expires - current_tick_ : 0;
+
+                unsigned level = 0;
+                while (level + 1 < wheel_levels && delta >= (std::uint64_t(1) << (wheel_bits * (level + 1))))
+                    level++;
+
+                std::uint32_t slot = level * wheel_size + static_cast<std::uint32_t>((n.expires >> (wheel_bits * level)) & wheel_mask);
+                n.slot = slot;
+                n.prev = npos;
+                n.next = slots_[slot];
+                if (n.next != npos)
+                    nodes_[n.next].prev = index;
+                slots_[slot] = index;
+            }
+
+            void unlink(std::uint32_t index)
+            {
+                node& n = nodes_[index];
+                if (n.prev != npos)
+                    nodes_[n.prev].next = n.next;
+                else
+                    slots_[n.slot] = n.next;
+                if (n.next != npos)
+                    nodes_[n.next].prev = n.prev;
+                n.prev = n.next = n.slot = npos;
+            }
+
+            /// Move every task of a higher level slot down to the level matching its remaining time.
+            void cascade(unsigned level)
+            {
+                std::uint32_t slot = level * wheel_size + static_cast<std::uint32_t>((current_tick_ >> (wheel_bits * level)) & wheel_mask);
+                while (slots_[slot] != npos)
                 {
-                    if (task.second.first < current_time)
-                    {
-                        (task.second.second)();
-                        finished_tasks.push_back(task.first);
-                        CROW_LOG_DEBUG << "task_timer called: " << this << ' ' << task.first;
-                    }
+                    std::uint32_t index = slots_[slot];
+                    unlink(index);
+                    link(index);
                 }
+            }
+
+            void advance()
+            {
+                current_tick_++;
 
-                for (const auto& task : finished_tasks)
-                    tasks_.erase(task);
+                for (unsigned level = 1; level < wheel_levels; level++)
+                {
+                    if ((current_tick_ & ((std::uint64_t(1) << (wheel_bits * level)) - 1)) != 0)
+                        break;
+                    cascade(level);
+                }
 
-                // If no task is currently scheduled, reset the issued ids back to 0.
-                if (tasks_.empty()) highest_id_ = 0;
+                // Tasks are unlinked before being called, so they may freely schedule or cancel other tasks.
+                std::uint32_t slot = static_cast<std::uint32_t>(current_tick_ & wheel_mask);
+                while (slots_[slot] != npos)
+                {
+                    std::uint32_t index = slots_[slot];
+                    unlink(index);
+                    task_type task = std::move(nodes_[index].task);
+                    CROW_LOG_DEBUG << "task_timer called: " << this << ' ' << ((static_cast<identifier_type>(nodes_[index].generation) << 32) | (index + 1));
+                    release(index);
+                    task();
+                }
             }
 
             void tick_handler(const boost::system::error_code& ec)
             {
                 if (ec) return;
 
-                process_tasks();
+                // Catch up on any ticks missed while the io_service was busy.
+                time_type current_time = clock_type::now();
+                while (next_tick_time_ <= current_time)
+                {
+                    advance();
+                    next_tick_time_ += tick_;
+                }
 
-                deadline_timer_.expires_from_now(boost::posix_time::seconds(1));
+                deadline_timer_.expires_at(next_tick_time_);
                 deadline_timer_.async_wait(
                   std::bind(&task_timer::tick_handler, this, std::placeholders::_1));
             }
@@ -121,12 +249,14 @@ namespace crow
         private:
             std::uint8_t default_timeout_{5};
             boost::asio::io_service& io_service_;
-            boost::asio::deadline_timer deadline_timer_;
-            std::map<identifier_type, std::pair<time_type, task_type>> tasks_;
+            boost::asio::steady_timer deadline_timer_;
+            std::chrono::milliseconds tick_;
+            time_type next_tick_time_;
 
-            // A continuosly increasing number to be issued to threads to identify them.
-            // If no tasks are scheduled, it will be reset to 0.
-            identifier_type highest_id_{0};
+            std::uint64_t current_tick_{0};
+            std::uint32_t slots_[wheel_levels * wheel_size];
+            std::vector<node> nodes_;
+            std::vector<std::uint32_t> free_;
         };
     } // namespace detail
 } // namespace crow
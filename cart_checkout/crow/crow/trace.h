@@ -0,0 +1,49 @@
+#pragma once
+
+#include "crow/settings.h"
+
+/// USDT (user-level statically defined tracing) probes.
+
+///
+/// With `CROW_ENABLE_USDT` defined, every probe compiles to a single `nop` plus a note in the
+/// `.note.stapsdt` ELF section, so they cost nothing until a tracer attaches to them:
+///
+///     bpftrace -l 'usdt:./cart_checkout:crow:*'
+///     bpftrace -e 'usdt:./cart_checkout:crow:route_matched { @[str(arg3)] = count(); }' -p <pid>
+///
+/// Without it (or without `sys/sdt.h`) the probes expand to nothing and their arguments are not evaluated,
+/// so only pass arguments which are free to compute.
+///
+/// Probes fired by crow (provider `crow`):
+///  - `accept(connection, worker)`
+///  - `parse_complete(parser, method, url)`
+///  - `route_matched(method, url, route_id, rule)`
+///  - `handler_start(route_id)` / `handler_end(route_id, status)`
+///  - `write_complete(connection, route_id, error)`
+
+#if defined(CROW_ENABLE_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CROW_USDT_AVAILABLE
+#endif
+#endif
+
+#ifdef CROW_USDT_AVAILABLE
+#define CROW_USDT_PROBE0(provider, name) DTRACE_PROBE(provider, name)
+#define CROW_USDT_PROBE1(provider, name, a1) DTRACE_PROBE1(provider, name, a1)
+#define CROW_USDT_PROBE2(provider, name, a1, a2) DTRACE_PROBE2(provider, name, a1, a2)
+#define CROW_USDT_PROBE3(provider, name, a1, a2, a3) DTRACE_PROBE3(provider, name, a1, a2, a3)
+#define CROW_USDT_PROBE4(provider, name, a1, a2, a3, a4) DTRACE_PROBE4(provider, name, a1, a2, a3, a4)
+#else
+#define CROW_USDT_PROBE0(provider, name)
+#define CROW_USDT_PROBE1(provider, name, a1)
+#define CROW_USDT_PROBE2(provider, name, a1, a2)
+#define CROW_USDT_PROBE3(provider, name, a1, a2, a3)
+#define CROW_USDT_PROBE4(provider, name, a1, a2, a3, a4)
+#endif
+
+#define CROW_TRACE0(name) CROW_USDT_PROBE0(crow, name)
+#define CROW_TRACE1(name, a1) CROW_USDT_PROBE1(crow, name, a1)
+#define CROW_TRACE2(name, a1, a2) CROW_USDT_PROBE2(crow, name, a1, a2)
+#define CROW_TRACE3(name, a1, a2, a3) CROW_USDT_PROBE3(crow, name, a1, a2, a3)
+#define CROW_TRACE4(name, a1, a2, a3, a4) CROW_USDT_PROBE4(crow, name, a1, a2, a3, a4)
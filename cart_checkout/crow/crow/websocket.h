@@ -1,6 +1,8 @@
 #pragma once
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/array.hpp>
+#include <memory>
+#include "crow/logging.h"
 #include "crow/socket_adaptors.h"
 #include "crow/http_request.h"
 #include "crow/TinySHA1.hpp"
@@ -18,11 +20,47 @@ namespace crow
             Payload,
         };
 
+        /// Generate the websocket header for a final frame with the given opcode and payload size (in bytes).
+        inline std::string frame_header(int opcode, size_t size)
+        {
+            char buf[2 + 8] = "\x80\x00";
+            buf[0] += opcode;
+            if (size < 126)
+            {
+                buf[1] += static_cast<char>(size);
+                return {buf, buf + 2};
+            }
+            else if (size < 0x10000)
+            {
+                buf[1] += 126;
+                *(uint16_t*)(buf + 2) = htons(static_cast<uint16_t>(size));
+                return {buf, buf + 4};
+            }
+            else
+            {
+                buf[1] += 127;
+                *reinterpret_cast<uint64_t*>(buf + 2) = ((1 == htonl(1)) ? static_cast<uint64_t>(size) : (static_cast<uint64_t>(htonl((size)&0xFFFFFFFF)) << 32) | htonl(static_cast<uint64_t>(size) >> 32));
+                return {buf, buf + 10};
+            }
+        }
+
+        /// Encode a complete server frame (header and unmasked payload), ready for connection::send_frame.
+
+        ///
+        /// Encoding a broadcast once and sharing the result avoids building a header and copying the payload per connection.
+        inline std::shared_ptr<const std::string> encode_frame(int opcode, const std::string& payload)
+        {
+            auto frame = std::make_shared<std::string>(frame_header(opcode, payload.size()));
+            frame->append(payload);
+            return frame;
+        }
+
         /// A base class for websocket connection.
         struct connection
         {
             virtual void send_binary(const std::string& msg) = 0;
             virtual void send_text(const std::string& msg) = 0;
+            virtual void send_frame(std::shared_ptr<const std::string> frame, size_t max_pending_frames) = 0;
             virtual void send_ping(const std::string& msg) = 0;
             virtual void send_pong(const std::string& msg) = 0;
             virtual void close(const std::string& msg = "quit") = 0;
@@ -169,6 +207,34 @@ namespace crow
                 });
             }
 
+            /// Send a frame made by encode_frame, without copying it.
+
+            ///
+            /// Safe to call from any thread, as long as the connection's close handler has not returned yet; the frame is queued on the connection's io_service.<br>
+            /// If max_pending_frames shared frames are already waiting behind the write in progress, the peer is not keeping up:
+            /// the connection is dropped (through the error and close handlers) instead of letting its queue grow without bound.
+            void send_frame(std::shared_ptr<const std::string> frame, size_t max_pending_frames) override
+            {
+                std::weak_ptr<char> alive = alive_;
+                post([this, alive, frame, max_pending_frames] {
+                    if (alive.expired() || close_connection_)
+                        return;
+                    if (pending_frames_ >= max_pending_frames)
+                    {
+                        CROW_LOG_WARNING << "Dropping slow websocket consumer with " << pending_frames_ << " frames pending";
+                        close_connection_ = true;
+                        adaptor_.close();
+                        if (error_handler_)
+                            error_handler_(*this);
+                        check_destroy();
+                        return;
+                    }
+                    pending_frames_++;
+                    write_buffers_.emplace_back(frame);
+                    do_write();
+                });
+            }
+
             /// Send a close signal.
 
             ///
@@ -199,25 +265,7 @@ namespace crow
             /// Generate the websocket headers using an opcode and the message size (in bytes).
             std::string build_header(int opcode, size_t size)
             {
-                char buf[2 + 8] = "\x80\x00";
-                buf[0] += opcode;
-                if (size < 126)
-                {
-                    buf[1] += static_cast<char>(size);
-                    return {buf, buf + 2};
-                }
-                else if (size < 0x10000)
-                {
-                    buf[1] += 126;
-                    *(uint16_t*)(buf + 2) = htons(static_cast<uint16_t>(size));
-                    return {buf, buf + 4};
-                }
-                else
-                {
-                    buf[1] += 127;
-                    *reinterpret_cast<uint64_t*>(buf + 2) = ((1 == htonl(1)) ? static_cast<uint64_t>(size) : (static_cast<uint64_t>(htonl((size)&0xFFFFFFFF)) << 32) | htonl(static_cast<uint64_t>(size) >> 32));
-                    return {buf, buf + 10};
-                }
+                return frame_header(opcode, size);
             }
 
             /// Send the HTTP upgrade response.
@@ -418,6 +466,7 @@ namespace crow
                                       if (error_handler_)
                                           error_handler_(*this);
                                       adaptor_.close();
+                                      check_destroy();
                                   }
                               });
                         }
@@ -456,6 +505,7 @@ namespace crow
                                   if (error_handler_)
                                       error_handler_(*this);
                                   adaptor_.close();
+                                  check_destroy();
                               }
                           });
                     }
@@ -570,11 +620,12 @@ namespace crow
                 if (sending_buffers_.empty())
                 {
                     sending_buffers_.swap(write_buffers_);
+                    pending_frames_ = 0;
                     std::vector<boost::asio::const_buffer> buffers;
                     buffers.reserve(sending_buffers_.size());
                     for (auto& s : sending_buffers_)
                     {
-                        buffers.emplace_back(boost::asio::buffer(s));
+                        buffers.emplace_back(s.buffer());
                     }
                     boost::asio::async_write(
                       adaptor_.socket(), buffers,
@@ -601,17 +652,42 @@ namespace crow
             {
                 //if (has_sent_close_ && has_recv_close_)
                 if (!is_close_handler_called_)
+                {
+                    is_close_handler_called_ = true;
                     if (close_handler_)
                         close_handler_(*this, "uncleanly");
+                }
                 if (sending_buffers_.empty() && !is_reading)
                     delete this;
             }
 
         private:
+            /// A buffer queued for writing: owned by the connection, or a frame shared with other connections.
+            struct write_buffer
+            {
+                write_buffer(std::string data):
+                  owned(std::move(data))
+                {}
+                write_buffer(std::shared_ptr<const std::string> frame):
+                  shared(std::move(frame))
+                {}
+
+                boost::asio::const_buffer buffer() const
+                {
+                    return shared ? boost::asio::buffer(*shared) : boost::asio::buffer(owned);
+                }
+
+                std::string owned;
+                std::shared_ptr<const std::string> shared;
+            };
+
             Adaptor adaptor_;
 
-            std::vector<std::string> sending_buffers_;
-            std::vector<std::string> write_buffers_;
+            std::vector<write_buffer> sending_buffers_;
+            std::vector<write_buffer> write_buffers_;
+            size_t pending_frames_{0};
+            // Expires when the connection is deleted, so frames posted from other threads can tell
+            std::shared_ptr<char> alive_{std::make_shared<char>()};
 
             boost::array<char, 4096> buffer_;
             bool is_binary_;
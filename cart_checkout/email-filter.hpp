@@ -0,0 +1,310 @@
+#ifndef EMAIL_FILTER_HPP
+#define EMAIL_FILTER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <crow/async_logging.h>
+
+#include "storage.hpp"
+
+/**
+ * @brief A Bloom filter over strings, on words it does not own: might_contain never misses an added string, and
+ * answers true for a string that was not added with a false positive rate depending on how full it is.
+ *
+ * Adding and testing are lock-free and may run concurrently.
+ */
+class bloom_filter
+{
+public:
+  bloom_filter(std::atomic<uint64_t> *words, size_t word_count, int probes)
+    : words_(words), word_count_(word_count), probes_(probes)
+  {
+  }
+
+  void add(const std::string &key)
+  {
+    uint64_t hash = std::hash<std::string>()(key), step = mix(hash) | 1;
+    for (int i = 0; i < probes_; i++, hash += step)
+    {
+      size_t bit = hash % (word_count_ * 64);
+      words_[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+    }
+  }
+
+  bool might_contain(const std::string &key) const
+  {
+    uint64_t hash = std::hash<std::string>()(key), step = mix(hash) | 1;
+    for (int i = 0; i < probes_; i++, hash += step)
+    {
+      size_t bit = hash % (word_count_ * 64);
+      if (!(words_[bit / 64].load(std::memory_order_relaxed) >> (bit % 64) & 1))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void clear()
+  {
+    for (size_t i = 0; i < word_count_; i++)
+    {
+      words_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  size_t bits() const
+  {
+    return word_count_ * 64;
+  }
+
+private:
+  // A second hash for double hashing (probe i is hash + i * step), from the splitmix64 finalizer
+  static uint64_t mix(uint64_t x)
+  {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  std::atomic<uint64_t> *words_;
+  size_t word_count_;
+  int probes_;
+};
+
+/**
+ * @brief What known_email_filter keeps, in memory shared by the server's processes (see shared_state): zeroed, it is
+ * a filter not built yet.
+ *
+ * There are two Bloom filters, so one can be rebuilt while the other answers.
+ */
+struct email_filter_state
+{
+  enum : size_t
+  {
+    words = 1 << 18,     // 16M bits per filter
+    probes = 7,
+    capacity = 1750000   // emails the filter holds at a 1% false positive rate
+  };
+
+  std::atomic<uint32_t> active;   // 1 + the filter answering, 0 until the first build
+  std::atomic<uint32_t> building; // 1 + the filter being rebuilt, 0 when none is
+  std::atomic<int64_t> synced_at_ms; // when the last sync started reading the store, on the system clock
+  std::atomic<int64_t> synced_ms;    // the same on the steady clock, for might_exist
+  std::atomic<int64_t> max_staleness_ms;
+  std::atomic<uint64_t> rejected;
+  std::atomic<uint64_t> stale; // rejections not trusted because the last sync was too old
+  std::atomic<uint64_t> bits[2][words];
+};
+
+/**
+ * @brief The registered emails as a Bloom filter, so lookups of emails that are certainly not registered (e.g. a
+ * credential stuffing burst on /login) are answered without a database round trip.
+ *
+ * Built from the store when started, kept up to date by add() on every registration made here and by refreshes
+ * reading the emails registered since the last sync (by other servers too), and rebuilt from the store
+ * periodically, since a Bloom filter cannot forget an email and gets less selective as it fills past its size.
+ *
+ * An email registered elsewhere is missing until the next refresh, so rejections are only trusted while the last
+ * sync is recent: once it is older than three refresh intervals (say refreshes fail), every email might exist
+ * again and is looked up in the database. Until the filter is built, every email might exist.
+ *
+ * The filter itself is an email_filter_state, which the server's processes share: one of them starts the filter,
+ * the others only look emails up and add the ones they register.
+ */
+class known_email_filter
+{
+public:
+  known_email_filter(storage &store, email_filter_state &state)
+    : store_(store), state_(state)
+  {
+  }
+
+  known_email_filter(const known_email_filter &) = delete;
+  known_email_filter &operator=(const known_email_filter &) = delete;
+
+  ~known_email_filter()
+  {
+    stop();
+  }
+
+  /**
+   * @brief Builds the filter (throws if the store cannot be read), then on its own thread refreshes it every
+   * refresh_interval and rebuilds it every rebuild_interval. Call in one of the processes sharing the state only.
+   */
+  void start(std::chrono::seconds rebuild_interval, std::chrono::seconds refresh_interval)
+  {
+    state_.max_staleness_ms.store(3 * std::chrono::duration_cast<std::chrono::milliseconds>(refresh_interval).count(), std::memory_order_relaxed);
+    rebuild();
+    stopping_ = false;
+    thread_ = std::thread([this, rebuild_interval, refresh_interval]
+    {
+      auto rebuilt = std::chrono::steady_clock::now();
+      std::unique_lock<std::mutex> lock(stop_mutex_);
+      while (!stop_condition_.wait_for(lock, refresh_interval, [this] { return stopping_; }))
+      {
+        lock.unlock();
+        bool rebuilding = std::chrono::steady_clock::now() - rebuilt >= rebuild_interval;
+        try
+        {
+          if (rebuilding)
+          {
+            rebuild();
+            rebuilt = std::chrono::steady_clock::now();
+          }
+          else
+          {
+            refresh();
+          }
+        }
+        catch (const std::exception &e)
+        {
+          CROW_SLOG_ERROR("email_filter").kv("reason", rebuilding ? "rebuild failed" : "refresh failed").kv("error", e.what());
+        }
+        lock.lock();
+      }
+    });
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(stop_mutex_);
+      stopping_ = true;
+    }
+    stop_condition_.notify_all();
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+  }
+
+  /**
+   * @brief false only if email is certainly not registered (as of the last sync, which is recent).
+   */
+  bool might_exist(const std::string &email)
+  {
+    uint32_t active = state_.active.load();
+    if (!active || filter(active).might_contain(email))
+    {
+      return true;
+    }
+    if (now_ms() - state_.synced_ms.load(std::memory_order_relaxed) > state_.max_staleness_ms.load(std::memory_order_relaxed))
+    {
+      state_.stale.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    state_.rejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  /**
+   * @brief Records a registered email. Call once it is stored, so a concurrent rebuild either reads it or sees it here.
+   */
+  void add(const std::string &email)
+  {
+    // building before active: a rebuild finishing in between has already made its filter the active one
+    uint32_t building = state_.building.load();
+    uint32_t active = state_.active.load();
+    if (building && building != active)
+    {
+      filter(building).add(email);
+    }
+    if (active)
+    {
+      filter(active).add(email);
+    }
+  }
+
+  /**
+   * @brief Builds the filter not in use from the emails in the store, then answers from it.
+   */
+  void rebuild()
+  {
+    auto started = std::chrono::system_clock::now();
+    int64_t started_ms = now_ms();
+    uint32_t target = state_.active.load() == 1 ? 2 : 1;
+    bloom_filter rebuilt = filter(target);
+    rebuilt.clear();
+    state_.building.store(target);
+
+    std::vector<std::string> emails;
+    try
+    {
+      emails = store_.list_user_emails();
+    }
+    catch (...)
+    {
+      state_.building.store(0);
+      throw;
+    }
+    for (const auto &email : emails)
+    {
+      rebuilt.add(email);
+    }
+
+    state_.active.store(target);
+    state_.building.store(0);
+    mark_synced(started, started_ms);
+    if (emails.size() > email_filter_state::capacity)
+    {
+      CROW_SLOG_WARNING("email_filter").kv("reason", "over capacity").kv("emails", emails.size())
+        .kv("capacity", static_cast<uint64_t>(email_filter_state::capacity));
+    }
+    CROW_SLOG_INFO("email_filter").kv("emails", emails.size()).kv("bits", rebuilt.bits())
+      .kv("rejected", state_.rejected.load(std::memory_order_relaxed)).kv("stale", state_.stale.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * @brief Adds the emails registered since the last sync, reading a minute further back for the clock skew between
+   * the servers inserting users and for inserts in flight during that sync.
+   */
+  void refresh()
+  {
+    auto started = std::chrono::system_clock::now();
+    int64_t started_ms = now_ms();
+    std::chrono::system_clock::time_point since(std::chrono::milliseconds(state_.synced_at_ms.load(std::memory_order_relaxed)));
+
+    std::vector<std::string> emails = store_.list_user_emails(since - std::chrono::minutes(1));
+    for (const auto &email : emails)
+    {
+      add(email);
+    }
+    mark_synced(started, started_ms);
+  }
+
+private:
+  static int64_t now_ms()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  bloom_filter filter(uint32_t which)
+  {
+    return bloom_filter(state_.bits[which - 1], email_filter_state::words, email_filter_state::probes);
+  }
+
+  void mark_synced(std::chrono::system_clock::time_point started, int64_t started_ms)
+  {
+    state_.synced_at_ms.store(std::chrono::duration_cast<std::chrono::milliseconds>(started.time_since_epoch()).count(), std::memory_order_relaxed);
+    state_.synced_ms.store(started_ms, std::memory_order_relaxed);
+  }
+
+  storage &store_;
+  email_filter_state &state_;
+
+  std::thread thread_;
+  std::mutex stop_mutex_;
+  std::condition_variable stop_condition_;
+  bool stopping_ = false;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef EXPIRY_SCHEDULER_HPP
+#define EXPIRY_SCHEDULER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+#include <crow/task_timer.h>
+
+/**
+ * @brief Runs callbacks when keyed deadlines expire, on a dedicated thread.
+ *
+ * Deadlines live in crow's hierarchical timing wheel (the one connections use for their timeouts), so
+ * scheduling and cancelling are O(1) however many are pending. Calls from other threads are posted to the
+ * scheduler thread; callbacks run on it and must be short.
+ */
+class expiry_scheduler
+{
+public:
+  explicit expiry_scheduler(std::chrono::milliseconds tick = std::chrono::milliseconds(100))
+    : work_(new boost::asio::io_service::work(io_service_)), timer_(io_service_, tick)
+  {
+  }
+
+  expiry_scheduler(const expiry_scheduler &) = delete;
+  expiry_scheduler &operator=(const expiry_scheduler &) = delete;
+
+  ~expiry_scheduler()
+  {
+    stop();
+  }
+
+  void start()
+  {
+    thread_ = std::thread([this] { io_service_.run(); });
+  }
+
+  /**
+   * @brief Stops the scheduler thread; pending deadlines never fire.
+   */
+  void stop()
+  {
+    if (!thread_.joinable())
+    {
+      return;
+    }
+    work_.reset();
+    io_service_.stop();
+    thread_.join();
+  }
+
+  /**
+   * @brief Calls expired after timeout unless key is cancelled first. Scheduling a pending key replaces it.
+   */
+  void schedule(uint64_t key, std::chrono::milliseconds timeout, std::function<void()> expired)
+  {
+    io_service_.post([this, key, timeout, expired]
+    {
+      cancel_now(key);
+      pending_[key] = timer_.schedule([this, key, expired]
+      {
+        pending_.erase(key);
+        expired();
+      }, timeout);
+    });
+  }
+
+  void cancel(uint64_t key)
+  {
+    io_service_.post([this, key] { cancel_now(key); });
+  }
+
+private:
+  void cancel_now(uint64_t key)
+  {
+    auto found = pending_.find(key);
+    if (found != pending_.end())
+    {
+      timer_.cancel(found->second);
+      pending_.erase(found);
+    }
+  }
+
+  boost::asio::io_service io_service_;
+  std::unique_ptr<boost::asio::io_service::work> work_;
+  crow::detail::task_timer timer_;
+  std::thread thread_;
+
+  // Only touched on the scheduler thread
+  std::unordered_map<uint64_t, crow::detail::task_timer::identifier_type> pending_;
+};
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef HEAVY_HITTERS_HPP
+#define HEAVY_HITTERS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The most frequent keys (e.g. client IPs) over a sliding window, in fixed memory whatever the number of
+ * distinct keys.
+ *
+ * Counts live in count-min sketches: depth rows of width counters, a key incrementing one counter per row and
+ * its count estimated as the smallest of them, which never undercounts and overcounts by about
+ * total / width. There is one sketch per window; the estimate for the last window is the current sketch plus the
+ * previous one weighted by how much of it the window still covers.
+ *
+ * The top keys are kept next to the sketches. Keys are only compared against them once their estimate reaches the
+ * smallest top count, so most additions take no lock.
+ */
+class heavy_hitters
+{
+public:
+  struct entry
+  {
+    std::string key;
+    uint32_t count;
+  };
+
+  /**
+   * @brief The counts, in fixed size memory that may be shared by processes (see share): zeroed, no key was counted.
+   */
+  struct sketch
+  {
+    enum : size_t
+    {
+      width = 4096,
+      depth = 4
+    };
+
+    std::atomic<int64_t> window_start_ms;
+    std::atomic<uint32_t> current;
+    // Two sketches of depth rows of width counters: current and the previous window's
+    std::atomic<uint32_t> counters[2 * depth * width];
+  };
+
+  explicit heavy_hitters(size_t top = 32, std::chrono::seconds window = std::chrono::seconds(60))
+    : top_(top), window_(window), own_sketch_(new sketch()), sketch_(own_sketch_.get())
+  {
+  }
+
+  heavy_hitters(const heavy_hitters &) = delete;
+  heavy_hitters &operator=(const heavy_hitters &) = delete;
+
+  /**
+   * @brief Counts in shared instead of memory of its own, e.g. so that the processes of a server add up their
+   * requests. Call before counting anything. The top keys stay this object's own: each process lists the keys it
+   * has seen, with their counts from every process.
+   */
+  void share(sketch &shared)
+  {
+    sketch_ = &shared;
+    own_sketch_.reset();
+  }
+
+  /**
+   * @brief Counts one occurrence of key. Safe to call from any thread.
+   *
+   * @return uint32_t the estimated occurrences of key in the last window, this one included.
+   */
+  uint32_t add(const std::string &key)
+  {
+    double elapsed = advance();
+    uint64_t hash = std::hash<std::string>()(key), step = spread(hash) | 1;
+    size_t current = sketch_->current.load(std::memory_order_relaxed);
+    uint32_t count = UINT32_MAX, previous_count = UINT32_MAX;
+    for (size_t row = 0; row < sketch::depth; row++, hash += step)
+    {
+      size_t column = hash % sketch::width;
+      count = std::min(count, counter(current, row, column).fetch_add(1, std::memory_order_relaxed) + 1);
+      previous_count = std::min(previous_count, counter(1 - current, row, column).load(std::memory_order_relaxed));
+    }
+    count += static_cast<uint32_t>(previous_count * (1 - elapsed));
+
+    if (count >= admit_.load(std::memory_order_relaxed))
+    {
+      offer(key, count);
+    }
+    return count;
+  }
+
+  /**
+   * @brief The estimated occurrences of key in the last window.
+   */
+  uint32_t estimate(const std::string &key) const
+  {
+    double elapsed = std::min(1.0, (now_ms() - sketch_->window_start_ms.load(std::memory_order_relaxed)) / static_cast<double>(window_ms()));
+    uint64_t hash = std::hash<std::string>()(key), step = spread(hash) | 1;
+    size_t current = sketch_->current.load(std::memory_order_relaxed);
+    uint32_t count = UINT32_MAX, previous_count = UINT32_MAX;
+    for (size_t row = 0; row < sketch::depth; row++, hash += step)
+    {
+      size_t column = hash % sketch::width;
+      count = std::min(count, counter(current, row, column).load(std::memory_order_relaxed));
+      previous_count = std::min(previous_count, counter(1 - current, row, column).load(std::memory_order_relaxed));
+    }
+    return count + static_cast<uint32_t>(previous_count * (1 - elapsed));
+  }
+
+  /**
+   * @brief The top keys by their current estimate, most frequent first.
+   */
+  std::vector<entry> top()
+  {
+    catch_up(sketch_->window_start_ms.load(std::memory_order_relaxed));
+    std::vector<entry> entries;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries = entries_;
+    }
+    for (auto &top_entry : entries)
+    {
+      top_entry.count = estimate(top_entry.key);
+    }
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const entry &top_entry) { return top_entry.count == 0; }), entries.end());
+    std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) { return a.count > b.count; });
+    return entries;
+  }
+
+  std::chrono::seconds window() const
+  {
+    return window_;
+  }
+
+private:
+  // Derives the step between the rows' columns from the key's hash
+  static uint64_t spread(uint64_t x)
+  {
+    x = (x ^ (x >> 33)) * 0xff51afd7ed558ccdULL;
+    x = (x ^ (x >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+  }
+
+  static int64_t now_ms()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  int64_t window_ms() const
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(window_).count();
+  }
+
+  std::atomic<uint32_t> &counter(size_t window, size_t row, size_t column) const
+  {
+    return sketch_->counters[(window * sketch::depth + row) * sketch::width + column];
+  }
+
+  /**
+   * @brief Starts a new window if the current one is over; the caller that wins the race clears the oldest sketch
+   * (additions racing with that may be lost, the counts are estimates anyway).
+   *
+   * @return double how much of the current window has elapsed, from 0 to 1.
+   */
+  double advance()
+  {
+    int64_t now = now_ms();
+    int64_t start = sketch_->window_start_ms.load(std::memory_order_relaxed);
+    if (now - start >= window_ms())
+    {
+      // Two windows without a request leave nothing worth keeping in either sketch
+      int64_t next = now - start >= 2 * window_ms() ? now : start + window_ms();
+      if (sketch_->window_start_ms.compare_exchange_strong(start, next, std::memory_order_relaxed))
+      {
+        const size_t counters = sketch::depth * sketch::width;
+        size_t stale = 1 - sketch_->current.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < counters; i++)
+        {
+          sketch_->counters[stale * counters + i].store(0, std::memory_order_relaxed);
+        }
+        if (next == now)
+        {
+          for (size_t i = 0; i < counters; i++)
+          {
+            sketch_->counters[(1 - stale) * counters + i].store(0, std::memory_order_relaxed);
+          }
+        }
+        sketch_->current.store(static_cast<uint32_t>(stale), std::memory_order_relaxed);
+      }
+      start = sketch_->window_start_ms.load(std::memory_order_relaxed);
+    }
+    catch_up(start);
+    return std::min(1.0, std::max(0.0, (now - start) / static_cast<double>(window_ms())));
+  }
+
+  /**
+   * @brief Re-estimates the top keys once per new window, so keys that went quiet lose their place and the admission
+   * threshold drops. Checked against the window this object last saw rather than done by whoever started the window,
+   * as that may be another process sharing the sketch.
+   */
+  void catch_up(int64_t window_start)
+  {
+    int64_t seen = seen_window_start_.load(std::memory_order_relaxed);
+    if (seen == window_start || !seen_window_start_.compare_exchange_strong(seen, window_start, std::memory_order_relaxed))
+    {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &top_entry : entries_)
+    {
+      top_entry.count = estimate(top_entry.key);
+    }
+    update_admission();
+  }
+
+  void offer(const std::string &key, uint32_t count)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = std::find_if(entries_.begin(), entries_.end(), [&key](const entry &top_entry) { return top_entry.key == key; });
+    if (found != entries_.end())
+    {
+      found->count = count;
+    }
+    else if (entries_.size() < top_)
+    {
+      entries_.push_back(entry{key, count});
+    }
+    else
+    {
+      auto smallest = std::min_element(entries_.begin(), entries_.end(), [](const entry &a, const entry &b) { return a.count < b.count; });
+      if (count <= smallest->count)
+      {
+        return;
+      }
+      *smallest = entry{key, count};
+    }
+    update_admission();
+  }
+
+  /**
+   * @brief Call with mutex_ held.
+   */
+  void update_admission()
+  {
+    uint32_t minimum = 0;
+    if (entries_.size() >= top_ && !entries_.empty())
+    {
+      minimum = std::min_element(entries_.begin(), entries_.end(), [](const entry &a, const entry &b) { return a.count < b.count; })->count;
+    }
+    admit_.store(minimum, std::memory_order_relaxed);
+  }
+
+  const size_t top_;
+  const std::chrono::seconds window_;
+  std::unique_ptr<sketch> own_sketch_;
+  sketch *sketch_;
+  std::atomic<int64_t> seen_window_start_{0}; // the window the top keys were last estimated for
+
+  std::mutex mutex_;
+  std::vector<entry> entries_;
+  std::atomic<uint32_t> admit_{0}; // the smallest top count once there are top_ keys, else 0
+};
+
+#endif
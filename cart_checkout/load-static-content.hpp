@@ -10,12 +10,31 @@
 #include <unordered_map>
 #include <algorithm>
 #include <vector>
+#include <cstdlib>
 
 #include <crow.h>
 
 using namespace std;
 using namespace crow;
 
+/**
+ * @brief Directory the built frontend is served from (STATIC_CONTENT_ROOT, defaults to the container's dist folder)
+ */
+const std::string &static_content_root()
+{
+  static const std::string root = []
+  {
+    const char *env = std::getenv("STATIC_CONTENT_ROOT");
+    std::string path = env ? env : "/usr/src/cart_checkout/dist/";
+    if (path.empty() || path.back() != '/')
+    {
+      path += '/';
+    }
+    return path;
+  }();
+  return root;
+}
+
 /**
  * @brief serves static files through the crow response handler
  * 
@@ -26,8 +45,8 @@ using namespace crow;
 void sendFile(response &res, std::string fileName, std::string contentType)
 {
   auto ss = std::ostringstream{};
-  std::ifstream file("/usr/src/cart_checkout/dist/" + fileName);
-  std::cout << "Sending file: /usr/src/cart_checkout/dist/" << fileName << "\n\n\n";
+  std::ifstream file(static_content_root() + fileName);
+  CROW_LOG_DEBUG << "Sending file: " << static_content_root() << fileName;
   if (file)
   {
     ss << file.rdbuf();
@@ -10,11 +10,19 @@
 
 #include "load-static-content.hpp"
 #include "authentication.hpp"
+#include "mongo-storage.hpp"
+#include "prefork.hpp"
+#include "routes.hpp"
+#include "shared-state.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <vector>
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -24,495 +32,252 @@
 
 #include <crow.h>
 #include <crow/middlewares/cookie_parser.h>
+#ifdef CART_CHECKOUT_INSTRUMENTATION
+#include <crow/allocation_hooks.h>
+#endif
 
 #include <bcrypt/BCrypt.hpp>
 #include <jwt-cpp/jwt.h>
 
 using namespace std;
 using namespace crow;
-using bsoncxx::builder::basic::kvp;
-using bsoncxx::builder::basic::make_array;
-using bsoncxx::builder::basic::make_document;
-using bsoncxx::builder::stream::close_array;
-using bsoncxx::builder::stream::close_document;
-using bsoncxx::builder::stream::document;
-using bsoncxx::builder::stream::finalize;
-using bsoncxx::builder::stream::open_array;
-using bsoncxx::builder::stream::open_document;
-using mongocxx::cursor;
 
 int main(int argc, const char *argv[])
 {
 
-  // Main Crow App (utilizing cookie parser)
-  crow::App<crow::CookieParser> app;
-
-
-  // MongoDB Database instance / connection initialization
-  char* mongo_db_uri = std::getenv("MONGO_DB_INSTANCE_URI");
-  bool database_available = true;
-  if(!mongo_db_uri)
+  // Rate limits, request counters, the email filter, abuse counts and metrics shared by every process of the host,
+  // mapped before any is forked
+  shared_state *shared = shared_state::create();
+  if (!shared)
   {
-    std::cout << "ERROR: MongoDB Instance URI is not found!" << std::endl;
-    database_available = false;
+    std::fprintf(stderr, "Could not map the shared state: %s\n", std::strerror(errno));
+    return 1;
   }
-  std::string mongo_db_uri_string(mongo_db_uri);
-  mongocxx::instance inst{};
-  const auto uri = mongocxx::uri{mongo_db_uri_string};
-  mongocxx::client client{uri};
-
-  
-  // CartDatabase database with Carts collection
-  mongocxx::database carts_db = client["CartDatabase"];
-  mongocxx::collection cart_collection = carts_db["Carts"];
-
-
-  // Users database with User collection
-  mongocxx::database users_db = client["Users"];
-  mongocxx::collection user_collection = users_db["User"];
-
-
-  // Rate limiter based on IP address and timestamp
-  std::unordered_map<std::string, std::pair<int, std::chrono::time_point<std::chrono::steady_clock>>> rate_limit_map;
-  
-
-  CROW_ROUTE(app, "/")([](const crow::request &req, crow::response &res)
-  {
-    sendHTML(res, "index.html"); // Loads initial HTML page
-  });
-
-  CROW_ROUTE(app, "/index.html")([](const crow::request &req, crow::response &res)
-  {
-    sendHTML(res, "index.html"); // Loads initial HTML page
-  });
 
-  CROW_ROUTE(app, "/login").methods("GET"_method)([](const crow::request &req, crow::response &res)
+  // PREFORK_PROCESSES (default 1, at most 64) processes serve the port, each with its own threads and connections
+  char* prefork_processes = std::getenv("PREFORK_PROCESSES");
+  unsigned long processes = prefork_processes ? std::strtoul(prefork_processes, nullptr, 10) : 1;
+  if (processes > shared_state::max_workers)
   {
-    sendHTML(res, "index.html");
-  });
+    processes = shared_state::max_workers;
+  }
 
-  CROW_ROUTE(app, "/register").methods("GET"_method)([](const crow::request &req, crow::response &res)
+  // CHECKOUT_ENABLED=0 turns off checkouts, holds, returns, bookings and the live feed: their state is kept by one
+  // allocation thread in one process, so several processes would each hand out the same carts
+  char* checkout_enabled_env = std::getenv("CHECKOUT_ENABLED");
+  bool checkout_enabled = !checkout_enabled_env || std::string(checkout_enabled_env) != "0";
+  if (processes > 1 && checkout_enabled)
   {
-    sendHTML(res, "index.html");
-  });
+    std::fprintf(stderr, "PREFORK_PROCESSES=%lu needs CHECKOUT_ENABLED=0: the cart allocation state cannot be split between processes\n", processes);
+    return 1;
+  }
 
-  CROW_ROUTE(app, "/checkout").methods("GET"_method)([](const crow::request &req, crow::response &res)
+  unsigned worker = 0;
+  if (processes > 1)
   {
-    sendHTML(res, "index.html");
-  });
+    worker = prefork(static_cast<unsigned>(processes));
+  }
 
-  CROW_ROUTE(app, "/manifest.json")([](const crow::request &req, crow::response &res)
-  {
-    sendJSON(res, "manifest.json"); // Loads manifest file
-  });
+  // Route all logging through the asynchronous writer thread
+  static crow::AsyncLogHandler log_handler;
+  crow::logger::setHandler(&log_handler);
 
-  CROW_ROUTE(app, "/favicon.ico")([](const crow::request &req, crow::response &res)
+  // Main Crow App (utilizing cookie parser)
+  cart_checkout_app app;
+  app.enable_metrics();
+  app.get_metrics()->share(shared->metrics_memory(), shared->metrics_memory_size());
+  if (processes > 1)
   {
-    sendImage(res, "favicon.ico"); // Loads favicon
-  });
+    app.reuse_port();
+  }
 
-  CROW_ROUTE(app, "/asset-manifest.json")([](const crow::request &req, crow::response &res)
+  // Per-route allocation and perf counters (allocations are only counted in -DCART_CHECKOUT_INSTRUMENTATION=ON builds)
+  char* instrument_handlers = std::getenv("INSTRUMENT_HANDLERS");
+  if (instrument_handlers && std::string(instrument_handlers) == "1")
   {
-    sendJSON(res, "asset-manifest.json"); // Loads asset manifest
-  });
+    app.instrument_handlers();
+  }
 
-  CROW_ROUTE(app, "/static/css/<string>")([](const crow::request &req, crow::response &res, string fileName)
+  // Sample one in every SERVER_TIMING_SAMPLE_RATE responses for a Server-Timing phase breakdown
+  char* server_timing_rate = std::getenv("SERVER_TIMING_SAMPLE_RATE");
+  if (server_timing_rate)
   {
-    sendStyle(res, fileName); // Deals with any CSS
-  });
+    app.server_timing(static_cast<unsigned>(std::strtoul(server_timing_rate, nullptr, 10)));
+  }
 
-  CROW_ROUTE(app, "/static/js/<string>")([](const crow::request &req, crow::response &res, string fileName)
-  {
-    sendScript(res, fileName); // Loads javascript dependencies
-  });
 
-  CROW_ROUTE(app, "/static/media/<string>")([](const crow::request &req, crow::response &res, string fileName)
+  // Storage backend: MongoDB (default) or, with STORAGE_BACKEND=memory, an embedded in-memory store
+  char* storage_backend = std::getenv("STORAGE_BACKEND");
+  std::unique_ptr<mongocxx::instance> mongo_instance;
+  std::unique_ptr<storage> backend;
+  if (storage_backend && std::string(storage_backend) == "memory")
   {
-    sendImage(res, fileName); // Deals with any images we might use
-  });
+    CROW_LOG_INFO << "Using the in-memory store, nothing will be persisted";
+    std::unique_ptr<in_memory_storage> memory(new in_memory_storage());
 
-  CROW_ROUTE(app, "/assets/<string>")([](const crow::request &req, crow::response &res, std::string fileName)
-  { 
-    if(fileName.find(".js") != string::npos)
-    {
-      sendScript(res, fileName);
-    }
-    else if (fileName.find(".css") != string::npos)
-    {
-      sendStyle(res, fileName);
-    }
-    else if (fileName.find(".png") != string::npos)
+    // Optionally seed MEMORY_STORAGE_CARTS carts so the checkout page has something to show
+    char* seed_carts = std::getenv("MEMORY_STORAGE_CARTS");
+    unsigned long cart_count = seed_carts ? std::strtoul(seed_carts, nullptr, 10) : 0;
+    for (unsigned long i = 0; i < cart_count; i++)
     {
-      sendImage(res, fileName);
+      cart_record cart;
+      cart.name = "Cart " + std::to_string(i + 1);
+      cart.type = static_cast<int>(i % 3);
+      cart.available = true;
+      memory->insert_cart(cart);
     }
-    else if (fileName.find(".svg") != string::npos)
+    backend = std::move(memory);
+  }
+  else
+  {
+    // MongoDB Database instance / connection initialization
+    char* mongo_db_uri = std::getenv("MONGO_DB_INSTANCE_URI");
+    bool database_available = true;
+    if(!mongo_db_uri)
     {
-      sendSVG(res, fileName);
+      CROW_LOG_ERROR << "MongoDB Instance URI is not found!";
+      database_available = false;
     }
-    else 
+    mongo_instance.reset(new mongocxx::instance{});
+    // Users live in Users.User and carts in CartDatabase.Carts; without a URI every database route answers 500
+    const auto uri = database_available ? mongocxx::uri{std::string(mongo_db_uri)} : mongocxx::uri{};
+    // Collection calls taking SLOW_QUERY_MS (default 100) or longer are logged as slow_query events
+    char* slow_query_ms = std::getenv("SLOW_QUERY_MS");
+    std::chrono::milliseconds slow_query_threshold(slow_query_ms ? std::strtoll(slow_query_ms, nullptr, 10) : 100);
+    std::unique_ptr<mongo_storage> mongo(new mongo_storage(uri, database_available, slow_query_threshold));
+    if (database_available && !mongo->ensure_indexes())
     {
-      std::cout << "Unable to serve file: " << fileName << std::endl;
+      CROW_LOG_ERROR << "Some database indexes could not be built, the queries relying on them will scan their collections";
     }
-  });
+    backend = std::move(mongo);
+  }
 
-  CROW_ROUTE(app, "/<string>")([](const crow::request &req, crow::response &res, string path)
+  // Simulated database round trips (STORAGE_LATENCY_US plus up to STORAGE_LATENCY_JITTER_US), for load tests
+  char* storage_latency = std::getenv("STORAGE_LATENCY_US");
+  char* storage_jitter = std::getenv("STORAGE_LATENCY_JITTER_US");
+  std::unique_ptr<storage> delayed_backend;
+  if (storage_latency || storage_jitter)
   {
-    std::cout << "Unmatched route: " << path << std::endl;
-    res.code = 404;
-    res.write("<html><body><h1>404 Not Found</h1></body></html>");
-    res.end();
-  });
-
-  CROW_ROUTE(app, "/verify-token").methods("POST"_method)([&app, &user_collection](const crow::request &req)
+    delayed_backend.reset(new latency_injecting_storage(*backend,
+      std::chrono::microseconds(storage_latency ? std::strtoll(storage_latency, nullptr, 10) : 0),
+      std::chrono::microseconds(storage_jitter ? std::strtoll(storage_jitter, nullptr, 10) : 0)));
+  }
+  storage &store = delayed_backend ? *delayed_backend : *backend;
+
+  route_context context(store);
+  shared->attach(worker);
+  context.shared = shared;
+  context.worker = worker;
+  app.get_middleware<host_stats>().attach(shared, worker);
+  app.get_middleware<abuse_guard>().share(shared->abuse());
+
+  // Sampling CPU profiler returning folded stacks for flame graphs, disabled unless PROFILER_ENABLED=1
+  char* profiler_env = std::getenv("PROFILER_ENABLED");
+  context.profiler_enabled = profiler_env && std::string(profiler_env) == "1";
+
+  // Reservations are kept in memory from today on (days before are never queried) and written through to the store
+  reservation_engine reservations(store);
+  if (checkout_enabled && store.available())
   {
-
-    // Check for secret key on the server environment
-    char* secret_key = std::getenv("SECRET_KEY");
-    if (!secret_key) 
-    {
-      std::cerr << "The SECRET_KEY environment variable is not set" << std::endl;
-      return crow::response(500);
-    }
-
-    // Get token from cookies and verify it using the secret key
-    auto& ctx = app.get_context<crow::CookieParser>(req);
-    std::string token = ctx.get_cookie("jwtToken");
-    std::cout << "Attempting to verify: " << token << std::endl;
-    const std::string secret_key_string(secret_key);
-    bool isValidToken = verifyToken(token , secret_key_string, "cartapp");
-    if(!isValidToken)
-    {
-      std::cout << "Unable to verify token: " << token << std::endl;
-      return crow::response(401);
-    }
-
-    // Get the associated email address
-    std::string email = extractEmailFromToken(token, secret_key_string, "cartapp");
-    if(email.length() <= 0) 
-    {
-      std::cout << "No email address found" << std::endl;
-      return crow::response(401);
-    }
-
-    // Get the associated uid
-    std::string uid = extractUidFromToken(token, secret_key_string, "cartapp");
-    if(uid.length() <= 0)
-    {
-      std::cout << "No uid found" << std::endl;
-      return crow::response(401);
-    }
-
-    // Find document which contains the provided email address and uid
-    std::string name = "";
-    auto filter_doc = document{} << "email" << email << "_id" << bsoncxx::oid(uid) << bsoncxx::builder::stream::finalize;
-    auto find_one_filtered_result = user_collection.find_one(filter_doc.view());
-    if (find_one_filtered_result) 
+    try
     {
-      auto view = find_one_filtered_result->view();
-
-      auto name_element = view["name"];
-      if (name_element && name_element.type() == bsoncxx::type::k_utf8) 
-      {
-        name = name_element.get_utf8().value.to_string();
-        std::cout << "Name from database: " << name << std::endl;
-      }
-      else 
-      {
-        std::cout << "Name field is missing or not a string" << std::endl;
-      }
+      reservations.load(reservation_engine::today());
+      context.reservations = &reservations;
     }
-    else 
+    catch (const std::exception &e)
     {
-      std::cout << "No document matching the filter found" << std::endl;
+      CROW_LOG_ERROR << "Could not load reservations, booking is disabled: " << e.what();
     }
+  }
 
-    crow::json::wvalue resJSON;
-    resJSON["email"] = email;
-    resJSON["uid"] = uid;
-    resJSON["name"] = name;
-    resJSON["verificationSuccess"] = true;
-
-    return crow::response(200, resJSON);
-  });
-
-  CROW_ROUTE(app, "/login").methods("POST"_method)([&database_available, &rate_limit_map, &user_collection](const crow::request &req)
+  // Registered emails, so unknown ones never reach the database: rebuilt every EMAIL_FILTER_REBUILD_SECONDS (default an
+  // hour) and given the emails registered by every server every EMAIL_FILTER_REFRESH_SECONDS (default 5), by the
+  // first process for all of them
+  known_email_filter known_emails(store, shared->email_filter());
+  if (store.available() && worker > 0)
   {
-
-    // Ensure MongoDB connection is established
-    if(!database_available)
-    {
-      std::cout << "Database unavailable when trying to login" << std::endl;
-      return crow::response(503);
-    }
-
-    // Ensure request body is valid
-    crow::json::rvalue body = crow::json::load(req.body);
-    if(!body)
-    {
-      std::cout << "Request body is invalid" << std::endl;
-      return crow::response(400);
-    }
-
-    // Ensures request IP Address is not blacklisted
-    std::string ip_address = req.remote_ip_address;
-    if (is_rate_limited(rate_limit_map, ip_address)) 
-    {
-      std::cout << "Too many requests" << std::endl;
-      return crow::response(429);
-    }
-
-    // Check for secret key on the server environment
-    char* secret_key = std::getenv("SECRET_KEY");
-    char* secret_key_pepper = std::getenv("SECRET_KEY_PEPPER");
-    if (!secret_key || !secret_key_pepper) 
-    {
-      std::cerr << "The SECRET_KEY environment variable is not set" << std::endl;
-      return crow::response(500);
-    }
-
-    crow::json::wvalue resJSON;
-    std::string returned_token = "";
-
-    // Ensure both email and password request params have been provided
-    if(body.has("email") && body.has("password"))
-    {
-      std::string email = body["email"].s();
-      trim(email);
-      std::string password = body["password"].s();
-      bsoncxx::stdx::optional<bsoncxx::document::value> maybe_result =
-        user_collection.find_one(bsoncxx::builder::stream::document{} << "email" << email << bsoncxx::builder::stream::finalize);
-  
-      // Ensure that a user with the provided email exists in the MongoDB database
-      if(maybe_result)
-      {
-        bsoncxx::document::view result_view = maybe_result->view();
-        bsoncxx::document::element password_element = result_view["password"];
-        bsoncxx::document::element uid_element = result_view["_id"];
-
-        std::string password_hash = password_element.get_utf8().value.to_string();
-        std::string uid = uid_element.get_oid().value.to_string();
-        std::string pepper(secret_key_pepper);
-
-        // Ensure provided password matches the email
-        if(BCrypt::validatePassword((password + pepper), password_hash))
-        {
-          std::cout << "User logged in" << std::endl;
-
-          // Create JWT token so user can remain logged in for certain amount of time
-          std::string secret_key_string(secret_key);
-          auto token = jwt::create()
-            .set_issuer("cartapp")
-            .set_type("JWS")
-            .set_payload_claim("email", jwt::claim(email))
-            .set_payload_claim("uid", jwt::claim(uid))
-            .set_issued_at(std::chrono::system_clock::now())
-            .set_expires_at(std::chrono::system_clock::now() + std::chrono::seconds{60*60*24*7})
-            .sign(jwt::algorithm::hs256{secret_key_string});
-
-          returned_token = token;
-          resJSON["resString"] = "Logged in";
-          resJSON["loginSuccess"] = true;
-        }
-        else
-        {
-          std::cout << "Incorrect password" << std::endl;
-          resJSON["loginSuccess"] = false;
-          resJSON["resString"] = "Incorrect password";
-        }
-      }
-      else
-      {
-        std::cout << "User does not exist" << std::endl;
-        resJSON["loginSuccess"] = false;
-        resJSON["resString"] = "Email not found";
-      }
-    }
-    else
-    {
-      std::cout << "Missing request params" << std::endl;
-      resJSON["loginSuccess"] = false;
-      resJSON["resString"] = "Unable to log into account, make sure all info is filled in";
-    }
-
-    // return JSON response along with the JWT token as a cookie
-    crow::response res = crow::response(200, resJSON);
-    std::string cookie_settings = "; HttpOnly; Secure; SameSite=Strict";
-    std::string cookie_settings_temp = "; HttpOnly; SameSite=Strict";
-    res.set_header("Set-Cookie", "jwtToken=" + returned_token + cookie_settings_temp);
-    return res;
-  });
-
-  CROW_ROUTE(app, "/register").methods("POST"_method)([&database_available, &rate_limit_map, &user_collection](const crow::request &req)
+    context.known_emails = &known_emails;
+  }
+  else if (store.available())
   {
-
-    // Ensure MongoDB connection is established
-    if(!database_available)
-    {
-      std::cout << "Database unavailable when trying to register account" << std::endl;
-      return crow::response(503);
-    }
-
-    // Ensure request body is valid
-    crow::json::rvalue body = crow::json::load(req.body);
-    if(!body)
+    char* email_filter_rebuild = std::getenv("EMAIL_FILTER_REBUILD_SECONDS");
+    char* email_filter_refresh = std::getenv("EMAIL_FILTER_REFRESH_SECONDS");
+    long long rebuild_seconds = email_filter_rebuild ? std::strtoll(email_filter_rebuild, nullptr, 10) : 3600;
+    long long refresh_seconds = email_filter_refresh ? std::strtoll(email_filter_refresh, nullptr, 10) : 5;
+    try
     {
-      std::cout << "Invalid request body" << std::endl;
-      return crow::response(400);
+      known_emails.start(std::chrono::seconds(rebuild_seconds > 0 ? rebuild_seconds : 3600), std::chrono::seconds(refresh_seconds > 0 ? refresh_seconds : 5));
+      context.known_emails = &known_emails;
     }
-
-    // Ensures request IP Address is not blacklisted
-    std::string ip_address = req.remote_ip_address;
-    if (is_rate_limited(rate_limit_map, ip_address)) 
+    catch (const std::exception &e)
     {
-      std::cout << "Too many requests" << std::endl;
-      return crow::response(429);
+      CROW_LOG_ERROR << "Could not load the registered emails, every login will query the database: " << e.what();
     }
+  }
 
-    // Ensure secret key is valid and available on server
-    char* secret_key = std::getenv("SECRET_KEY");
-    char* secret_key_pepper = std::getenv("SECRET_KEY_PEPPER");
-    if(!secret_key || !secret_key_pepper)
-    {
-      std::cerr << "The SECRET_KEY environment variable is not set" << std::endl;
-      return crow::response(500);
-    }
-
-    crow::json::wvalue resJSON;
-    std::string returned_token = "";
-
-    // Ensure both email and password params are valid and/or were provided by user
-    if(body.has("email") && body.has("password") && body.has("name"))
-    {
-      std::string email = body["email"].s();
-      std::string password = body["password"].s();
-      std::string name = body["name"].s();
-      trim(email); trim(name);
-      std::string secret_key_string(secret_key);
-
-      // Ensure user with email does not already exist
-      bsoncxx::stdx::optional<bsoncxx::document::value> maybe_result = 
-        user_collection.find_one(bsoncxx::builder::stream::document{} << "email" << email << bsoncxx::builder::stream::finalize);
-      if(maybe_result)
-      {
-        std::cout << "user already exists!" << std::endl;
-        resJSON["resString"] = "An account already exists with this email!";
-        resJSON["registerSuccess"] = false;
-      }
-      else 
-      {
-        // Create row in User collection wil email and hashed password
-        std::string pepper(secret_key_pepper);
-        std::string hashed_password = BCrypt::generateHash((password + pepper));
-        bsoncxx::document::value doc_value = make_document(kvp("email", email), kvp("password", hashed_password), kvp("name", name));
-        auto insert_result = user_collection.insert_one(std::move(doc_value));
-
-        std::string uid = insert_result->inserted_id().get_oid().value.to_string();
-
-        // Create token so user can remain logged in for a certain amount of time
-        auto token = jwt::create()
-          .set_issuer("cartapp")
-          .set_type("JWS")
-          .set_payload_claim("email", jwt::claim(email))
-          .set_payload_claim("uid", jwt::claim(uid))
-          .set_issued_at(std::chrono::system_clock::now())
-          .set_expires_at(std::chrono::system_clock::now() + std::chrono::seconds{60*60*24*7})
-          .sign(jwt::algorithm::hs256{secret_key_string});
-
-        returned_token = token;
-        resJSON["registerSuccess"] = true;
-        resJSON["resString"] = "Registered successfully";
-      }
-    }
-    else 
-    {
-      std::cout << "Missing request params: email and/or password not provided" << std::endl;
-      resJSON["resString"] = "Unable to register, make sure both email and password are provided";
-      resJSON["registerSuccess"] = false;
-    }
+  // Availability changes made by the sequencer (and new bookings) are pushed to /ws/carts and /events subscribers
+  cart_broadcast_hub cart_feed;
 
-    // return JSON response along with the JWT token as a cookie
-    crow::response res = crow::response(200, resJSON);
-    std::string cookie_settings = "; HttpOnly; Secure; SameSite=Strict";
-    std::string cookie_settings_temp = "; HttpOnly; SameSite=Strict";
-    res.set_header("Set-Cookie", "jwtToken=" + returned_token + cookie_settings_temp);
-    return res;
-  });
+  // /cart-info answers from the sequencer's view of the fleet, as a whole or as the changes since a version
+  cart_inventory inventory;
 
-  CROW_ROUTE(app, "/logout").methods("POST"_method)([](const crow::request &req)
+  // Cart checkouts, holds and returns go through one allocation thread owning the fleet state
+  checkout_sequencer checkouts(store);
+  checkouts.on_change([&cart_feed, &inventory](const std::vector<cart_record> &changed)
   {
-    crow::response res = crow::response(200);
-    std::string cookie_settings = "jwtToken=; HttpOnly; Secure; SameSite=Strict; Expires=Thu, 01 Jan 1970 00:00:00 GMT";
-    std::string cookie_settings_temp = "jwtToken=; HttpOnly; SameSite=Strict; Expires=Thu, 01 Jan 1970 00:00:00 GMT";
-    res.set_header("Set-Cookie", cookie_settings_temp);
-    return res;
+    inventory.apply(changed);
+    cart_feed.publish(changed);
   });
-
-  CROW_ROUTE(app, "/cart-info").methods("POST"_method)([&database_available, &rate_limit_map, &cart_collection](const crow::request &req)
+  char* hold_seconds = std::getenv("HOLD_SECONDS");
+  if (hold_seconds && std::strtoll(hold_seconds, nullptr, 10) > 0)
   {
-
-    // Ensure MongoDB connection is established
-    if(!database_available)
+    context.hold_duration = std::chrono::seconds(std::strtoll(hold_seconds, nullptr, 10));
+  }
+  if (checkout_enabled && store.available())
+  {
+    try
     {
-      std::cout << "Database unavailable when trying to access cart info" << std::endl;
-      return crow::response(503);
+      checkouts.start();
+      context.checkouts = &checkouts;
+      context.cart_feed = &cart_feed;
+      context.inventory = &inventory;
     }
-
-    // Ensures request IP Address is not blacklisted
-    std::string ip_address = req.remote_ip_address;
-    if (is_rate_limited(rate_limit_map, ip_address)) 
+    catch (const std::exception &e)
     {
-      std::cout << "Too many requests" << std::endl;
-      return crow::response(429);
+      CROW_LOG_ERROR << "Could not load the fleet, checkout is disabled: " << e.what();
     }
+  }
 
-    crow::json::wvalue carts;
+  register_routes(app, context);
 
-    bsoncxx::document::view_or_value filter{};
-    auto cursor = cart_collection.find(filter);
-    
-    int i = 0;
-    for (auto&& doc : cursor) 
-    {
-      crow::json::wvalue cart;
-      std::string id_str = "";
-      std::string name = "";
-      int type = 0;
-      bool available;
-
-      auto id_element = doc["_id"];
-      if (id_element && id_element.type() == bsoncxx::type::k_oid) {
-        id_str = id_element.get_oid().value.to_string();
-      }
-
-      auto name_element = doc["name"];
-      if (name_element && name_element.type() == bsoncxx::type::k_utf8) {
-        name = name_element.get_utf8().value.to_string();
-      }
-
-      auto type_element = doc["type"];
-      if (type_element && type_element.type() == bsoncxx::type::k_int32) {
-        type = type_element.get_int32().value;
-      }
-
-      auto available_element = doc["available"];
-      if (available_element && available_element.type() == bsoncxx::type::k_bool) {
-        available = available_element.get_bool().value;
-      }
-
-      cart["id"] = id_str;
-      cart["name"] = name;
-      cart["type"] = type;
-      cart["available"] = available;
-      carts[i++] = std::move(cart);
-    }
+  // With several processes, each writes its own files: the configured path followed by .w and the worker index
+  auto worker_path = [processes, worker](const char *path)
+  {
+    return processes > 1 ? std::string(path) + ".w" + std::to_string(worker) : std::string(path);
+  };
 
-    return crow::response(200, carts);
-  });
+  // Binary access log, decoded offline with the access_log_decode tool
+  char *access_log_path = getenv("ACCESS_LOG_PATH");
+  if (access_log_path != NULL)
+  {
+    app.access_log(worker_path(access_log_path));
+  }
 
-  CROW_ROUTE(app, "/user-info").methods("POST"_method)([&user_collection](const crow::request& req)
+  // Sanitized request capture for tools/traffic_replay, one in every TRAFFIC_CAPTURE_SAMPLE requests (default all)
+  char *traffic_capture_path = getenv("TRAFFIC_CAPTURE_PATH");
+  if (traffic_capture_path != NULL)
   {
-    return crow::response(200);
-  });
+    char *traffic_capture_sample = getenv("TRAFFIC_CAPTURE_SAMPLE");
+    app.get_middleware<crow::TrafficCapture>().open(worker_path(traffic_capture_path),
+      static_cast<unsigned>(traffic_capture_sample != NULL ? std::strtoul(traffic_capture_sample, nullptr, 10) : 1));
+  }
+
+  // IPs sending ABUSE_BLOCK_THRESHOLD requests (default 1200, 0 disables) in a minute get 429s for ABUSE_BLOCK_SECONDS (default 300)
+  char *abuse_block_threshold = getenv("ABUSE_BLOCK_THRESHOLD");
+  char *abuse_block_seconds = getenv("ABUSE_BLOCK_SECONDS");
+  app.get_middleware<abuse_guard>().configure(
+    static_cast<uint32_t>(abuse_block_threshold != NULL ? std::strtoul(abuse_block_threshold, nullptr, 10) : 1200),
+    std::chrono::seconds(abuse_block_seconds != NULL ? std::strtoll(abuse_block_seconds, nullptr, 10) : 300));
 
   // Necessary Crow stuff to run server
   char *port = getenv("PORT");
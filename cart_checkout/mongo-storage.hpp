@@ -0,0 +1,524 @@
+#ifndef MONGO_STORAGE_HPP
+#define MONGO_STORAGE_HPP
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/oid.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/client.hpp>
+#include <mongocxx/exception/operation_exception.hpp>
+#include <mongocxx/model/update_one.hpp>
+#include <mongocxx/model/write.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/stdx.hpp>
+#include <mongocxx/uri.hpp>
+
+#include <crow/async_logging.h>
+
+#include "storage.hpp"
+
+/**
+ * @brief Stores users in Users.User and carts in CartDatabase.Carts.
+ * A mongocxx::instance must be alive for as long as this object.
+ *
+ * Every collection call is timed; one taking at least slow_query_threshold is logged as a slow_query event with
+ * the collection, the operation and the shape of its filter (field names and operators, values elided).
+ */
+class mongo_storage : public storage
+{
+public:
+  mongo_storage(const mongocxx::uri &uri, bool available, std::chrono::milliseconds slow_query_threshold = std::chrono::milliseconds(100))
+    : client_(uri),
+      cart_collection_(client_["CartDatabase"]["Carts"]),
+      user_collection_(client_["Users"]["User"]),
+      reservation_collection_(client_["CartDatabase"]["Reservations"]),
+      available_(available),
+      slow_query_threshold_(slow_query_threshold)
+  {
+  }
+
+  bool available() const override
+  {
+    return available_;
+  }
+
+  bool find_user_by_email(const std::string &email, user_record &user) override
+  {
+    auto filter_doc = bsoncxx::builder::stream::document{} << "email" << email << bsoncxx::builder::stream::finalize;
+    query_timer timer(*this, "Users.User", "find_one", filter_doc.view());
+    bsoncxx::stdx::optional<bsoncxx::document::value> result = user_collection_.find_one(filter_doc.view());
+    if (!result)
+    {
+      return false;
+    }
+    read_user(result->view(), user);
+    return true;
+  }
+
+  bool find_user(const std::string &uid, const std::string &email, user_record &user) override
+  {
+    auto filter_doc = bsoncxx::builder::stream::document{} << "email" << email << "_id" << bsoncxx::oid(uid) << bsoncxx::builder::stream::finalize;
+    query_timer timer(*this, "Users.User", "find_one", filter_doc.view());
+    bsoncxx::stdx::optional<bsoncxx::document::value> result = user_collection_.find_one(filter_doc.view());
+    if (!result)
+    {
+      return false;
+    }
+    read_user(result->view(), user);
+    return true;
+  }
+
+  /**
+   * @brief Relies on the unique email index built by ensure_indexes(): a registered email fails the insert with a
+   * duplicate key error instead of needing a find first.
+   */
+  insert_status insert_user(const user_record &user, std::string &uid) override
+  {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    bsoncxx::document::value doc_value = make_document(kvp("email", user.email), kvp("password", user.password_hash), kvp("name", user.name));
+    query_timer timer(*this, "Users.User", "insert_one");
+    try
+    {
+      auto insert_result = user_collection_.insert_one(std::move(doc_value));
+      if (!insert_result)
+      {
+        return insert_status::failed;
+      }
+      uid = insert_result->inserted_id().get_oid().value.to_string();
+      return insert_status::inserted;
+    }
+    catch (const mongocxx::operation_exception &e)
+    {
+      if (e.code().value() == duplicate_key_error)
+      {
+        return insert_status::duplicate;
+      }
+      CROW_SLOG_ERROR("insert_user").kv("error", e.what());
+      return insert_status::failed;
+    }
+  }
+
+  std::vector<std::string> list_user_emails() override
+  {
+    return read_user_emails(bsoncxx::document::view_or_value{});
+  }
+
+  std::vector<std::string> list_user_emails(std::chrono::system_clock::time_point since) override
+  {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    // An ObjectId starts with its creation time in seconds, so the smallest one of that second bounds an _id range
+    char first_oid[25];
+    snprintf(first_oid, sizeof(first_oid), "%08x0000000000000000",
+             static_cast<unsigned>(std::chrono::duration_cast<std::chrono::seconds>(since.time_since_epoch()).count()));
+    return read_user_emails(make_document(kvp("_id", make_document(kvp("$gte", bsoncxx::oid(std::string(first_oid)))))));
+  }
+
+  std::vector<cart_record> list_carts() override
+  {
+    std::vector<cart_record> carts;
+    bsoncxx::document::view_or_value filter{};
+    query_timer timer(*this, "CartDatabase.Carts", "find");
+    auto cursor = cart_collection_.find(filter);
+    for (auto &&doc : cursor)
+    {
+      cart_record cart;
+      read_cart(doc, cart);
+      carts.push_back(std::move(cart));
+    }
+    return carts;
+  }
+
+  cart_page query_carts(const cart_query &query) override
+  {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_array;
+    using bsoncxx::builder::basic::make_document;
+
+    // Equality on type and available, then the (name, _id) sort: served by the { type, available, name, _id } index
+    // (or { name, _id } without a type filter); an anchored prefix regex only scans the matching name range
+    bsoncxx::builder::basic::document filter;
+    if (query.type >= 0)
+    {
+      filter.append(kvp("type", query.type));
+    }
+    if (query.available >= 0)
+    {
+      filter.append(kvp("available", query.available != 0));
+    }
+    if (!query.name_prefix.empty())
+    {
+      filter.append(kvp("name", make_document(kvp("$regex", "^" + escape_regex(query.name_prefix)))));
+    }
+    if (!query.after_id.empty())
+    {
+      filter.append(kvp("$or", make_array(make_document(kvp("name", make_document(kvp("$gt", query.after_name)))),
+                                          make_document(kvp("name", query.after_name), kvp("_id", make_document(kvp("$gt", bsoncxx::oid(query.after_id))))))));
+    }
+
+    // Only the requested fields come back; the name is always needed for the next page's cursor
+    bsoncxx::builder::basic::document projection;
+    projection.append(kvp("name", 1));
+    if (query.fields & cart_field_type)
+    {
+      projection.append(kvp("type", 1));
+    }
+    if (query.fields & cart_field_available)
+    {
+      projection.append(kvp("available", 1));
+    }
+
+    mongocxx::options::find options;
+    options.sort(make_document(kvp("name", 1), kvp("_id", 1)));
+    options.limit(static_cast<int64_t>(query.limit) + 1);
+    options.projection(projection.extract());
+
+    cart_page page;
+    bsoncxx::document::value filter_doc = filter.extract();
+    query_timer timer(*this, "CartDatabase.Carts", "find", filter_doc.view());
+    auto cursor = cart_collection_.find(filter_doc.view(), options);
+    for (auto &&doc : cursor)
+    {
+      if (page.carts.size() == query.limit)
+      {
+        page.more = true;
+        break;
+      }
+      cart_record cart;
+      read_cart(doc, cart);
+      page.carts.push_back(std::move(cart));
+    }
+    return page;
+  }
+
+  /**
+   * @brief Builds the indexes the queries of this class rely on. Declaring an index that already exists is a
+   * no-op, so this runs on every start.
+   *
+   * @return false if any index could not be built (e.g. existing duplicate emails); the others are still built.
+   */
+  bool ensure_indexes()
+  {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    // Logins, registrations and token checks look users up by email (and _id), and emails identify members
+    bool built = ensure_index(user_collection_, "Users.User", make_document(kvp("email", 1)), make_document(kvp("unique", true)));
+
+    // Cart queries: the (name, _id) order, optionally after equality on type and availability
+    built &= ensure_index(cart_collection_, "CartDatabase.Carts", make_document(kvp("name", 1), kvp("_id", 1)));
+    built &= ensure_index(cart_collection_, "CartDatabase.Carts", make_document(kvp("type", 1), kvp("available", 1), kvp("name", 1), kvp("_id", 1)));
+
+    // Reservations are loaded from a day on
+    built &= ensure_index(reservation_collection_, "CartDatabase.Reservations", make_document(kvp("day", 1)));
+    return built;
+  }
+
+  bool update_carts(const std::vector<cart_update> &updates) override
+  {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    if (updates.empty())
+    {
+      return true;
+    }
+    std::vector<mongocxx::model::write> writes;
+    writes.reserve(updates.size());
+    for (const auto &update : updates)
+    {
+      writes.emplace_back(mongocxx::model::update_one(make_document(kvp("_id", bsoncxx::oid(update.cart_id))),
+                                                      make_document(kvp("$set", make_document(kvp("available", update.available), kvp("holder", update.holder))))));
+    }
+    query_timer timer(*this, "CartDatabase.Carts", "bulk_write");
+    auto result = cart_collection_.bulk_write(writes);
+    return static_cast<bool>(result);
+  }
+
+  std::string insert_reservation(const reservation_record &reservation) override
+  {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    bsoncxx::document::value doc_value = make_document(kvp("cart_id", reservation.cart_id), kvp("uid", reservation.uid), kvp("day", reservation.day),
+                                                       kvp("first_slot", reservation.first_slot), kvp("slot_count", reservation.slot_count));
+    query_timer timer(*this, "CartDatabase.Reservations", "insert_one");
+    auto insert_result = reservation_collection_.insert_one(std::move(doc_value));
+    if (!insert_result)
+    {
+      return "";
+    }
+    return insert_result->inserted_id().get_oid().value.to_string();
+  }
+
+  std::vector<reservation_record> list_reservations(int from_day) override
+  {
+    std::vector<reservation_record> reservations;
+    auto filter_doc = bsoncxx::builder::stream::document{} << "day" << bsoncxx::builder::stream::open_document << "$gte" << from_day
+                                                           << bsoncxx::builder::stream::close_document << bsoncxx::builder::stream::finalize;
+    query_timer timer(*this, "CartDatabase.Reservations", "find", filter_doc.view());
+    auto cursor = reservation_collection_.find(filter_doc.view());
+    for (auto &&doc : cursor)
+    {
+      reservation_record reservation;
+
+      auto id_element = doc["_id"];
+      if (id_element && id_element.type() == bsoncxx::type::k_oid)
+      {
+        reservation.id = id_element.get_oid().value.to_string();
+      }
+
+      auto cart_element = doc["cart_id"];
+      auto uid_element = doc["uid"];
+      auto day_element = doc["day"];
+      auto first_slot_element = doc["first_slot"];
+      auto slot_count_element = doc["slot_count"];
+      if (!cart_element || cart_element.type() != bsoncxx::type::k_utf8 ||
+          !day_element || day_element.type() != bsoncxx::type::k_int32 ||
+          !first_slot_element || first_slot_element.type() != bsoncxx::type::k_int32 ||
+          !slot_count_element || slot_count_element.type() != bsoncxx::type::k_int32)
+      {
+        continue;
+      }
+      reservation.cart_id = cart_element.get_utf8().value.to_string();
+      if (uid_element && uid_element.type() == bsoncxx::type::k_utf8)
+      {
+        reservation.uid = uid_element.get_utf8().value.to_string();
+      }
+      reservation.day = day_element.get_int32().value;
+      reservation.first_slot = first_slot_element.get_int32().value;
+      reservation.slot_count = slot_count_element.get_int32().value;
+
+      reservations.push_back(std::move(reservation));
+    }
+    return reservations;
+  }
+
+private:
+  std::vector<std::string> read_user_emails(bsoncxx::document::view_or_value filter)
+  {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+
+    // Only the emails are sent back (and read off the email index when every user is listed)
+    mongocxx::options::find options;
+    options.projection(make_document(kvp("email", 1), kvp("_id", 0)));
+
+    std::vector<std::string> emails;
+    query_timer timer(*this, "Users.User", "find", filter.view());
+    auto cursor = user_collection_.find(filter, options);
+    for (auto &&doc : cursor)
+    {
+      auto email_element = doc["email"];
+      if (email_element && email_element.type() == bsoncxx::type::k_utf8)
+      {
+        emails.push_back(email_element.get_utf8().value.to_string());
+      }
+    }
+    return emails;
+  }
+
+  // The server error code of a write violating a unique index
+  static const int duplicate_key_error = 11000;
+
+  /**
+   * @brief Times a collection call until it goes out of scope (so a find includes reading its cursor), and logs it if
+   * it was slow. The filter must outlive the timer.
+   */
+  class query_timer
+  {
+  public:
+    query_timer(const mongo_storage &storage, const char *collection, const char *operation, bsoncxx::document::view filter = {})
+      : storage_(storage), collection_(collection), operation_(operation), filter_(filter), start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    query_timer(const query_timer &) = delete;
+    query_timer &operator=(const query_timer &) = delete;
+
+    ~query_timer()
+    {
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_);
+      if (elapsed >= storage_.slow_query_threshold_)
+      {
+        std::string shape;
+        append_shape(shape, filter_);
+        CROW_SLOG_WARNING("slow_query").kv("collection", collection_).kv("operation", operation_).kv("filter", shape).kv("latency_ms", elapsed.count() / 1000.0);
+      }
+    }
+
+  private:
+    const mongo_storage &storage_;
+    const char *collection_;
+    const char *operation_;
+    bsoncxx::document::view filter_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  /**
+   * @brief Appends document with its values replaced by '?', e.g. {day:{$gte:?}}, so queries differing only in
+   * their values report the same shape.
+   */
+  static void append_shape(std::string &shape, bsoncxx::document::view document)
+  {
+    shape += '{';
+    bool first = true;
+    for (const auto &element : document)
+    {
+      if (!first)
+      {
+        shape += ',';
+      }
+      first = false;
+      shape += element.key().to_string();
+      shape += ':';
+      append_value_shape(shape, element);
+    }
+    shape += '}';
+  }
+
+  static void append_value_shape(std::string &shape, const bsoncxx::document::element &value)
+  {
+    if (value.type() == bsoncxx::type::k_document)
+    {
+      append_shape(shape, value.get_document().value);
+    }
+    else if (value.type() == bsoncxx::type::k_array)
+    {
+      shape += '[';
+      bool first = true;
+      for (const auto &item : value.get_array().value)
+      {
+        if (!first)
+        {
+          shape += ',';
+        }
+        first = false;
+        append_value_shape(shape, item);
+      }
+      shape += ']';
+    }
+    else
+    {
+      shape += '?';
+    }
+  }
+
+  bool ensure_index(mongocxx::collection &collection, const char *name, bsoncxx::document::value keys,
+                    bsoncxx::document::view_or_value options = {})
+  {
+    std::string shape;
+    append_shape(shape, keys.view());
+    try
+    {
+      query_timer timer(*this, name, "create_index");
+      collection.create_index(keys.view(), options);
+      CROW_SLOG_INFO("index_ready").kv("collection", name).kv("keys", shape);
+      return true;
+    }
+    catch (const std::exception &e)
+    {
+      CROW_SLOG_ERROR("index_failed").kv("collection", name).kv("keys", shape).kv("error", e.what());
+      return false;
+    }
+  }
+
+  static void read_cart(bsoncxx::document::view view, cart_record &cart)
+  {
+    auto id_element = view["_id"];
+    if (id_element && id_element.type() == bsoncxx::type::k_oid)
+    {
+      cart.id = id_element.get_oid().value.to_string();
+    }
+
+    auto name_element = view["name"];
+    if (name_element && name_element.type() == bsoncxx::type::k_utf8)
+    {
+      cart.name = name_element.get_utf8().value.to_string();
+    }
+
+    auto type_element = view["type"];
+    if (type_element && type_element.type() == bsoncxx::type::k_int32)
+    {
+      cart.type = type_element.get_int32().value;
+    }
+
+    auto available_element = view["available"];
+    if (available_element && available_element.type() == bsoncxx::type::k_bool)
+    {
+      cart.available = available_element.get_bool().value;
+    }
+
+    auto holder_element = view["holder"];
+    if (holder_element && holder_element.type() == bsoncxx::type::k_utf8)
+    {
+      cart.holder = holder_element.get_utf8().value.to_string();
+    }
+  }
+
+  /**
+   * @brief Escapes the characters a regular expression would interpret.
+   */
+  static std::string escape_regex(const std::string &text)
+  {
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text)
+    {
+      if (c != '\0' && std::strchr("\\^$.|?*+()[]{}", c))
+      {
+        escaped += '\\';
+      }
+      escaped += c;
+    }
+    return escaped;
+  }
+
+  static void read_user(bsoncxx::document::view view, user_record &user)
+  {
+    auto id_element = view["_id"];
+    if (id_element && id_element.type() == bsoncxx::type::k_oid)
+    {
+      user.id = id_element.get_oid().value.to_string();
+    }
+
+    auto email_element = view["email"];
+    if (email_element && email_element.type() == bsoncxx::type::k_utf8)
+    {
+      user.email = email_element.get_utf8().value.to_string();
+    }
+
+    auto password_element = view["password"];
+    if (password_element && password_element.type() == bsoncxx::type::k_utf8)
+    {
+      user.password_hash = password_element.get_utf8().value.to_string();
+    }
+
+    auto name_element = view["name"];
+    if (name_element && name_element.type() == bsoncxx::type::k_utf8)
+    {
+      user.name = name_element.get_utf8().value.to_string();
+    }
+  }
+
+  mongocxx::client client_;
+  mongocxx::collection cart_collection_;
+  mongocxx::collection user_collection_;
+  mongocxx::collection reservation_collection_;
+  bool available_;
+  std::chrono::microseconds slow_query_threshold_;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef PREFORK_HPP
+#define PREFORK_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+/**
+ * @brief Runs processes copies of the server: forks that many workers, each returning from here with its index
+ * (from 0), while the calling process stays here as their supervisor until they have all exited, then exits.
+ *
+ * The supervisor starts again a worker exiting with an error or killed by a signal (waiting a second first if it
+ * died within a second of starting), and passes SIGINT and SIGTERM on to the workers, which then stop as a single
+ * process would. Workers exiting cleanly are not restarted.
+ *
+ * Call before starting any thread, as only the calling thread is forked, and before anything worth not copying,
+ * e.g. database connections. The supervisor only writes to stderr.
+ */
+inline unsigned prefork(unsigned processes)
+{
+  // The signals are only taken by sigwait in the supervisor; workers get the mask back
+  sigset_t signals, previous_mask;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &signals, &previous_mask);
+  pid_t supervisor = getpid();
+
+  std::vector<pid_t> workers(processes, 0);
+  std::vector<std::chrono::steady_clock::time_point> started(processes);
+  bool stopping = false;
+
+  auto stop_workers = [&workers]
+  {
+    for (pid_t pid : workers)
+    {
+      if (pid > 0)
+      {
+        kill(pid, SIGTERM);
+      }
+    }
+  };
+
+  // Returns true in the new worker
+  auto spawn = [&](unsigned index)
+  {
+    started[index] = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+#ifdef __linux__
+      // A worker outliving a killed supervisor would keep the port
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      if (getppid() != supervisor)
+      {
+        std::_Exit(1);
+      }
+#endif
+      sigprocmask(SIG_SETMASK, &previous_mask, nullptr);
+      return true;
+    }
+    if (pid < 0)
+    {
+      std::fprintf(stderr, "prefork: could not start worker %u: %s\n", index, std::strerror(errno));
+    }
+    workers[index] = pid > 0 ? pid : 0;
+    return false;
+  };
+
+  for (unsigned index = 0; index < processes; index++)
+  {
+    if (spawn(index))
+    {
+      return index;
+    }
+  }
+  std::fprintf(stderr, "prefork: supervisor %d started %u workers\n", static_cast<int>(supervisor), processes);
+
+  while (true)
+  {
+    int signal = 0;
+    if (sigwait(&signals, &signal) != 0)
+    {
+      continue;
+    }
+    if (signal != SIGCHLD)
+    {
+      stopping = true;
+      stop_workers();
+    }
+
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+      for (unsigned index = 0; index < processes; index++)
+      {
+        if (workers[index] != pid)
+        {
+          continue;
+        }
+        workers[index] = 0;
+        if (stopping || (WIFEXITED(status) && WEXITSTATUS(status) == 0))
+        {
+          break;
+        }
+
+        if (WIFSIGNALED(status))
+        {
+          std::fprintf(stderr, "prefork: worker %u (%d) killed by signal %d, restarting it\n", index, static_cast<int>(pid), WTERMSIG(status));
+        }
+        else
+        {
+          std::fprintf(stderr, "prefork: worker %u (%d) exited with %d, restarting it\n", index, static_cast<int>(pid), WEXITSTATUS(status));
+        }
+        if (std::chrono::steady_clock::now() - started[index] < std::chrono::seconds(1))
+        {
+          std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        if (spawn(index))
+        {
+          return index;
+        }
+        break;
+      }
+    }
+
+    bool running = false;
+    for (pid_t worker : workers)
+    {
+      running = running || worker > 0;
+    }
+    if (!running)
+    {
+      std::fprintf(stderr, "prefork: every worker has exited\n");
+      std::exit(0);
+    }
+  }
+}
+
+#endif
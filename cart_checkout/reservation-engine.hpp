@@ -0,0 +1,478 @@
+#ifndef RESERVATION_ENGINE_HPP
+#define RESERVATION_ENGINE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESERVATION_ENGINE_X86 1
+#endif
+
+#include "storage.hpp"
+
+/**
+ * @brief Books carts in 5-minute slots and finds free carts for a time window, across a whole season.
+ *
+ * Every day keeps one bit per slot and cart (set = booked). Bits are stored word-major: word w of every cart
+ * is contiguous, so checking a window against the fleet is a handful of AND/OR over consecutive carts,
+ * done 4 carts at a time with AVX2 (when the CPU has it) or 2 at a time with SSE2. Searching for the earliest
+ * free window of a given length folds each cart's free bits onto themselves instead of trying every start.
+ *
+ * Bookings are committed in memory first (rejecting overlaps atomically) and then written through to the store;
+ * a booking the store refuses is rolled back.
+ */
+class reservation_engine
+{
+public:
+  static constexpr int slot_minutes = 5;
+  static constexpr int slots_per_day = 24 * 60 / slot_minutes; // 288
+  static constexpr int words_per_day = (slots_per_day + 63) / 64; // 5
+  static constexpr int booking_horizon_days = 365; // the last bookable day, counted from today
+
+  /**
+   * @brief The outcome of a booking request.
+   */
+  enum class booking_status
+  {
+    booked,
+    conflict,        // the cart is already booked for part of the window
+    invalid,         // unknown cart or a window outside the day
+    storage_failure  // the store did not accept the reservation
+  };
+
+  explicit reservation_engine(storage &store) : store_(store) {}
+
+  /**
+   * @brief Loads the fleet and every reservation from from_day onwards. Carts are indexed in list_carts order.
+   */
+  void load(int from_day)
+  {
+    std::vector<cart_record> carts = store_.list_carts();
+    std::vector<reservation_record> reservations = store_.list_reservations(from_day);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    carts_ = std::move(carts);
+    cart_indexes_.clear();
+    for (size_t i = 0; i < carts_.size(); i++)
+    {
+      cart_indexes_[carts_[i].id] = i;
+    }
+    days_.clear();
+    for (const auto &reservation : reservations)
+    {
+      auto cart = cart_indexes_.find(reservation.cart_id);
+      if (cart == cart_indexes_.end() || !valid_window(reservation.first_slot, reservation.slot_count))
+      {
+        continue;
+      }
+      set_bits(day_locked(reservation.day), cart->second, reservation.first_slot, reservation.slot_count, true);
+    }
+  }
+
+  /**
+   * @brief Returns the carts of the given type (any type if negative) free for the whole window.
+   */
+  std::vector<cart_record> find_free(int day, int first_slot, int slot_count, int type = -1) const
+  {
+    std::vector<cart_record> free_carts;
+    if (!valid_window(first_slot, slot_count))
+    {
+      return free_carts;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint8_t> busy;
+    scan_locked(day, first_slot, slot_count, busy);
+    for (size_t i = 0; i < carts_.size(); i++)
+    {
+      if (!busy[i] && (type < 0 || carts_[i].type == type))
+      {
+        free_carts.push_back(carts_[i]);
+      }
+    }
+    return free_carts;
+  }
+
+  /**
+   * @brief Finds the earliest start between earliest_slot and latest_end_slot - slot_count at which a cart of the
+   * given type (any type if negative) is free for slot_count slots.
+   *
+   * Each cart's free slots are folded onto themselves (free &= free >> k, doubling k) until bit i means
+   * "slots i .. i + slot_count - 1 are free", so the search costs O(log slot_count) word operations per cart.
+   *
+   * @return int the start slot (free_carts holds the carts free from it), or -1 if there is none.
+   */
+  int find_earliest_window(int day, int earliest_slot, int latest_end_slot, int slot_count, int type, std::vector<cart_record> &free_carts) const
+  {
+    free_carts.clear();
+    earliest_slot = std::max(earliest_slot, 0);
+    latest_end_slot = std::min(latest_end_slot, static_cast<int>(slots_per_day));
+    if (slot_count <= 0 || earliest_slot + slot_count > latest_end_slot)
+    {
+      return -1;
+    }
+
+    uint64_t starts_mask[words_per_day];
+    window_mask(earliest_slot, latest_end_slot - slot_count - earliest_slot + 1, starts_mask);
+    uint64_t day_mask[words_per_day];
+    window_mask(0, slots_per_day, day_mask);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = days_.find(day);
+    const day_table *table = found != days_.end() && found->second.words[0].size() == padded_cart_count() ? &found->second : nullptr;
+
+    int best = -1;
+    std::vector<uint64_t> starts(carts_.size() * words_per_day, 0);
+    for (size_t cart = 0; cart < carts_.size(); cart++)
+    {
+      if (type >= 0 && carts_[cart].type != type)
+      {
+        continue;
+      }
+      uint64_t *runs = &starts[cart * words_per_day];
+      for (int w = 0; w < words_per_day; w++)
+      {
+        runs[w] = (table ? ~table->words[w][cart] : ~0ULL) & day_mask[w];
+      }
+      for (int covered = 1; covered < slot_count;)
+      {
+        int shift = std::min(std::min(covered, slot_count - covered), 63);
+        fold_right(runs, shift);
+        covered += shift;
+      }
+      for (int w = 0; w < words_per_day; w++)
+      {
+        runs[w] &= starts_mask[w];
+        if (runs[w])
+        {
+          int start = w * 64 + __builtin_ctzll(runs[w]);
+          if (best < 0 || start < best)
+          {
+            best = start;
+          }
+          break;
+        }
+      }
+    }
+
+    if (best >= 0)
+    {
+      for (size_t cart = 0; cart < carts_.size(); cart++)
+      {
+        if (starts[cart * words_per_day + best / 64] & (1ULL << (best % 64)))
+        {
+          free_carts.push_back(carts_[cart]);
+        }
+      }
+    }
+    return best;
+  }
+
+  /**
+   * @brief Books a cart for slot_count slots from first_slot, if none of them are booked yet.
+   */
+  booking_status book(const std::string &cart_id, const std::string &uid, int day, int first_slot, int slot_count, std::string *reservation_id = nullptr)
+  {
+    if (!valid_window(first_slot, slot_count))
+    {
+      return booking_status::invalid;
+    }
+
+    size_t cart;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto found = cart_indexes_.find(cart_id);
+      if (found == cart_indexes_.end())
+      {
+        return booking_status::invalid;
+      }
+      cart = found->second;
+      // A day without a table has nothing booked; its table is only made for a booking that is accepted
+      if (days_.count(day) && overlaps(day_locked(day), cart, first_slot, slot_count))
+      {
+        return booking_status::conflict;
+      }
+      set_bits(day_locked(day), cart, first_slot, slot_count, true);
+    }
+
+    reservation_record reservation;
+    reservation.cart_id = cart_id;
+    reservation.uid = uid;
+    reservation.day = day;
+    reservation.first_slot = first_slot;
+    reservation.slot_count = slot_count;
+    std::string id = store_.insert_reservation(reservation);
+    if (id.empty())
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      set_bits(day_locked(day), cart, first_slot, slot_count, false);
+      return booking_status::storage_failure;
+    }
+    if (reservation_id)
+    {
+      *reservation_id = id;
+    }
+    return booking_status::booked;
+  }
+
+  size_t cart_count() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return carts_.size();
+  }
+
+  /**
+   * @brief Converts "HH:MM" to a slot index, rounding down (or up with round_up) to the 5-minute grid.
+   *
+   * @return int the slot (slots_per_day for "24:00"), or -1 if the time is malformed.
+   */
+  static int parse_slot(const std::string &time, bool round_up = false)
+  {
+    int hours = 0, minutes = 0;
+    if (std::sscanf(time.c_str(), "%d:%d", &hours, &minutes) != 2 || hours < 0 || minutes < 0 || minutes >= 60 || hours * 60 + minutes > 24 * 60)
+    {
+      return -1;
+    }
+    int total = hours * 60 + minutes;
+    return round_up ? (total + slot_minutes - 1) / slot_minutes : total / slot_minutes;
+  }
+
+  /**
+   * @brief Today in days since 1970-01-01 (UTC), the first day load() keeps.
+   */
+  static int today()
+  {
+    return static_cast<int>(std::time(nullptr) / 86400);
+  }
+
+  /**
+   * @brief Whether day can be queried or booked: from today to booking_horizon_days later. Earlier days are not
+   * reloaded after a restart, so their bookings would be missing.
+   */
+  static bool bookable_day(int day)
+  {
+    int first = today();
+    return day >= first && day <= first + booking_horizon_days;
+  }
+
+  /**
+   * @brief Converts "YYYY-MM-DD" to days since 1970-01-01.
+   *
+   * @return bool false if the date is malformed.
+   */
+  static bool parse_day(const std::string &date, int &day)
+  {
+    int year = 0, month = 0, day_of_month = 0;
+    if (std::sscanf(date.c_str(), "%d-%d-%d", &year, &month, &day_of_month) != 3 || month < 1 || month > 12 || day_of_month < 1 || day_of_month > 31)
+    {
+      return false;
+    }
+    // days_from_civil (Howard Hinnant)
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day_of_month - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    day = era * 146097 + day_of_era - 719468;
+    return true;
+  }
+
+private:
+  /**
+   * @brief One day of the fleet: words[w][cart] holds slots 64*w .. 64*w+63 of the cart.
+   * Rows are padded to a multiple of 4 carts so the vector loops need no tail.
+   */
+  struct day_table
+  {
+    std::vector<uint64_t> words[words_per_day];
+  };
+
+  static bool valid_window(int first_slot, int slot_count)
+  {
+    return first_slot >= 0 && slot_count > 0 && first_slot + slot_count <= slots_per_day;
+  }
+
+  static void window_mask(int first_slot, int slot_count, uint64_t mask[words_per_day])
+  {
+    for (int w = 0; w < words_per_day; w++)
+    {
+      int low = std::max(first_slot, w * 64);
+      int high = std::min(first_slot + slot_count, (w + 1) * 64);
+      if (low >= high)
+      {
+        mask[w] = 0;
+        continue;
+      }
+      int width = high - low;
+      uint64_t bits = width == 64 ? ~0ULL : ((1ULL << width) - 1);
+      mask[w] = bits << (low - w * 64);
+    }
+  }
+
+  size_t padded_cart_count() const
+  {
+    return (carts_.size() + 3) & ~static_cast<size_t>(3);
+  }
+
+  day_table &day_locked(int day)
+  {
+    day_table &table = days_[day];
+    if (table.words[0].size() != padded_cart_count())
+    {
+      for (auto &row : table.words)
+      {
+        row.resize(padded_cart_count(), 0);
+      }
+    }
+    return table;
+  }
+
+  /**
+   * @brief bits &= bits >> shift across the day's words (0 < shift < 64).
+   */
+  static void fold_right(uint64_t bits[words_per_day], int shift)
+  {
+    for (int w = 0; w < words_per_day; w++)
+    {
+      uint64_t shifted = bits[w] >> shift;
+      if (w + 1 < words_per_day)
+      {
+        shifted |= bits[w + 1] << (64 - shift);
+      }
+      bits[w] &= shifted;
+    }
+  }
+
+  static bool overlaps(const day_table &table, size_t cart, int first_slot, int slot_count)
+  {
+    uint64_t mask[words_per_day];
+    window_mask(first_slot, slot_count, mask);
+    for (int w = 0; w < words_per_day; w++)
+    {
+      if (table.words[w][cart] & mask[w])
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void set_bits(day_table &table, size_t cart, int first_slot, int slot_count, bool booked)
+  {
+    uint64_t mask[words_per_day];
+    window_mask(first_slot, slot_count, mask);
+    for (int w = 0; w < words_per_day; w++)
+    {
+      table.words[w][cart] = booked ? (table.words[w][cart] | mask[w]) : (table.words[w][cart] & ~mask[w]);
+    }
+  }
+
+  /**
+   * @brief Sets busy[cart] for every cart with a booked slot in the window (days never booked are all free).
+   */
+  void scan_locked(int day, int first_slot, int slot_count, std::vector<uint8_t> &busy) const
+  {
+    busy.assign(padded_cart_count(), 0);
+    auto found = days_.find(day);
+    if (found == days_.end() || found->second.words[0].size() != busy.size())
+    {
+      return;
+    }
+
+    uint64_t mask[words_per_day];
+    window_mask(first_slot, slot_count, mask);
+    const uint64_t *rows[words_per_day];
+    uint64_t row_masks[words_per_day];
+    int row_count = 0;
+    for (int w = 0; w < words_per_day; w++)
+    {
+      if (mask[w])
+      {
+        rows[row_count] = found->second.words[w].data();
+        row_masks[row_count++] = mask[w];
+      }
+    }
+
+#ifdef RESERVATION_ENGINE_X86
+    if (has_avx2())
+    {
+      scan_avx2(rows, row_masks, row_count, busy.size(), busy.data());
+      return;
+    }
+#endif
+#if defined(__SSE2__)
+    scan_sse2(rows, row_masks, row_count, busy.size(), busy.data());
+#else
+    for (size_t cart = 0; cart < busy.size(); cart++)
+    {
+      uint64_t conflicts = 0;
+      for (int r = 0; r < row_count; r++)
+      {
+        conflicts |= rows[r][cart] & row_masks[r];
+      }
+      busy[cart] = conflicts != 0;
+    }
+#endif
+  }
+
+#ifdef RESERVATION_ENGINE_X86
+  static bool has_avx2()
+  {
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+  }
+
+  __attribute__((target("avx2"))) static void scan_avx2(const uint64_t *const *rows, const uint64_t *row_masks, int row_count, size_t cart_count, uint8_t *busy)
+  {
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t cart = 0; cart < cart_count; cart += 4)
+    {
+      __m256i conflicts = zero;
+      for (int r = 0; r < row_count; r++)
+      {
+        __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows[r] + cart));
+        conflicts = _mm256_or_si256(conflicts, _mm256_and_si256(words, _mm256_set1_epi64x(static_cast<long long>(row_masks[r]))));
+      }
+      int free_lanes = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(conflicts, zero)));
+      for (int lane = 0; lane < 4; lane++)
+      {
+        busy[cart + lane] = !(free_lanes & (1 << lane));
+      }
+    }
+  }
+#endif
+
+#if defined(__SSE2__)
+  static void scan_sse2(const uint64_t *const *rows, const uint64_t *row_masks, int row_count, size_t cart_count, uint8_t *busy)
+  {
+    for (size_t cart = 0; cart < cart_count; cart += 2)
+    {
+      __m128i conflicts = _mm_setzero_si128();
+      for (int r = 0; r < row_count; r++)
+      {
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[r] + cart));
+        conflicts = _mm_or_si128(conflicts, _mm_and_si128(words, _mm_set1_epi64x(static_cast<long long>(row_masks[r]))));
+      }
+      alignas(16) uint64_t lanes[2];
+      _mm_store_si128(reinterpret_cast<__m128i *>(lanes), conflicts);
+      busy[cart] = lanes[0] != 0;
+      busy[cart + 1] = lanes[1] != 0;
+    }
+  }
+#endif
+
+  storage &store_;
+  mutable std::mutex mutex_;
+  std::vector<cart_record> carts_;
+  std::unordered_map<std::string, size_t> cart_indexes_;
+  std::unordered_map<int, day_table> days_;
+};
+
+#endif
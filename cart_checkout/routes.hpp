@@ -0,0 +1,1295 @@
+#ifndef ROUTES_HPP
+#define ROUTES_HPP
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <crow.h>
+#include <crow/middlewares/cookie_parser.h>
+#include <crow/middlewares/traffic_capture.h>
+
+#include "abuse-guard.hpp"
+#include "authentication.hpp"
+#include "broadcast-hub.hpp"
+#include "cart-inventory.hpp"
+#include "checkout-sequencer.hpp"
+#include "email-filter.hpp"
+#include "load-static-content.hpp"
+#include "reservation-engine.hpp"
+#include "shared-state.hpp"
+#include "single-flight.hpp"
+#include "storage.hpp"
+
+typedef crow::App<crow::CookieParser, crow::TrafficCapture, host_stats, abuse_guard> cart_checkout_app;
+
+/**
+ * @brief Result of a user lookup, shared between coalesced /verify-token requests.
+ */
+struct user_lookup
+{
+  bool found = false;
+  user_record user;
+};
+
+/**
+ * @brief Ids of the database calls timed on /metrics as crow_operation_duration_seconds{operation="..."}.
+ */
+struct db_operation_ids
+{
+  unsigned find_user = 0;
+  unsigned insert_user = 0;
+  unsigned query_carts = 0;
+  unsigned list_carts = 0;
+  unsigned insert_reservation = 0;
+};
+
+/**
+ * @brief State shared by the route handlers; must outlive the app.
+ */
+struct route_context
+{
+  explicit route_context(storage &store) : store(store) {}
+
+  storage &store;
+
+  // Rate limiter based on IP address and timestamp, host-wide in shared (this process's map without it)
+  shared_state *shared = nullptr;
+  unsigned worker = 0; // this process's index in shared
+  std::unordered_map<std::string, std::pair<int, std::chrono::time_point<std::chrono::steady_clock>>> rate_limit_map;
+  bool rate_limiting = true;
+
+  // The app's metrics (null when disabled) and the database calls registered with them, set by register_routes
+  crow::metrics_registry *metrics = nullptr;
+  db_operation_ids operations;
+
+  // Sampling CPU profiler behind /debug/profile, admin-only
+  bool profiler_enabled = false;
+
+  // Registered emails, so /login and /verify-token skip the database for unknown ones (always looked up without it)
+  known_email_filter *known_emails = nullptr;
+
+  // Concurrent identical reads share one database call (keyed by "uid\nemail" for users)
+  single_flight<int, std::vector<cart_record>> cart_list_reads;
+  single_flight<std::string, user_lookup> user_reads;
+
+  // Time-slotted cart bookings behind /cart-availability and /reserve (those routes answer 503 without it)
+  reservation_engine *reservations = nullptr;
+
+  // Single-writer cart allocation behind POST /checkout, /hold, /confirm and /return (those routes answer 503 without it)
+  checkout_sequencer *checkouts = nullptr;
+
+  // The fleet with its change log, serving /cart-info from memory (the store is read without it)
+  cart_inventory *inventory = nullptr;
+
+  // Live availability and bookings pushed over /ws/carts and /events (refused without it)
+  cart_broadcast_hub *cart_feed = nullptr;
+
+  // How long /hold keeps a cart for a member who has not confirmed, and the longest hold a request may ask for
+  std::chrono::seconds hold_duration{180};
+};
+
+/**
+ * @brief Formats a reservation slot index as "HH:MM".
+ */
+inline std::string format_slot(int slot)
+{
+  char time[6];
+  snprintf(time, sizeof(time), "%02d:%02d", slot * reservation_engine::slot_minutes / 60, slot * reservation_engine::slot_minutes % 60);
+  return time;
+}
+
+/**
+ * @brief Reads the /cart-info query parameters: type, available (true/false), prefix, after (a page cursor),
+ * limit (at most 500) and fields (a comma separated subset of name, type and available).
+ *
+ * @return false if a parameter is malformed. filtered is set if any was given.
+ */
+inline bool parse_cart_query(const crow::request &req, cart_query &query, bool &filtered)
+{
+  filtered = false;
+  if (const char *type = req.url_params.get("type"))
+  {
+    char *end = nullptr;
+    long value = std::strtol(type, &end, 10);
+    if (*type == '\0' || *end != '\0' || value < 0 || value > 1000)
+    {
+      return false;
+    }
+    query.type = static_cast<int>(value);
+    filtered = true;
+  }
+  if (const char *available = req.url_params.get("available"))
+  {
+    if (strcmp(available, "true") != 0 && strcmp(available, "false") != 0)
+    {
+      return false;
+    }
+    query.available = strcmp(available, "true") == 0;
+    filtered = true;
+  }
+  if (const char *prefix = req.url_params.get("prefix"))
+  {
+    query.name_prefix = prefix;
+    filtered = true;
+  }
+  if (const char *after = req.url_params.get("after"))
+  {
+    // base64url of "<id>\n<name>" for the last cart of the previous page
+    size_t size = strlen(after);
+    std::string cursor = size >= 2 ? crow::utility::base64decode(after, size) : std::string();
+    size_t separator = cursor.find('\n');
+    // Cart ids are ObjectIds, 24 hex digits, which the Mongo query converts back
+    if (separator != 24 || cursor.find_first_not_of("0123456789abcdefABCDEF") < separator)
+    {
+      return false;
+    }
+    query.after_id = cursor.substr(0, separator);
+    query.after_name = cursor.substr(separator + 1);
+    filtered = true;
+  }
+  if (const char *limit = req.url_params.get("limit"))
+  {
+    char *end = nullptr;
+    long value = std::strtol(limit, &end, 10);
+    if (*limit == '\0' || *end != '\0' || value < 1 || value > 500)
+    {
+      return false;
+    }
+    query.limit = static_cast<size_t>(value);
+    filtered = true;
+  }
+  if (const char *fields = req.url_params.get("fields"))
+  {
+    query.fields = 0;
+    std::stringstream list(fields);
+    std::string field;
+    while (std::getline(list, field, ','))
+    {
+      if (field == "name") query.fields |= cart_field_name;
+      else if (field == "type") query.fields |= cart_field_type;
+      else if (field == "available") query.fields |= cart_field_available;
+      else return false;
+    }
+    filtered = true;
+  }
+  return true;
+}
+
+/**
+ * @brief {"carts": [...], "next": cursor} for a page of a /cart-info query, with only the requested fields (and the id).
+ */
+inline crow::json::wvalue cart_page_json(const cart_page &page, unsigned fields)
+{
+  crow::json::wvalue carts(crow::json::wvalue::list{});
+  int i = 0;
+  for (const auto &cart_entry : page.carts)
+  {
+    crow::json::wvalue cart;
+    cart["id"] = cart_entry.id;
+    if (fields & cart_field_name) cart["name"] = cart_entry.name;
+    if (fields & cart_field_type) cart["type"] = cart_entry.type;
+    if (fields & cart_field_available) cart["available"] = cart_entry.available;
+    carts[i++] = std::move(cart);
+  }
+
+  crow::json::wvalue result;
+  result["carts"] = std::move(carts);
+  if (page.more && !page.carts.empty())
+  {
+    std::string cursor = page.carts.back().id + '\n' + page.carts.back().name;
+    result["next"] = crow::utility::base64encode_urlsafe(cursor, cursor.size());
+  }
+  return result;
+}
+
+/**
+ * @brief Reads the uid of the logged in member from the request's jwtToken cookie (timed as the token phase).
+ *
+ * @return int 200 if uid was set, otherwise the status to answer with (401, or 500 without SECRET_KEY).
+ */
+inline int authenticate_member(cart_checkout_app &app, const crow::request &req, std::string &uid)
+{
+  char* secret_key = std::getenv("SECRET_KEY");
+  if (!secret_key)
+  {
+    CROW_LOG_ERROR << "The SECRET_KEY environment variable is not set";
+    return 500;
+  }
+
+  std::string token = app.get_context<crow::CookieParser>(req).get_cookie("jwtToken");
+  const std::string secret_key_string(secret_key);
+  crow::scoped_phase_timer timer(req, crow::timing_phase::token);
+  if (!verifyToken(token, secret_key_string, "cartapp"))
+  {
+    return 401;
+  }
+  uid = extractUidFromToken(token, secret_key_string, "cartapp");
+  return uid.empty() ? 401 : 200;
+}
+
+/**
+ * @brief Runs the rate limiter for the request's IP address (timed as the rate_limit phase).
+ *
+ * @return true if the request should be rejected with a 429.
+ */
+inline bool check_rate_limit(route_context &ctx, const crow::request &req)
+{
+  if (!ctx.rate_limiting)
+  {
+    return false;
+  }
+
+  // Ensures request IP Address is not blacklisted
+  const std::string &ip_address = req.remote_ip_address;
+  bool rate_limited;
+  {
+    crow::scoped_phase_timer timer(req, crow::timing_phase::rate_limit);
+    rate_limited = ctx.shared ? ctx.shared->rate_limited(ip_address, ctx.worker) : is_rate_limited(ctx.rate_limit_map, ip_address);
+  }
+  if (rate_limited)
+  {
+    CROW_SLOG_WARNING("rate_limited").kv("ip", ip_address).kv("url", req.url);
+  }
+  return rate_limited;
+}
+
+/**
+ * @brief The checks in front of the sequencer routes: 503 without a sequencer, 429 when rate limited, then the
+ * member's authentication (uid is set when it returns 200).
+ */
+inline int sequencer_request_status(cart_checkout_app &app, route_context &ctx, const crow::request &req, std::string &uid)
+{
+  if (!ctx.checkouts)
+  {
+    return 503;
+  }
+  if (check_rate_limit(ctx, req))
+  {
+    return 429;
+  }
+  return authenticate_member(app, req, uid);
+}
+
+/**
+ * @brief The callback for a sequencer command made by req, so no worker thread waits for the allocation thread:
+ * the result is posted back to the request's io_service, where respond turns it into res before it is sent.
+ * The wait is timed as the database phase.
+ */
+inline checkout_sequencer::result_callback respond_on_io_service(const crow::request &req, crow::response &res,
+                                                                 std::function<crow::response(const checkout_result &)> respond)
+{
+  boost::asio::io_service *io_service = req.io_service;
+  crow::request_timing *timing = req.timing;
+  std::chrono::steady_clock::time_point submitted;
+  if (timing)
+  {
+    submitted = std::chrono::steady_clock::now();
+  }
+  return [io_service, timing, submitted, &res, respond](const checkout_result &result)
+  {
+    io_service->post([timing, submitted, &res, respond, result]
+    {
+      if (timing)
+      {
+        timing->add(crow::timing_phase::database, static_cast<uint32_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - submitted).count()));
+      }
+      res = respond(result);
+      res.end();
+    });
+  };
+}
+
+/**
+ * @brief Registers the static content, authentication, cart and admin routes.
+ */
+inline void register_routes(cart_checkout_app &app, route_context &ctx)
+{
+  ctx.metrics = app.get_metrics();
+  if (ctx.metrics)
+  {
+    ctx.operations.find_user = ctx.metrics->operation("users.find_one");
+    ctx.operations.insert_user = ctx.metrics->operation("users.insert_one");
+    ctx.operations.query_carts = ctx.metrics->operation("carts.query");
+    ctx.operations.list_carts = ctx.metrics->operation("carts.find");
+    ctx.operations.insert_reservation = ctx.metrics->operation("reservations.insert_one");
+  }
+
+  CROW_ROUTE(app, "/")([](const crow::request &req, crow::response &res)
+  {
+    sendHTML(res, "index.html"); // Loads initial HTML page
+  });
+
+  CROW_ROUTE(app, "/index.html")([](const crow::request &req, crow::response &res)
+  {
+    sendHTML(res, "index.html"); // Loads initial HTML page
+  });
+
+  CROW_ROUTE(app, "/login").methods("GET"_method)([](const crow::request &req, crow::response &res)
+  {
+    sendHTML(res, "index.html");
+  });
+
+  CROW_ROUTE(app, "/register").methods("GET"_method)([](const crow::request &req, crow::response &res)
+  {
+    sendHTML(res, "index.html");
+  });
+
+  CROW_ROUTE(app, "/checkout").methods("GET"_method)([](const crow::request &req, crow::response &res)
+  {
+    sendHTML(res, "index.html");
+  });
+
+  CROW_ROUTE(app, "/manifest.json")([](const crow::request &req, crow::response &res)
+  {
+    sendJSON(res, "manifest.json"); // Loads manifest file
+  });
+
+  CROW_ROUTE(app, "/favicon.ico")([](const crow::request &req, crow::response &res)
+  {
+    sendImage(res, "favicon.ico"); // Loads favicon
+  });
+
+  CROW_ROUTE(app, "/asset-manifest.json")([](const crow::request &req, crow::response &res)
+  {
+    sendJSON(res, "asset-manifest.json"); // Loads asset manifest
+  });
+
+  CROW_ROUTE(app, "/static/css/<string>")([](const crow::request &req, crow::response &res, std::string fileName)
+  {
+    sendStyle(res, fileName); // Deals with any CSS
+  });
+
+  CROW_ROUTE(app, "/static/js/<string>")([](const crow::request &req, crow::response &res, std::string fileName)
+  {
+    sendScript(res, fileName); // Loads javascript dependencies
+  });
+
+  CROW_ROUTE(app, "/static/media/<string>")([](const crow::request &req, crow::response &res, std::string fileName)
+  {
+    sendImage(res, fileName); // Deals with any images we might use
+  });
+
+  CROW_ROUTE(app, "/assets/<string>")([](const crow::request &req, crow::response &res, std::string fileName)
+  {
+    if(fileName.find(".js") != std::string::npos)
+    {
+      sendScript(res, fileName);
+    }
+    else if (fileName.find(".css") != std::string::npos)
+    {
+      sendStyle(res, fileName);
+    }
+    else if (fileName.find(".png") != std::string::npos)
+    {
+      sendImage(res, fileName);
+    }
+    else if (fileName.find(".svg") != std::string::npos)
+    {
+      sendSVG(res, fileName);
+    }
+    else
+    {
+      CROW_SLOG_WARNING("asset_not_served").kv("file", fileName);
+    }
+  });
+
+  CROW_ROUTE(app, "/<string>")([](const crow::request &req, crow::response &res, std::string path)
+  {
+    CROW_SLOG_INFO("unmatched_route").kv("path", path);
+    res.code = 404;
+    res.write("<html><body><h1>404 Not Found</h1></body></html>");
+    res.end();
+  });
+
+  CROW_ROUTE(app, "/verify-token").methods("POST"_method)([&app, &ctx](const crow::request &req)
+  {
+
+    // Check for secret key on the server environment
+    char* secret_key = std::getenv("SECRET_KEY");
+    if (!secret_key)
+    {
+      CROW_LOG_ERROR << "The SECRET_KEY environment variable is not set";
+      return crow::response(500);
+    }
+
+    // Get token from cookies and verify it using the secret key
+    auto& cookies = app.get_context<crow::CookieParser>(req);
+    std::string token = cookies.get_cookie("jwtToken");
+    CROW_SLOG_DEBUG("verify_token").kv("token_length", token.length());
+    const std::string secret_key_string(secret_key);
+    std::string email, uid;
+    {
+      crow::scoped_phase_timer timer(req, crow::timing_phase::token);
+      bool isValidToken = verifyToken(token , secret_key_string, "cartapp");
+      if(!isValidToken)
+      {
+        CROW_SLOG_INFO("verify_token_failed").kv("reason", "invalid token");
+        return crow::response(401);
+      }
+
+      // Get the associated email address and uid
+      email = extractEmailFromToken(token, secret_key_string, "cartapp");
+      uid = extractUidFromToken(token, secret_key_string, "cartapp");
+    }
+    if(email.length() <= 0)
+    {
+      CROW_SLOG_INFO("verify_token_failed").kv("reason", "no email");
+      return crow::response(401);
+    }
+    if(uid.length() <= 0)
+    {
+      CROW_SLOG_INFO("verify_token_failed").kv("reason", "no uid");
+      return crow::response(401);
+    }
+
+    // Find the user which has the provided email address and uid
+    std::string name = "";
+    user_lookup lookup;
+    if (!ctx.known_emails || ctx.known_emails->might_exist(email))
+    {
+      crow::scoped_phase_timer timer(req, crow::timing_phase::database);
+      bool coalesced = false;
+      lookup = ctx.user_reads.run(uid + '\n' + email, [&ctx, &req, &uid, &email]
+      {
+        user_lookup result;
+        crow::scoped_operation_timer operation(ctx.metrics, ctx.operations.find_user);
+        CROW_USDT_PROBE2(cart_checkout, db_start, req.route_id, "users.find_one");
+        result.found = ctx.store.find_user(uid, email, result.user);
+        CROW_USDT_PROBE2(cart_checkout, db_end, req.route_id, "users.find_one");
+        return result;
+      }, &coalesced);
+      CROW_SLOG_DEBUG("verify_token").kv("coalesced", coalesced);
+    }
+    const user_record &user = lookup.user;
+    if (lookup.found)
+    {
+      if (!user.name.empty())
+      {
+        name = user.name;
+        CROW_SLOG_DEBUG("verify_token").kv("name", name);
+      }
+      else
+      {
+        CROW_SLOG_WARNING("verify_token").kv("reason", "name field is missing or not a string").kv("uid", uid);
+      }
+    }
+    else
+    {
+      CROW_SLOG_INFO("verify_token").kv("reason", "no matching user").kv("uid", uid);
+    }
+
+    crow::json::wvalue resJSON;
+    resJSON["email"] = email;
+    resJSON["uid"] = uid;
+    resJSON["name"] = name;
+    resJSON["verificationSuccess"] = true;
+
+    crow::scoped_phase_timer timer(req, crow::timing_phase::serialization);
+    return crow::response(200, resJSON);
+  });
+
+  CROW_ROUTE(app, "/login").methods("POST"_method)([&app, &ctx](const crow::request &req)
+  {
+
+    // Ensure the database is reachable
+    if(!ctx.store.available())
+    {
+      CROW_SLOG_ERROR("login").kv("reason", "database unavailable");
+      return crow::response(503);
+    }
+
+    // Ensure request body is valid
+    crow::json::rvalue body = crow::json::load(req.body);
+    if(!body)
+    {
+      CROW_SLOG_INFO("login").kv("reason", "invalid request body");
+      return crow::response(400);
+    }
+
+    if (check_rate_limit(ctx, req))
+    {
+      return crow::response(429);
+    }
+
+    // Check for secret key on the server environment
+    char* secret_key = std::getenv("SECRET_KEY");
+    char* secret_key_pepper = std::getenv("SECRET_KEY_PEPPER");
+    if (!secret_key || !secret_key_pepper)
+    {
+      CROW_LOG_ERROR << "The SECRET_KEY environment variable is not set";
+      return crow::response(500);
+    }
+
+    crow::json::wvalue resJSON;
+    std::string returned_token = "";
+
+    // Ensure both email and password request params have been provided
+    if(body.has("email") && body.has("password"))
+    {
+      std::string email = body["email"].s();
+      boost::trim(email);
+      app.get_middleware<abuse_guard>().record_email(email);
+      std::string password = body["password"].s();
+      user_record user;
+      bool user_found = false;
+      bool filtered = ctx.known_emails && !ctx.known_emails->might_exist(email);
+      if (!filtered)
+      {
+        crow::scoped_phase_timer timer(req, crow::timing_phase::database);
+        crow::scoped_operation_timer operation(ctx.metrics, ctx.operations.find_user);
+        CROW_USDT_PROBE2(cart_checkout, db_start, req.route_id, "users.find_one");
+        user_found = ctx.store.find_user_by_email(email, user);
+        CROW_USDT_PROBE2(cart_checkout, db_end, req.route_id, "users.find_one");
+      }
+
+      // Ensure that a user with the provided email exists in the database
+      if(user_found)
+      {
+        std::string pepper(secret_key_pepper);
+
+        // Ensure provided password matches the email
+        bool password_valid;
+        {
+          crow::scoped_phase_timer timer(req, crow::timing_phase::password_hash);
+          password_valid = BCrypt::validatePassword((password + pepper), user.password_hash);
+        }
+        if(password_valid)
+        {
+          CROW_SLOG_INFO("login").kv("email", email_log_tag(email)).kv("success", true);
+
+          // Create JWT token so user can remain logged in for certain amount of time
+          std::string secret_key_string(secret_key);
+          crow::scoped_phase_timer timer(req, crow::timing_phase::token);
+          auto token = jwt::create()
+            .set_issuer("cartapp")
+            .set_type("JWS")
+            .set_payload_claim("email", jwt::claim(email))
+            .set_payload_claim("uid", jwt::claim(user.id))
+            .set_issued_at(std::chrono::system_clock::now())
+            .set_expires_at(std::chrono::system_clock::now() + std::chrono::seconds{60*60*24*7})
+            .sign(jwt::algorithm::hs256{secret_key_string});
+
+          returned_token = token;
+          resJSON["resString"] = "Logged in";
+          resJSON["loginSuccess"] = true;
+        }
+        else
+        {
+          CROW_SLOG_INFO("login").kv("email", email_log_tag(email)).kv("success", false).kv("reason", "incorrect password");
+          resJSON["loginSuccess"] = false;
+          resJSON["resString"] = "Incorrect password";
+        }
+      }
+      else
+      {
+        CROW_SLOG_INFO("login").kv("email", email_log_tag(email)).kv("success", false).kv("reason", "user does not exist").kv("filtered", filtered);
+        resJSON["loginSuccess"] = false;
+        resJSON["resString"] = "Email not found";
+      }
+    }
+    else
+    {
+      CROW_SLOG_INFO("login").kv("reason", "missing request params");
+      resJSON["loginSuccess"] = false;
+      resJSON["resString"] = "Unable to log into account, make sure all info is filled in";
+    }
+
+    // return JSON response along with the JWT token as a cookie
+    crow::scoped_phase_timer timer(req, crow::timing_phase::serialization);
+    crow::response res = crow::response(200, resJSON);
+    std::string cookie_settings = "; HttpOnly; Secure; SameSite=Strict";
+    std::string cookie_settings_temp = "; HttpOnly; SameSite=Strict";
+    res.set_header("Set-Cookie", "jwtToken=" + returned_token + cookie_settings_temp);
+    return res;
+  });
+
+  CROW_ROUTE(app, "/register").methods("POST"_method)([&app, &ctx](const crow::request &req)
+  {
+
+    // Ensure the database is reachable
+    if(!ctx.store.available())
+    {
+      CROW_SLOG_ERROR("register").kv("reason", "database unavailable");
+      return crow::response(503);
+    }
+
+    // Ensure request body is valid
+    crow::json::rvalue body = crow::json::load(req.body);
+    if(!body)
+    {
+      CROW_SLOG_INFO("register").kv("reason", "invalid request body");
+      return crow::response(400);
+    }
+
+    if (check_rate_limit(ctx, req))
+    {
+      return crow::response(429);
+    }
+
+    // Ensure secret key is valid and available on server
+    char* secret_key = std::getenv("SECRET_KEY");
+    char* secret_key_pepper = std::getenv("SECRET_KEY_PEPPER");
+    if(!secret_key || !secret_key_pepper)
+    {
+      CROW_LOG_ERROR << "The SECRET_KEY environment variable is not set";
+      return crow::response(500);
+    }
+
+    crow::json::wvalue resJSON;
+    std::string returned_token = "";
+
+    // Ensure both email and password params are valid and/or were provided by user
+    if(body.has("email") && body.has("password") && body.has("name"))
+    {
+      std::string email = body["email"].s();
+      std::string password = body["password"].s();
+      std::string name = body["name"].s();
+      boost::trim(email); boost::trim(name);
+      app.get_middleware<abuse_guard>().record_email(email);
+      std::string secret_key_string(secret_key);
+
+      // One insert: the unique email index rejects an email that is already registered, even by a concurrent request
+      std::string pepper(secret_key_pepper);
+      user_record user;
+      user.email = email;
+      user.name = name;
+      {
+        crow::scoped_phase_timer timer(req, crow::timing_phase::password_hash);
+        user.password_hash = BCrypt::generateHash((password + pepper));
+      }
+      std::string uid;
+      insert_status inserted;
+      {
+        crow::scoped_phase_timer timer(req, crow::timing_phase::database);
+        crow::scoped_operation_timer operation(ctx.metrics, ctx.operations.insert_user);
+        CROW_USDT_PROBE2(cart_checkout, db_start, req.route_id, "users.insert_one");
+        inserted = ctx.store.insert_user(user, uid);
+        CROW_USDT_PROBE2(cart_checkout, db_end, req.route_id, "users.insert_one");
+      }
+      if (ctx.known_emails && inserted != insert_status::failed)
+      {
+        ctx.known_emails->add(email);
+      }
+      if (inserted == insert_status::failed)
+      {
+        CROW_SLOG_ERROR("register").kv("email", email_log_tag(email)).kv("success", false).kv("reason", "insert failed");
+        return crow::response(500);
+      }
+      if (inserted == insert_status::duplicate)
+      {
+        CROW_SLOG_INFO("register").kv("email", email_log_tag(email)).kv("success", false).kv("reason", "user already exists");
+        resJSON["resString"] = "An account already exists with this email!";
+        resJSON["registerSuccess"] = false;
+      }
+      else
+      {
+        CROW_SLOG_INFO("register").kv("email", email_log_tag(email)).kv("success", true);
+
+        // Create token so user can remain logged in for a certain amount of time
+        crow::scoped_phase_timer timer(req, crow::timing_phase::token);
+        auto token = jwt::create()
+          .set_issuer("cartapp")
+          .set_type("JWS")
+          .set_payload_claim("email", jwt::claim(email))
+          .set_payload_claim("uid", jwt::claim(uid))
+          .set_issued_at(std::chrono::system_clock::now())
+          .set_expires_at(std::chrono::system_clock::now() + std::chrono::seconds{60*60*24*7})
+          .sign(jwt::algorithm::hs256{secret_key_string});
+
+        returned_token = token;
+        resJSON["registerSuccess"] = true;
+        resJSON["resString"] = "Registered successfully";
+      }
+    }
+    else
+    {
+      CROW_SLOG_INFO("register").kv("reason", "missing request params");
+      resJSON["resString"] = "Unable to register, make sure both email and password are provided";
+      resJSON["registerSuccess"] = false;
+    }
+
+    // return JSON response along with the JWT token as a cookie
+    crow::scoped_phase_timer timer(req, crow::timing_phase::serialization);
+    crow::response res = crow::response(200, resJSON);
+    std::string cookie_settings = "; HttpOnly; Secure; SameSite=Strict";
+    std::string cookie_settings_temp = "; HttpOnly; SameSite=Strict";
+    res.set_header("Set-Cookie", "jwtToken=" + returned_token + cookie_settings_temp);
+    return res;
+  });
+
+  CROW_ROUTE(app, "/logout").methods("POST"_method)([](const crow::request &req)
+  {
+    crow::response res = crow::response(200);
+    std::string cookie_settings = "jwtToken=; HttpOnly; Secure; SameSite=Strict; Expires=Thu, 01 Jan 1970 00:00:00 GMT";
+    std::string cookie_settings_temp = "jwtToken=; HttpOnly; SameSite=Strict; Expires=Thu, 01 Jan 1970 00:00:00 GMT";
+    res.set_header("Set-Cookie", cookie_settings_temp);
+    return res;
+  });
+
+  // The fleet as an array. With {"since": v}, where v is the X-Inventory-Version of an earlier answer: 304 if nothing
+  // changed, else {"version", "full", "carts"} with only the carts changed since v (all of them if v is too old or
+  // from before a restart)
+  CROW_ROUTE(app, "/cart-info").methods("POST"_method)([&ctx](const crow::request &req)
+  {
+    // Filtered, paginated and projected: /cart-info?type=2&available=true&prefix=Cart&limit=20&fields=name
+    cart_query query;
+    bool filtered = false;
+    if (!parse_cart_query(req, query, filtered))
+    {
+      return crow::response(400);
+    }
+    if (filtered)
+    {
+      if (!ctx.inventory && !ctx.store.available())
+      {
+        CROW_SLOG_ERROR("cart_info").kv("reason", "database unavailable");
+        return crow::response(503);
+      }
+      if (check_rate_limit(ctx, req))
+      {
+        return crow::response(429);
+      }
+
+      cart_page page;
+      std::string version;
+      if (ctx.inventory)
+      {
+        page = ctx.inventory->query(query, &version);
+      }
+      else
+      {
+        crow::scoped_phase_timer timer(req, crow::timing_phase::database);
+        crow::scoped_operation_timer operation(ctx.metrics, ctx.operations.query_carts);
+        CROW_USDT_PROBE2(cart_checkout, db_start, req.route_id, "carts.query");
+        page = ctx.store.query_carts(query);
+        CROW_USDT_PROBE2(cart_checkout, db_end, req.route_id, "carts.query");
+      }
+
+      crow::scoped_phase_timer timer(req, crow::timing_phase::serialization);
+      crow::json::wvalue result = cart_page_json(page, query.fields);
+      crow::response res(200, result);
+      if (ctx.inventory)
+      {
+        res.set_header("X-Inventory-Version", version);
+      }
+      CROW_SLOG_DEBUG("cart_info").kv("query_results", page.carts.size()).kv("more", page.more);
+      return res;
+    }
+
+    if (ctx.inventory)
+    {
+      if (check_rate_limit(ctx, req))
+      {
+        return crow::response(429);
+      }
+
+      auto body = crow::json::load(req.body);
+      crow::scoped_phase_timer timer(req, crow::timing_phase::serialization);
+      crow::response res(200);
+      if (body && body.has("since") && body["since"].t() == crow::json::type::String)
+      {
+        std::string since = body["since"].s();
+        cart_inventory::sync_result sync = ctx.inventory->since(since);
+        if (sync.kind == cart_inventory::sync_kind::unchanged)
+        {
+          res.code = 304;
+        }
+        res.body = std::move(sync.body);
+        res.set_header("X-Inventory-Version", sync.version);
+        CROW_SLOG_DEBUG("cart_info").kv("since", since).kv("sync", static_cast<int>(sync.kind));
+      }
+      else
+      {
+        std::string version;
+        res.body = *ctx.inventory->snapshot(&version);
+        res.set_header("X-Inventory-Version", version);
+      }
+      if (res.code == 200)
+      {
+        res.set_header("Content-Type", "application/json");
+      }
+      return res;
+    }
+
+    // Ensure the database is reachable
+    if(!ctx.store.available())
+    {
+      CROW_SLOG_ERROR("cart_info").kv("reason", "database unavailable");
+      return crow::response(503);
+    }
+
+    if (check_rate_limit(ctx, req))
+    {
+      return crow::response(429);
+    }
+
+    std::vector<cart_record> cart_list;
+    {
+      crow::scoped_phase_timer timer(req, crow::timing_phase::database);
+      bool coalesced = false;
+      cart_list = ctx.cart_list_reads.run(0, [&ctx, &req]
+      {
+        crow::scoped_operation_timer operation(ctx.metrics, ctx.operations.list_carts);
+        CROW_USDT_PROBE2(cart_checkout, db_start, req.route_id, "carts.find");
+        std::vector<cart_record> carts = ctx.store.list_carts();
+        CROW_USDT_PROBE2(cart_checkout, db_end, req.route_id, "carts.find");
+        return carts;
+      }, &coalesced);
+      CROW_SLOG_DEBUG("cart_info").kv("coalesced", coalesced);
+    }
+
+    crow::scoped_phase_timer timer(req, crow::timing_phase::serialization);
+    crow::json::wvalue carts;
+    int i = 0;
+    for (const auto &cart_entry : cart_list)
+    {
+      crow::json::wvalue cart;
+      cart["id"] = cart_entry.id;
+      cart["name"] = cart_entry.name;
+      cart["type"] = cart_entry.type;
+      cart["available"] = cart_entry.available;
+      carts[i++] = std::move(cart);
+    }
+
+    return crow::response(200, carts);
+  });
+
+  CROW_ROUTE(app, "/cart-availability").methods("POST"_method)([&ctx](const crow::request &req)
+  {
+    if (!ctx.reservations)
+    {
+      return crow::response(503);
+    }
+
+    // {"date": "2026-10-19", "start": "09:10", "end": "13:30", "type": 4, "duration": 90}
+    // Without a duration the carts free for the whole window are returned, with one the earliest window of that many minutes
+    auto body = crow::json::load(req.body);
+    int day = 0;
+    if (!body || !body.has("date") || !body.has("start") || !body.has("end") || !reservation_engine::parse_day(body["date"].s(), day) ||
+        !reservation_engine::bookable_day(day))
+    {
+      return crow::response(400);
+    }
+    int first_slot = reservation_engine::parse_slot(body["start"].s());
+    int end_slot = reservation_engine::parse_slot(body["end"].s(), true);
+    int type = body.has("type") ? static_cast<int>(body["type"].i()) : -1;
+    if (first_slot < 0 || end_slot <= first_slot)
+    {
+      return crow::response(400);
+    }
+
+    std::vector<cart_record> free_carts;
+    int window_start = first_slot;
+    int window_slots = end_slot - first_slot;
+    {
+      crow::scoped_phase_timer timer(req, crow::timing_phase::database);
+      if (body.has("duration"))
+      {
+        int duration_minutes = static_cast<int>(body["duration"].i());
+        window_slots = (duration_minutes + reservation_engine::slot_minutes - 1) / reservation_engine::slot_minutes;
+        if (window_slots <= 0)
+        {
+          return crow::response(400);
+        }
+        window_start = ctx.reservations->find_earliest_window(day, first_slot, end_slot, window_slots, type, free_carts);
+      }
+      else
+      {
+        free_carts = ctx.reservations->find_free(day, first_slot, window_slots, type);
+      }
+    }
+
+    crow::scoped_phase_timer timer(req, crow::timing_phase::serialization);
+    crow::json::wvalue resJSON;
+    crow::json::wvalue carts(crow::json::wvalue::list{});
+    int i = 0;
+    for (const auto &cart_entry : free_carts)
+    {
+      carts[i]["id"] = cart_entry.id;
+      carts[i]["name"] = cart_entry.name;
+      carts[i]["type"] = cart_entry.type;
+      i++;
+    }
+    resJSON["carts"] = std::move(carts);
+    if (!free_carts.empty())
+    {
+      resJSON["start"] = format_slot(window_start);
+      resJSON["end"] = format_slot(window_start + window_slots);
+    }
+    return crow::response(200, resJSON);
+  });
+
+  CROW_ROUTE(app, "/reserve").methods("POST"_method)([&app, &ctx](const crow::request &req)
+  {
+    if (!ctx.reservations)
+    {
+      return crow::response(503);
+    }
+
+    if (check_rate_limit(ctx, req))
+    {
+      return crow::response(429);
+    }
+
+    // Only logged in members can book; the booking is recorded against their uid
+    std::string uid;
+    int auth_status = authenticate_member(app, req, uid);
+    if (auth_status != 200)
+    {
+      return crow::response(auth_status);
+    }
+
+    // {"cart_id": "...", "date": "2026-10-19", "start": "09:10", "end": "13:30"}
+    auto body = crow::json::load(req.body);
+    int day = 0;
+    if (!body || !body.has("cart_id") || !body.has("date") || !body.has("start") || !body.has("end") || !reservation_engine::parse_day(body["date"].s(), day) ||
+        !reservation_engine::bookable_day(day))
+    {
+      return crow::response(400);
+    }
+    int first_slot = reservation_engine::parse_slot(body["start"].s());
+    int end_slot = reservation_engine::parse_slot(body["end"].s(), true);
+    if (first_slot < 0 || end_slot <= first_slot)
+    {
+      return crow::response(400);
+    }
+
+    std::string reservation_id;
+    reservation_engine::booking_status status;
+    {
+      crow::scoped_phase_timer timer(req, crow::timing_phase::database);
+      crow::scoped_operation_timer operation(ctx.metrics, ctx.operations.insert_reservation);
+      CROW_USDT_PROBE2(cart_checkout, db_start, req.route_id, "reservations.insert_one");
+      status = ctx.reservations->book(body["cart_id"].s(), uid, day, first_slot, end_slot - first_slot, &reservation_id);
+      CROW_USDT_PROBE2(cart_checkout, db_end, req.route_id, "reservations.insert_one");
+    }
+
+    switch (status)
+    {
+      case reservation_engine::booking_status::booked:
+      {
+        CROW_SLOG_INFO("reserve").kv("uid", uid).kv("reservation", reservation_id);
+        if (ctx.cart_feed)
+        {
+          ctx.cart_feed->publish_booking(body["cart_id"].s(), body["date"].s(), format_slot(first_slot), format_slot(end_slot));
+        }
+        crow::json::wvalue resJSON;
+        resJSON["reservationId"] = reservation_id;
+        resJSON["start"] = format_slot(first_slot);
+        resJSON["end"] = format_slot(end_slot);
+        return crow::response(201, resJSON);
+      }
+      case reservation_engine::booking_status::conflict:
+        return crow::response(409);
+      case reservation_engine::booking_status::invalid:
+        return crow::response(400);
+      default:
+        CROW_SLOG_ERROR("reserve").kv("reason", "reservation could not be stored").kv("uid", uid);
+        return crow::response(500);
+    }
+  });
+
+  // {"cart_id": "..."} checks out that cart, {"type": 4} the first free cart of that type
+  CROW_ROUTE(app, "/checkout").methods("POST"_method)([&app, &ctx](const crow::request &req, crow::response &res)
+  {
+    std::string uid;
+    int status = sequencer_request_status(app, ctx, req, uid);
+    auto body = crow::json::load(req.body);
+    if (status == 200 && (!body || (!body.has("cart_id") && !body.has("type"))))
+    {
+      status = 400;
+    }
+    if (status != 200)
+    {
+      res.code = status;
+      res.end();
+      return;
+    }
+    std::string cart_id = body.has("cart_id") ? std::string(body["cart_id"].s()) : "";
+    int type = body.has("type") ? static_cast<int>(body["type"].i()) : -1;
+
+    ctx.checkouts->checkout(cart_id, type, uid, respond_on_io_service(req, res, [uid](const checkout_result &result)
+    {
+      switch (result.status)
+      {
+        case checkout_status::ok:
+        {
+          CROW_SLOG_INFO("checkout").kv("uid", uid).kv("cart", result.cart.id);
+          crow::json::wvalue resJSON;
+          resJSON["id"] = result.cart.id;
+          resJSON["name"] = result.cart.name;
+          resJSON["type"] = result.cart.type;
+          return crow::response(200, resJSON);
+        }
+        case checkout_status::unavailable:
+          return crow::response(409);
+        case checkout_status::unknown_cart:
+          return crow::response(404);
+        default:
+          CROW_SLOG_ERROR("checkout").kv("reason", "checkout could not be stored").kv("uid", uid);
+          return crow::response(500);
+      }
+    }));
+  });
+
+  // {"cart_id": "..."} or {"type": 4}, optionally {"seconds": 60}: holds a cart until confirmed, released or expired
+  CROW_ROUTE(app, "/hold").methods("POST"_method)([&app, &ctx](const crow::request &req, crow::response &res)
+  {
+    std::string uid;
+    int status = sequencer_request_status(app, ctx, req, uid);
+    auto body = crow::json::load(req.body);
+    if (status == 200 && (!body || (!body.has("cart_id") && !body.has("type"))))
+    {
+      status = 400;
+    }
+    std::chrono::seconds hold_for = ctx.hold_duration;
+    if (status == 200 && body.has("seconds"))
+    {
+      int64_t seconds = body["seconds"].i();
+      if (seconds <= 0)
+      {
+        status = 400;
+      }
+      hold_for = std::min(hold_for, std::chrono::seconds(seconds));
+    }
+    if (status != 200)
+    {
+      res.code = status;
+      res.end();
+      return;
+    }
+    std::string cart_id = body.has("cart_id") ? std::string(body["cart_id"].s()) : "";
+    int type = body.has("type") ? static_cast<int>(body["type"].i()) : -1;
+
+    ctx.checkouts->hold(cart_id, type, uid, hold_for, respond_on_io_service(req, res, [uid, hold_for](const checkout_result &result)
+    {
+      switch (result.status)
+      {
+        case checkout_status::ok:
+        {
+          CROW_SLOG_INFO("hold").kv("uid", uid).kv("cart", result.cart.id).kv("seconds", static_cast<int64_t>(hold_for.count()));
+          crow::json::wvalue resJSON;
+          resJSON["id"] = result.cart.id;
+          resJSON["name"] = result.cart.name;
+          resJSON["type"] = result.cart.type;
+          resJSON["holdId"] = result.hold_id;
+          resJSON["expiresIn"] = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(result.hold_for).count());
+          return crow::response(200, resJSON);
+        }
+        case checkout_status::unavailable:
+          return crow::response(409);
+        case checkout_status::unknown_cart:
+          return crow::response(404);
+        default:
+          return crow::response(500);
+      }
+    }));
+  });
+
+  // {"cart_id": "..."}: checks out a cart the member holds; 409 once the hold has expired
+  CROW_ROUTE(app, "/confirm").methods("POST"_method)([&app, &ctx](const crow::request &req, crow::response &res)
+  {
+    std::string uid;
+    int status = sequencer_request_status(app, ctx, req, uid);
+    auto body = crow::json::load(req.body);
+    if (status == 200 && (!body || !body.has("cart_id")))
+    {
+      status = 400;
+    }
+    if (status != 200)
+    {
+      res.code = status;
+      res.end();
+      return;
+    }
+
+    ctx.checkouts->confirm(body["cart_id"].s(), uid, respond_on_io_service(req, res, [uid](const checkout_result &result)
+    {
+      switch (result.status)
+      {
+        case checkout_status::ok:
+        {
+          CROW_SLOG_INFO("confirm").kv("uid", uid).kv("cart", result.cart.id);
+          crow::json::wvalue resJSON;
+          resJSON["id"] = result.cart.id;
+          resJSON["name"] = result.cart.name;
+          resJSON["type"] = result.cart.type;
+          return crow::response(200, resJSON);
+        }
+        case checkout_status::not_holder:
+          return crow::response(409);
+        case checkout_status::unknown_cart:
+          return crow::response(404);
+        default:
+          CROW_SLOG_ERROR("confirm").kv("reason", "checkout could not be stored").kv("uid", uid);
+          return crow::response(500);
+      }
+    }));
+  });
+
+  // {"cart_id": "..."}: gives back a checked out or held cart (/release is the same route)
+  auto return_cart = [&app, &ctx](const crow::request &req, crow::response &res)
+  {
+    std::string uid;
+    int status = sequencer_request_status(app, ctx, req, uid);
+    auto body = crow::json::load(req.body);
+    if (status == 200 && (!body || !body.has("cart_id")))
+    {
+      status = 400;
+    }
+    if (status != 200)
+    {
+      res.code = status;
+      res.end();
+      return;
+    }
+
+    ctx.checkouts->release(body["cart_id"].s(), uid, respond_on_io_service(req, res, [uid](const checkout_result &result)
+    {
+      switch (result.status)
+      {
+        case checkout_status::ok:
+          CROW_SLOG_INFO("return").kv("uid", uid).kv("cart", result.cart.id);
+          return crow::response(200);
+        case checkout_status::not_holder:
+          return crow::response(409);
+        case checkout_status::unknown_cart:
+          return crow::response(404);
+        default:
+          CROW_SLOG_ERROR("return").kv("reason", "return could not be stored").kv("uid", uid);
+          return crow::response(500);
+      }
+    }));
+  };
+  CROW_ROUTE(app, "/return").methods("POST"_method)(return_cart);
+  CROW_ROUTE(app, "/release").methods("POST"_method)(return_cart);
+
+  // Snapshot of the fleet on connect, then a delta whenever carts are checked out, held or returned
+  CROW_ROUTE(app, "/ws/carts")
+    .websocket()
+    .onaccept([&app, &ctx](const crow::request &req)
+    {
+      // Upgrades skip the middlewares, so blocked clients are refused here
+      return ctx.cart_feed != nullptr && !app.get_middleware<abuse_guard>().blocked(req.remote_ip_address);
+    })
+    .onopen([&ctx](crow::websocket::connection &conn)
+    {
+      ctx.cart_feed->subscribe(conn);
+    })
+    .onclose([&ctx](crow::websocket::connection &conn, const std::string &reason)
+    {
+      ctx.cart_feed->unsubscribe(conn);
+    });
+
+  // The same feed as server-sent events, for clients behind proxies that break websockets; resumes from Last-Event-ID
+  CROW_ROUTE(app, "/events")
+    .event_stream()
+    .heartbeat(std::chrono::seconds(15))
+    .onaccept([&app, &ctx](const crow::request &req)
+    {
+      // Upgrades skip the middlewares, so blocked clients are refused here
+      return ctx.cart_feed != nullptr && !app.get_middleware<abuse_guard>().blocked(req.remote_ip_address);
+    })
+    .onopen([&ctx](crow::event_stream::connection &conn)
+    {
+      ctx.cart_feed->subscribe(conn);
+    })
+    .onclose([&ctx](crow::event_stream::connection &conn)
+    {
+      ctx.cart_feed->unsubscribe(conn);
+    });
+
+  // This process's metrics, then the counters of every process on the host
+  CROW_ROUTE(app, "/metrics").methods("GET"_method)([&app, &ctx](const crow::request &req)
+  {
+    std::string metrics = app.metrics_text();
+    if (ctx.shared)
+    {
+      metrics += ctx.shared->metrics_text();
+    }
+    crow::response res(200, metrics);
+    res.set_header("Content-Type", "text/plain; version=0.0.4");
+    return res;
+  });
+
+  CROW_ROUTE(app, "/user-info").methods("POST"_method)([](const crow::request& req)
+  {
+    return crow::response(200);
+  });
+
+  // The IPs and emails with the most requests over the last window, and the IPs blocked for crossing the threshold
+  CROW_ROUTE(app, "/debug/heavy-hitters").methods("GET"_method)([&app](const crow::request &req)
+  {
+    if (!is_admin_request(req))
+    {
+      CROW_SLOG_WARNING("heavy_hitters_denied").kv("ip", req.remote_ip_address);
+      return crow::response(403);
+    }
+    crow::json::wvalue report = app.get_middleware<abuse_guard>().report();
+    return crow::response(200, report);
+  });
+
+  // Sampling CPU profiler returning folded stacks for flame graphs
+  CROW_ROUTE(app, "/debug/profile").methods("GET"_method)([&ctx](const crow::request &req, crow::response &res)
+  {
+    if (!ctx.profiler_enabled)
+    {
+      res.code = 404;
+      res.end();
+      return;
+    }
+    if (!is_admin_request(req))
+    {
+      CROW_SLOG_WARNING("profile_denied").kv("ip", req.remote_ip_address);
+      res.code = 403;
+      res.end();
+      return;
+    }
+
+    unsigned seconds = 10;
+    unsigned frequency = 99;
+    if (req.url_params.get("seconds"))
+    {
+      seconds = static_cast<unsigned>(std::strtoul(req.url_params.get("seconds"), nullptr, 10));
+    }
+    if (req.url_params.get("hz"))
+    {
+      frequency = static_cast<unsigned>(std::strtoul(req.url_params.get("hz"), nullptr, 10));
+    }
+    CROW_SLOG_INFO("profile_started").kv("ip", req.remote_ip_address).kv("seconds", seconds).kv("hz", frequency);
+
+    // Profile on a separate thread so this worker keeps serving (and being sampled) meanwhile
+    boost::asio::io_service* io_service = req.io_service;
+    std::thread([io_service, &res, seconds, frequency]
+    {
+      std::string folded;
+      bool profiled = crow::sampling_profiler::instance().profile(seconds, frequency, folded);
+      io_service->post([&res, profiled, folded]
+      {
+        if (!profiled)
+        {
+          res.code = 409;
+          res.write("A profile is already running");
+        }
+        else
+        {
+          res.set_header("Content-Type", "text/plain");
+          res.write(folded);
+        }
+        res.end();
+      });
+    }).detach();
+  });
+}
+
+#endif
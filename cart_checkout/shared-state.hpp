@@ -0,0 +1,255 @@
+#ifndef SHARED_STATE_HPP
+#define SHARED_STATE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <crow.h>
+
+#include "abuse-guard.hpp"
+#include "email-filter.hpp"
+#include "shared-table.hpp"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared_state needs lock-free 64-bit atomics to share them between processes");
+
+/**
+ * @brief State shared by every process of the server on a host: the rate limit buckets, keyed by IP address,
+ * request counters per process, the registered email filter, the abuse guard's counts and blocks, and the Crow
+ * metrics. Lives in one anonymous shared mapping, made before the processes are forked.
+ *
+ * Only lock-free atomics are used, as a process dying while holding a lock would leave it held for the others.
+ * The buckets are a shared_table, a bucket whose window is over being taken over by another address if needed.
+ */
+class shared_state
+{
+public:
+  enum : unsigned
+  {
+    max_workers = 64,
+    max_routes = 64 // routes the shared Crow metrics have room for
+  };
+
+  /**
+   * @brief Maps a zeroed shared_state, followed by memory for the Crow metrics, or returns nullptr if the mapping fails.
+   */
+  static shared_state *create()
+  {
+    size_t metrics_size = crow::metrics_registry::shared_size(max_routes);
+    void *memory = mmap(nullptr, metrics_offset() + metrics_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+      return nullptr;
+    }
+    shared_state *state = new (memory) shared_state();
+    state->metrics_size_ = metrics_size;
+    return state;
+  }
+
+  /**
+   * @brief Memory for crow::metrics_registry::share, so every process records into the same metrics.
+   */
+  void *metrics_memory()
+  {
+    return reinterpret_cast<char *>(this) + metrics_offset();
+  }
+
+  size_t metrics_memory_size() const
+  {
+    return metrics_size_;
+  }
+
+  /**
+   * @brief Records the process running as the given worker.
+   */
+  void attach(unsigned worker)
+  {
+    workers_[worker].pid.store(getpid(), std::memory_order_relaxed);
+  }
+
+  void count_request(unsigned worker)
+  {
+    workers_[worker].requests.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Counts a request from ip_address against the host-wide limit of limit requests per window, the window
+   * starting at the address's first request (the rules of is_rate_limited, for every process at once).
+   *
+   * @return true if the request should be rejected. Requests are let through if the table has no room for the address.
+   */
+  bool rate_limited(const std::string &ip_address, unsigned worker, uint32_t limit = 10, uint32_t window_seconds = 60)
+  {
+    uint64_t hash = bucket_table::hash_key(ip_address);
+    uint64_t check = (hash >> 48) & 0xff;
+    uint32_t now = now_seconds();
+
+    // A bucket being claimed for another address while this one was looking means looking again
+    for (int attempt = 0; attempt < 4; attempt++)
+    {
+      bucket_table::slot *found = buckets_.find_or_claim(ip_address, hash,
+        [now, window_seconds](const std::atomic<uint64_t> &value)
+        {
+          return now - static_cast<uint32_t>(value.load(std::memory_order_relaxed) >> 32) >= window_seconds;
+        },
+        [now, check](std::atomic<uint64_t> &value)
+        {
+          value.store(bucket_value(now, 0, check), std::memory_order_relaxed);
+        });
+      if (!found)
+      {
+        workers_[worker].table_full.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      uint64_t value = found->value.load(std::memory_order_relaxed);
+      while ((value & 0xff) == check)
+      {
+        uint64_t updated;
+        if (now - static_cast<uint32_t>(value >> 32) >= window_seconds)
+        {
+          updated = bucket_value(now, 1, check);
+        }
+        else if (((value >> 8) & 0xffffff) >= limit)
+        {
+          workers_[worker].rate_limited.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+        else
+        {
+          updated = value + (1 << 8);
+        }
+        if (found->value.compare_exchange_weak(value, updated, std::memory_order_relaxed))
+        {
+          return false;
+        }
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief The registered email filter, built by one process and read by all.
+   */
+  email_filter_state &email_filter()
+  {
+    return email_filter_;
+  }
+
+  /**
+   * @brief The abuse guard's request counts and blocked IPs.
+   */
+  abuse_guard_state &abuse()
+  {
+    return abuse_;
+  }
+
+  /**
+   * @brief The counters of every process, in the Prometheus text format.
+   */
+  std::string metrics_text() const
+  {
+    std::string out;
+    out += "# HELP cart_checkout_requests_total Requests received by each server process on the host.\n";
+    out += "# TYPE cart_checkout_requests_total counter\n";
+    append_worker_samples(out, "cart_checkout_requests_total", &worker_stats::requests);
+    out += "# HELP cart_checkout_rate_limited_total Requests rejected by the host-wide rate limit, by the process that rejected them.\n";
+    out += "# TYPE cart_checkout_rate_limited_total counter\n";
+    append_worker_samples(out, "cart_checkout_rate_limited_total", &worker_stats::rate_limited);
+    out += "# HELP cart_checkout_rate_limit_table_full_total Requests let through because the rate limit table had no room for their address.\n";
+    out += "# TYPE cart_checkout_rate_limit_table_full_total counter\n";
+    append_worker_samples(out, "cart_checkout_rate_limit_table_full_total", &worker_stats::table_full);
+    return out;
+  }
+
+private:
+  struct worker_stats
+  {
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> rate_limited;
+    std::atomic<uint64_t> table_full;
+    std::atomic<int64_t> pid;
+    char padding[32]; // one cache line per process
+  };
+
+  // A bucket's value is the window's start in seconds (32 bits), its request count (24 bits) and a check byte of
+  // the address, which a request verifies when it updates the value in case the bucket was claimed by another
+  // address meanwhile
+  typedef shared_table<std::atomic<uint64_t>, 1 << 16, 64> bucket_table;
+
+  shared_state() = default;
+
+  static uint64_t bucket_value(uint32_t start, uint32_t count, uint64_t check)
+  {
+    return (static_cast<uint64_t>(start) << 32) | (static_cast<uint64_t>(count) << 8) | check;
+  }
+
+  static size_t metrics_offset()
+  {
+    return (sizeof(shared_state) + 63) & ~size_t(63);
+  }
+
+  static uint32_t now_seconds()
+  {
+    // CLOCK_MONOTONIC, the same for every process on the host
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  void append_worker_samples(std::string &out, const char *name, std::atomic<uint64_t> worker_stats::*counter) const
+  {
+    for (unsigned worker = 0; worker < max_workers; worker++)
+    {
+      int64_t pid = workers_[worker].pid.load(std::memory_order_relaxed);
+      if (pid)
+      {
+        out += name;
+        out += "{worker=\"" + std::to_string(worker) + "\",pid=\"" + std::to_string(pid) + "\"} ";
+        out += std::to_string((workers_[worker].*counter).load(std::memory_order_relaxed));
+        out += '\n';
+      }
+    }
+  }
+
+  worker_stats workers_[max_workers];
+  bucket_table buckets_;
+  email_filter_state email_filter_;
+  abuse_guard_state abuse_;
+  size_t metrics_size_;
+};
+
+/**
+ * @brief Middleware counting every request in the shared_state, once attached to it.
+ */
+struct host_stats
+{
+  struct context
+  {};
+
+  void attach(shared_state *state, unsigned worker)
+  {
+    state_ = state;
+    worker_ = worker;
+  }
+
+  void before_handle(crow::request & /*req*/, crow::response & /*res*/, context & /*ctx*/)
+  {
+    if (state_)
+    {
+      state_->count_request(worker_);
+    }
+  }
+
+  void after_handle(crow::request & /*req*/, crow::response & /*res*/, context & /*ctx*/)
+  {}
+
+private:
+  shared_state *state_ = nullptr;
+  unsigned worker_ = 0;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef SHARED_TABLE_HPP
+#define SHARED_TABLE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+
+/**
+ * @brief A fixed size hash table from short strings (e.g. IP addresses) to a Value made of lock-free atomics, for
+ * memory shared between processes: zeroed memory is an empty table, and it never locks, as a process dying while
+ * holding a lock would leave it held for the others.
+ *
+ * It is open addressing: a slot is claimed by compare-and-swap on its tag, and a slot whose value has expired can
+ * be claimed by another key once the key's probe sequence is full. Slots are never emptied, so a lookup stops at
+ * the first empty slot. Keys are cut to 47 characters.
+ */
+template <typename Value, size_t SlotCount, size_t MaxProbes>
+struct shared_table
+{
+  struct slot
+  {
+    std::atomic<uint64_t> tag;
+    Value value;
+    char key[48];
+  };
+
+  // FNV-1a: every process has to place a key in the same slot
+  static uint64_t hash_key(const std::string &key)
+  {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : key)
+    {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+    }
+    return hash ^ (hash >> 29);
+  }
+
+  /**
+   * @brief The slot of key (hashed by hash_key), or nullptr if it has none.
+   */
+  slot *find(const std::string &key, uint64_t hash)
+  {
+    uint64_t tag = tag_of(hash);
+    for (uint64_t probe = 0; probe < MaxProbes; probe++)
+    {
+      slot &candidate = slots[(hash + probe) % SlotCount];
+      uint64_t current = settled_tag(candidate);
+      if (current == empty)
+      {
+        return nullptr;
+      }
+      if (current == tag && key_matches(candidate, key) && candidate.tag.load(std::memory_order_acquire) == tag)
+      {
+        return &candidate;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief The slot of key, or one claimed for it, empty or taking over one whose value expired(value) says is
+   * expired: init(value) is called on a claimed slot before other processes can find it.
+   *
+   * @return nullptr if every slot of the key's probe sequence is taken.
+   */
+  template <typename Expired, typename Init>
+  slot *find_or_claim(const std::string &key, uint64_t hash, Expired expired, Init init)
+  {
+    uint64_t tag = tag_of(hash);
+    slot *reusable = nullptr;
+    uint64_t reusable_tag = 0;
+    for (uint64_t probe = 0; probe < MaxProbes; probe++)
+    {
+      slot &candidate = slots[(hash + probe) % SlotCount];
+      uint64_t current = settled_tag(candidate);
+      if (current == empty)
+      {
+        if (candidate.tag.compare_exchange_strong(current, claiming, std::memory_order_acquire))
+        {
+          return publish(candidate, key, tag, init);
+        }
+        current = settled_tag(candidate); // claimed by another process, maybe for this key
+      }
+      // The key is only trusted if the slot was not reclaimed while it was compared
+      if (current == tag && key_matches(candidate, key) && candidate.tag.load(std::memory_order_acquire) == tag)
+      {
+        return &candidate;
+      }
+      if (!reusable && current != claiming && expired(candidate.value))
+      {
+        reusable = &candidate;
+        reusable_tag = current;
+      }
+    }
+
+    // Every slot of the probe sequence is taken: take over one that has expired
+    if (reusable && reusable->tag.compare_exchange_strong(reusable_tag, claiming, std::memory_order_acquire))
+    {
+      return publish(*reusable, key, tag, init);
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief Calls visit(key, value) for every claimed slot (a slot claimed meanwhile may be missed).
+   */
+  template <typename Visit>
+  void for_each(Visit visit)
+  {
+    for (size_t i = 0; i < SlotCount; i++)
+    {
+      uint64_t tag = slots[i].tag.load(std::memory_order_acquire);
+      if (tag != empty && tag != claiming)
+      {
+        char key[sizeof(slots[i].key)];
+        std::memcpy(key, slots[i].key, sizeof(key));
+        key[sizeof(key) - 1] = '\0';
+        if (slots[i].tag.load(std::memory_order_acquire) == tag)
+        {
+          visit(std::string(key), slots[i].value);
+        }
+      }
+    }
+  }
+
+  slot slots[SlotCount];
+
+private:
+  enum : uint64_t
+  {
+    empty = 0,
+    claiming = 1 // tags of claimed slots have their top bit set
+  };
+
+  static uint64_t tag_of(uint64_t hash)
+  {
+    return hash | (uint64_t(1) << 63);
+  }
+
+  static bool key_matches(const slot &candidate, const std::string &key)
+  {
+    return std::strncmp(candidate.key, key.c_str(), sizeof(candidate.key) - 1) == 0;
+  }
+
+  template <typename Init>
+  static slot *publish(slot &claimed, const std::string &key, uint64_t tag, Init &init)
+  {
+    std::strncpy(claimed.key, key.c_str(), sizeof(claimed.key) - 1);
+    claimed.key[sizeof(claimed.key) - 1] = '\0';
+    init(claimed.value);
+    claimed.tag.store(tag, std::memory_order_release);
+    return &claimed;
+  }
+
+  /**
+   * @brief Waits out a claim in progress; gives up after a while, in case its process died in the middle of it.
+   */
+  static uint64_t settled_tag(const slot &candidate)
+  {
+    uint64_t tag = candidate.tag.load(std::memory_order_acquire);
+    for (int spins = 0; tag == claiming && spins < 1000; spins++)
+    {
+      std::this_thread::yield();
+      tag = candidate.tag.load(std::memory_order_acquire);
+    }
+    return tag;
+  }
+};
+
+#endif
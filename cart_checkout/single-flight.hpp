@@ -0,0 +1,69 @@
+#ifndef SINGLE_FLIGHT_HPP
+#define SINGLE_FLIGHT_HPP
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * @brief Coalesces identical concurrent reads: while a call for a key is in flight, further calls for the
+ * same key wait for it and receive its result (or exception) instead of issuing their own.
+ *
+ * Nothing is cached; the next call after the in-flight one completes starts a new read.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class single_flight
+{
+public:
+  /**
+   * @brief Runs read for key, unless a call for key is already running, in which case its result is returned.
+   *
+   * @param shared set to true if the result came from another caller's read.
+   */
+  Value run(const Key &key, const std::function<Value()> &read, bool *shared = nullptr)
+  {
+    std::shared_ptr<std::promise<Value>> leader;
+    std::shared_future<Value> result;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto in_flight = calls_.find(key);
+      if (in_flight != calls_.end())
+      {
+        result = in_flight->second;
+      }
+      else
+      {
+        leader = std::make_shared<std::promise<Value>>();
+        result = leader->get_future().share();
+        calls_.emplace(key, result);
+      }
+    }
+    if (shared)
+    {
+      *shared = !leader;
+    }
+
+    if (leader)
+    {
+      try
+      {
+        leader->set_value(read());
+      }
+      catch (...)
+      {
+        leader->set_exception(std::current_exception());
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      calls_.erase(key);
+    }
+    return result.get();
+  }
+
+private:
+  std::mutex mutex_;
+  std::unordered_map<Key, std::shared_future<Value>, Hash> calls_;
+};
+
+#endif
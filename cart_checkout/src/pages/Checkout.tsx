@@ -1,4 +1,4 @@
-import { useCallback, useEffect, useState } from "react";
+import { useCallback, useEffect, useRef, useState } from "react";
 import { useNavigate } from "react-router-dom";
 import { useAuthContext } from "../my-context";
 import LoadingDialog from "../components/loading/LoadingDialog";
@@ -18,29 +18,47 @@ const Checkout: React.FC = () => {
 
   const [cartData, setCartData] = useState<CartData[]>([]);
   const [cartDataLoading, setCartDataLoading] = useState<boolean>(false);
+  // Inventory version of the last /cart-info answer, so refreshes only fetch what changed since
+  const inventoryVersion = useRef<string | null>(null);
 
   const fetchCarts = useCallback(async () => {
     try {
-      setCartDataLoading(true);
+      const since = inventoryVersion.current;
+      if (since === null) {
+        setCartDataLoading(true);
+      }
       const res = await fetch('/cart-info', {
         method: 'POST',
         headers: {
           'Content-Type': 'application/json',
         },
+        body: since === null ? undefined : JSON.stringify({ since }),
         credentials: 'include'
       });
 
+      if (res.status === 304) {
+        return;
+      }
       if (!res.ok) {
         console.log(res.statusText);
         throw new Error(`Server responded with status: ${res.status}`);
       }
+      const version = res.headers.get('X-Inventory-Version');
 
-      const data: CartData[] | null = await res.json();
+      const data: CartData[] | { version: string, full: boolean, carts: CartData[] } | null = await res.json();
       console.log(data);
-      if (!data || data.length <= 0) {
+      if (data && !Array.isArray(data) && !data.full) {
+        const changed = new Map(data.carts.map((cart: CartData) => [cart.id, cart]));
+        setCartData((carts: CartData[]) => carts.map((cart: CartData) => changed.get(cart.id) ?? cart));
+        inventoryVersion.current = version;
+        return;
+      }
+      const carts = Array.isArray(data) ? data : data?.carts;
+      if (!carts || carts.length <= 0) {
         throw new Error(`Error fetching cart data`);
       }
-      setCartData(data);
+      setCartData(carts);
+      inventoryVersion.current = version;
       setCartDataLoading(false);
     } catch (err: any) {
       setCartDataLoading(false);
@@ -56,10 +74,42 @@ const Checkout: React.FC = () => {
       } else {
         console.log('checkout page - fetching carts')
         fetchCarts();
+        // Catch up when the page comes back into view, in case the live feed missed something meanwhile
+        window.addEventListener('focus', fetchCarts);
+        return () => window.removeEventListener('focus', fetchCarts);
       }
     }
   }, [context.authLoading, context.auth, fetchCarts]);
 
+  // Live availability: a snapshot on connect, then deltas with the carts that changed
+  useEffect(() => {
+    if (context.authLoading || !context.auth.loggedIn) {
+      return;
+    }
+    const scheme = window.location.protocol === 'https:' ? 'wss' : 'ws';
+    const socket = new WebSocket(`${scheme}://${window.location.host}/ws/carts`);
+    socket.onmessage = (event: MessageEvent) => {
+      const message: { type: 'snapshot' | 'delta' | 'booking', version: number, carts?: CartData[] } = JSON.parse(event.data);
+      // Bookings are future reservations, they do not change what is available now
+      if (message.type === 'booking') {
+        return;
+      }
+      const carts = message.carts;
+      if (!carts) {
+        return;
+      }
+      if (message.type === 'snapshot') {
+        if (carts.length > 0) {
+          setCartData(carts);
+        }
+        return;
+      }
+      const changed = new Map(carts.map((cart: CartData) => [cart.id, cart]));
+      setCartData((prev: CartData[]) => prev.map((cart: CartData) => changed.get(cart.id) ?? cart));
+    };
+    return () => socket.close();
+  }, [context.authLoading, context.auth]);
+
   return (
     <>
       <h1>Checking out carts</h1>
@@ -0,0 +1,474 @@
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief A registered user as stored in the Users collection.
+ */
+struct user_record
+{
+  std::string id;
+  std::string email;
+  std::string password_hash;
+  std::string name;
+};
+
+/**
+ * @brief The outcome of inserting a record that has a unique key.
+ */
+enum class insert_status
+{
+  inserted,
+  duplicate, // a record with the same unique key already exists
+  failed
+};
+
+/**
+ * @brief A golf cart as stored in the Carts collection.
+ */
+struct cart_record
+{
+  std::string id;
+  std::string name;
+  int type = 0;
+  bool available = false;
+  std::string holder; // uid of the member who checked the cart out, if any
+};
+
+/**
+ * @brief Cart fields a query can project (the id is always returned).
+ */
+enum cart_fields : unsigned
+{
+  cart_field_name = 1,
+  cart_field_type = 2,
+  cart_field_available = 4,
+  all_cart_fields = cart_field_name | cart_field_type | cart_field_available
+};
+
+/**
+ * @brief A filtered page of carts, in (name, id) order.
+ */
+struct cart_query
+{
+  int type = -1;      // any type if negative
+  int available = -1; // 0 or 1, either if negative
+  std::string name_prefix;
+  std::string after_name; // the last cart of the previous page (none if after_id is empty)
+  std::string after_id;
+  size_t limit = 50;
+  unsigned fields = all_cart_fields;
+};
+
+struct cart_page
+{
+  std::vector<cart_record> carts;
+  bool more = false; // whether carts after the last one also match
+};
+
+/**
+ * @brief Whether cart passes the query's filters (the cursor aside).
+ */
+inline bool cart_matches(const cart_query &query, const cart_record &cart)
+{
+  return (query.type < 0 || cart.type == query.type) &&
+         (query.available < 0 || cart.available == (query.available != 0)) &&
+         cart.name.compare(0, query.name_prefix.size(), query.name_prefix) == 0;
+}
+
+/**
+ * @brief The (name, id) order of query results.
+ */
+inline bool cart_ordered_before(const std::string &name, const std::string &id, const std::string &other_name, const std::string &other_id)
+{
+  int names = name.compare(other_name);
+  return names < 0 || (names == 0 && id < other_id);
+}
+
+/**
+ * @brief A change of a cart's checkout state.
+ */
+struct cart_update
+{
+  std::string cart_id;
+  bool available = false;
+  std::string holder;
+};
+
+/**
+ * @brief A booking of one cart for consecutive 5-minute slots of one day, as stored in the Reservations collection.
+ */
+struct reservation_record
+{
+  std::string id;
+  std::string cart_id;
+  std::string uid;
+  int day = 0;        // days since 1970-01-01
+  int first_slot = 0; // 0 is 00:00, 1 is 00:05, ...
+  int slot_count = 0;
+};
+
+/**
+ * @brief The database operations used by the routes, so they can run against MongoDB or an in-memory stand-in.
+ */
+class storage
+{
+public:
+  virtual ~storage() {}
+
+  /**
+   * @brief Whether the backing database can be used at all.
+   */
+  virtual bool available() const = 0;
+
+  /**
+   * @brief Finds the user registered with the provided email address.
+   *
+   * @return true if the user exists, in which case it is written to user.
+   */
+  virtual bool find_user_by_email(const std::string &email, user_record &user) = 0;
+
+  /**
+   * @brief Finds the user with the provided uid, only if it is registered with the provided email address.
+   *
+   * @return true if the user exists, in which case it is written to user.
+   */
+  virtual bool find_user(const std::string &uid, const std::string &email, user_record &user) = 0;
+
+  /**
+   * @brief Inserts a new user (its id is ignored) in one round trip, unless its email is already registered.
+   *
+   * The email is unique in the store, so concurrent registrations of the same email cannot both succeed.
+   *
+   * @return insert_status inserted, in which case the new user's uid is written to uid, duplicate if the email is
+   * already registered, or failed.
+   */
+  virtual insert_status insert_user(const user_record &user, std::string &uid) = 0;
+
+  /**
+   * @brief Returns the email of every registered user (and nothing else about them).
+   */
+  virtual std::vector<std::string> list_user_emails() = 0;
+
+  /**
+   * @brief Returns the email of every user registered at or after since, going by the clock of whoever inserted them.
+   */
+  virtual std::vector<std::string> list_user_emails(std::chrono::system_clock::time_point since) = 0;
+
+  /**
+   * @brief Returns every cart.
+   */
+  virtual std::vector<cart_record> list_carts() = 0;
+
+  /**
+   * @brief Returns the first query.limit carts matching query after its cursor, in (name, id) order.
+   */
+  virtual cart_page query_carts(const cart_query &query) = 0;
+
+  /**
+   * @brief Applies a batch of checkout state changes, in order, as one round trip.
+   *
+   * @return true if every update was applied.
+   */
+  virtual bool update_carts(const std::vector<cart_update> &updates) = 0;
+
+  /**
+   * @brief Inserts a reservation (its id is ignored).
+   *
+   * @return std::string the id of the inserted reservation, or an empty string if it could not be inserted.
+   */
+  virtual std::string insert_reservation(const reservation_record &reservation) = 0;
+
+  /**
+   * @brief Returns every reservation from day onwards.
+   */
+  virtual std::vector<reservation_record> list_reservations(int from_day) = 0;
+};
+
+/**
+ * @brief Keeps users and carts in memory, used by benchmarks and local runs without MongoDB.
+ * Users are indexed by email and by _id; emails are unique, like the index on Users.User.
+ */
+class in_memory_storage : public storage
+{
+public:
+  bool available() const override
+  {
+    return true;
+  }
+
+  bool find_user_by_email(const std::string &email, user_record &user) override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = users_by_email_.find(email);
+    if (found == users_by_email_.end())
+    {
+      return false;
+    }
+    user = users_[found->second];
+    return true;
+  }
+
+  bool find_user(const std::string &uid, const std::string &email, user_record &user) override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = users_by_id_.find(uid);
+    if (found == users_by_id_.end() || users_[found->second].email != email)
+    {
+      return false;
+    }
+    user = users_[found->second];
+    return true;
+  }
+
+  insert_status insert_user(const user_record &user, std::string &uid) override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (users_by_email_.count(user.email))
+    {
+      return insert_status::duplicate;
+    }
+    users_.push_back(user);
+    users_.back().id = next_id();
+    users_registered_.push_back(std::chrono::system_clock::now());
+    users_by_email_.emplace(user.email, users_.size() - 1);
+    users_by_id_.emplace(users_.back().id, users_.size() - 1);
+    uid = users_.back().id;
+    return insert_status::inserted;
+  }
+
+  std::vector<std::string> list_user_emails() override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> emails;
+    emails.reserve(users_.size());
+    for (const auto &user : users_)
+    {
+      emails.push_back(user.email);
+    }
+    return emails;
+  }
+
+  std::vector<std::string> list_user_emails(std::chrono::system_clock::time_point since) override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> emails;
+    for (size_t i = 0; i < users_.size(); i++)
+    {
+      if (users_registered_[i] >= since)
+      {
+        emails.push_back(users_[i].email);
+      }
+    }
+    return emails;
+  }
+
+  std::vector<cart_record> list_carts() override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return carts_;
+  }
+
+  cart_page query_carts(const cart_query &query) override
+  {
+    std::vector<cart_record> matching;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto &cart : carts_)
+      {
+        if (cart_matches(query, cart) && (query.after_id.empty() || cart_ordered_before(query.after_name, query.after_id, cart.name, cart.id)))
+        {
+          matching.push_back(cart);
+        }
+      }
+    }
+    std::sort(matching.begin(), matching.end(), [](const cart_record &a, const cart_record &b)
+    {
+      return cart_ordered_before(a.name, a.id, b.name, b.id);
+    });
+
+    cart_page page;
+    page.more = matching.size() > query.limit;
+    matching.resize(std::min(matching.size(), query.limit));
+    page.carts = std::move(matching);
+    return page;
+  }
+
+  bool update_carts(const std::vector<cart_update> &updates) override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &update : updates)
+    {
+      for (auto &cart : carts_)
+      {
+        if (cart.id == update.cart_id)
+        {
+          cart.available = update.available;
+          cart.holder = update.holder;
+        }
+      }
+    }
+    return true;
+  }
+
+  std::string insert_reservation(const reservation_record &reservation) override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reservations_.push_back(reservation);
+    reservations_.back().id = next_id();
+    return reservations_.back().id;
+  }
+
+  std::vector<reservation_record> list_reservations(int from_day) override
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<reservation_record> reservations;
+    for (const auto &reservation : reservations_)
+    {
+      if (reservation.day >= from_day)
+      {
+        reservations.push_back(reservation);
+      }
+    }
+    return reservations;
+  }
+
+  /**
+   * @brief Adds a cart (its id is ignored) and returns its id.
+   */
+  std::string insert_cart(const cart_record &cart)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    carts_.push_back(cart);
+    carts_.back().id = next_id();
+    return carts_.back().id;
+  }
+
+private:
+  /**
+   * @brief Generates ids shaped like MongoDB ObjectIds (24 hex digits).
+   */
+  std::string next_id()
+  {
+    char id[25];
+    snprintf(id, sizeof(id), "%024llx", static_cast<unsigned long long>(++last_id_));
+    return id;
+  }
+
+  std::mutex mutex_;
+  std::vector<user_record> users_;
+  std::vector<std::chrono::system_clock::time_point> users_registered_; // by index in users_
+  std::unordered_map<std::string, size_t> users_by_email_;
+  std::unordered_map<std::string, size_t> users_by_id_;
+  std::vector<cart_record> carts_;
+  std::vector<reservation_record> reservations_;
+  unsigned long long last_id_ = 0;
+};
+
+/**
+ * @brief Delays every call to another store by a fixed latency plus uniform jitter,
+ * so runs against in_memory_storage see round trips similar to a real database.
+ */
+class latency_injecting_storage : public storage
+{
+public:
+  latency_injecting_storage(storage &inner, std::chrono::microseconds latency, std::chrono::microseconds jitter)
+    : inner_(inner), latency_(latency), jitter_(jitter)
+  {
+  }
+
+  bool available() const override
+  {
+    return inner_.available();
+  }
+
+  bool find_user_by_email(const std::string &email, user_record &user) override
+  {
+    delay();
+    return inner_.find_user_by_email(email, user);
+  }
+
+  bool find_user(const std::string &uid, const std::string &email, user_record &user) override
+  {
+    delay();
+    return inner_.find_user(uid, email, user);
+  }
+
+  insert_status insert_user(const user_record &user, std::string &uid) override
+  {
+    delay();
+    return inner_.insert_user(user, uid);
+  }
+
+  std::vector<std::string> list_user_emails() override
+  {
+    delay();
+    return inner_.list_user_emails();
+  }
+
+  std::vector<std::string> list_user_emails(std::chrono::system_clock::time_point since) override
+  {
+    delay();
+    return inner_.list_user_emails(since);
+  }
+
+  std::vector<cart_record> list_carts() override
+  {
+    delay();
+    return inner_.list_carts();
+  }
+
+  cart_page query_carts(const cart_query &query) override
+  {
+    delay();
+    return inner_.query_carts(query);
+  }
+
+  bool update_carts(const std::vector<cart_update> &updates) override
+  {
+    delay();
+    return inner_.update_carts(updates);
+  }
+
+  std::string insert_reservation(const reservation_record &reservation) override
+  {
+    delay();
+    return inner_.insert_reservation(reservation);
+  }
+
+  std::vector<reservation_record> list_reservations(int from_day) override
+  {
+    delay();
+    return inner_.list_reservations(from_day);
+  }
+
+private:
+  void delay() const
+  {
+    static thread_local std::mt19937 generator(std::random_device{}());
+    std::chrono::microseconds latency = latency_;
+    if (jitter_.count() > 0)
+    {
+      latency += std::chrono::microseconds(std::uniform_int_distribution<long long>(0, jitter_.count())(generator));
+    }
+    if (latency.count() > 0)
+    {
+      std::this_thread::sleep_for(latency);
+    }
+  }
+
+  storage &inner_;
+  std::chrono::microseconds latency_;
+  std::chrono::microseconds jitter_;
+};
+
+#endif
@@ -0,0 +1,177 @@
+// Decodes binary access logs written by crow::access_log_writer into Common Log Format or JSON lines.
+//
+// usage: access_log_decode [--format clf|json] [--routes <path>.routes] <path>.000001 [<path>.000002 ...]
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include <crow/access_log.h>
+#include <crow/common.h>
+
+/**
+ * @brief Loads the `id<TAB>rule` route table written next to the access logs.
+ */
+std::vector<std::string> load_routes(const std::string &path)
+{
+  std::vector<std::string> routes;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line))
+  {
+    size_t tab = line.find('\t');
+    if (tab == std::string::npos)
+    {
+      continue;
+    }
+    size_t id = std::stoul(line.substr(0, tab));
+    if (id >= routes.size())
+    {
+      routes.resize(id + 1);
+    }
+    routes[id] = line.substr(tab + 1);
+  }
+  return routes;
+}
+
+/**
+ * @brief Strips the `.NNNNNN` sequence suffix from a log file name to find its `.routes` file.
+ */
+std::string routes_path_for(const std::string &log_path)
+{
+  size_t dot = log_path.rfind('.');
+  if (dot == std::string::npos)
+  {
+    return log_path + ".routes";
+  }
+  return log_path.substr(0, dot) + ".routes";
+}
+
+std::string format_ip(const crow::access_log_record &record)
+{
+  char buffer[INET6_ADDRSTRLEN] = {0};
+  inet_ntop(record.ip_version == 6 ? AF_INET6 : AF_INET, record.ip, buffer, sizeof(buffer));
+  return buffer;
+}
+
+std::string json_escape(const std::string &value)
+{
+  std::string escaped;
+  for (char c : value)
+  {
+    if (c == '"' || c == '\\')
+    {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+void print_record(const crow::access_log_record &record, const std::vector<std::string> &routes, bool json)
+{
+  std::string route = record.route_id < routes.size() && !routes[record.route_id].empty() ? routes[record.route_id] : "route#" + std::to_string(record.route_id);
+  std::string method = crow::method_name(static_cast<crow::HTTPMethod>(record.method));
+  std::string ip = format_ip(record);
+
+  time_t seconds = static_cast<time_t>(record.timestamp_us / 1000000);
+  tm my_tm;
+  gmtime_r(&seconds, &my_tm);
+
+  if (json)
+  {
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &my_tm);
+    printf("{\"time\":\"%s.%06uZ\",\"ip\":\"%s\",\"method\":\"%s\",\"route\":\"%s\",\"route_id\":%u,\"http_version\":\"%u.%u\",\"status\":%u,\"latency_us\":%u,\"bytes_sent\":%u,\"bytes_received\":%u}\n",
+           date, static_cast<unsigned>(record.timestamp_us % 1000000), ip.c_str(), method.c_str(), json_escape(route).c_str(), record.route_id,
+           record.http_version / 10, record.http_version % 10, record.status, record.latency_us, record.bytes_sent, record.bytes_received);
+  }
+  else
+  {
+    char date[40];
+    strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S +0000", &my_tm);
+    printf("%s - - [%s] \"%s %s HTTP/%u.%u\" %u %u\n",
+           ip.c_str(), date, method.c_str(), route.c_str(), record.http_version / 10, record.http_version % 10, record.status, record.bytes_sent);
+  }
+}
+
+bool decode_file(const std::string &path, const std::vector<std::string> &routes, bool json)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+  {
+    std::cerr << "Could not open " << path << std::endl;
+    return false;
+  }
+
+  crow::access_log_header header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || std::memcmp(header.magic, "CROWALOG", 8) != 0)
+  {
+    std::cerr << path << " is not an access log" << std::endl;
+    return false;
+  }
+  if (header.version != 1 || header.record_size != sizeof(crow::access_log_record))
+  {
+    std::cerr << path << " has unsupported version " << header.version << " / record size " << header.record_size << std::endl;
+    return false;
+  }
+
+  crow::access_log_record record;
+  while (file.read(reinterpret_cast<char *>(&record), sizeof(record)))
+  {
+    // Slots reserved but never written (e.g. the process died mid-file) are left zeroed
+    if (record.timestamp_us == 0)
+    {
+      continue;
+    }
+    print_record(record, routes, json);
+  }
+  return true;
+}
+
+int main(int argc, const char *argv[])
+{
+  bool json = false;
+  std::string routes_path;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "--format" && i + 1 < argc)
+    {
+      json = std::string(argv[++i]) == "json";
+    }
+    else if (arg == "--routes" && i + 1 < argc)
+    {
+      routes_path = argv[++i];
+    }
+    else
+    {
+      files.push_back(arg);
+    }
+  }
+
+  if (files.empty())
+  {
+    std::cerr << "usage: " << argv[0] << " [--format clf|json] [--routes <path>.routes] <log files...>" << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> routes = load_routes(routes_path.empty() ? routes_path_for(files.front()) : routes_path);
+
+  bool ok = true;
+  for (const auto &path : files)
+  {
+    ok = decode_file(path, routes, json) && ok;
+  }
+  return ok ? 0 : 1;
+}
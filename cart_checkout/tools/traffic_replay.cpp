@@ -0,0 +1,322 @@
+// Replays a traffic capture written by crow::TrafficCapture against a test instance.
+//
+// usage: traffic_replay [--host 127.0.0.1] [--port 18080] [--speed 1|10|max] [--concurrency n]
+//                       [--cookie "jwtToken=..."] [--credentials email:password] <capture file>
+//
+// Requests keep their captured start offsets, divided by --speed (max sends them back to back). They are spread over
+// --concurrency keep-alive connections. Captured cookies are redacted, so --cookie replaces the Cookie header of every
+// request that had one, and --credentials replaces the body of every POST /login.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include <crow/common.h>
+#include <crow/middlewares/traffic_capture.h>
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+/**
+ * @brief One captured request, already rendered as an HTTP/1.1 request.
+ */
+struct replay_request
+{
+  uint64_t offset_us;
+  std::string path;
+  std::string raw;
+};
+
+struct replay_options
+{
+  std::string host = "127.0.0.1";
+  std::string port = "18080";
+  double speed = 1; // 0 means as fast as possible
+  unsigned concurrency = 8;
+  std::string cookie;
+  std::string email;
+  std::string password;
+};
+
+std::string login_body(const replay_options &options)
+{
+  crow::json::wvalue body;
+  body["email"] = options.email;
+  body["password"] = options.password;
+  return body.dump();
+}
+
+/**
+ * @brief Reads every record of a capture file and renders it as a request.
+ */
+bool load_capture(const std::string &path, const replay_options &options, std::vector<replay_request> &requests)
+{
+  std::ifstream file(path, std::ios::binary);
+  crow::traffic_capture_header header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || std::memcmp(header.magic, "CROWCAPT", 8) != 0 || header.version != 1)
+  {
+    std::cerr << path << ": not a traffic capture (or an unsupported version)" << std::endl;
+    return false;
+  }
+
+  crow::traffic_capture_record record;
+  while (file.read(reinterpret_cast<char *>(&record), sizeof(record)))
+  {
+    if (record.size < sizeof(record))
+    {
+      std::cerr << path << ": corrupt record, stopping" << std::endl;
+      break;
+    }
+    std::string data(record.size - sizeof(record), '\0');
+    if (!file.read(&data[0], data.size()))
+    {
+      std::cerr << path << ": truncated record, stopping" << std::endl;
+      break;
+    }
+
+    replay_request request;
+    request.offset_us = record.offset_us;
+    size_t position = 0;
+    std::string url = data.substr(position, record.url_size);
+    position += record.url_size;
+    request.path = url.substr(0, url.find('?'));
+
+    crow::HTTPMethod method = static_cast<crow::HTTPMethod>(record.method);
+    std::string raw = crow::method_name(method) + " " + url + " HTTP/1.1\r\nHost: " + options.host + "\r\n";
+    for (unsigned i = 0; i < record.header_count; i++)
+    {
+      uint16_t sizes[2];
+      std::memcpy(sizes, data.data() + position, sizeof(sizes));
+      position += sizeof(sizes);
+      std::string name = data.substr(position, sizes[0]);
+      std::string value = data.substr(position + sizes[0], sizes[1]);
+      position += sizes[0] + sizes[1];
+      if (boost::iequals(name, "Cookie") && !options.cookie.empty())
+      {
+        value = options.cookie;
+      }
+      raw += name + ": " + value + "\r\n";
+    }
+
+    std::string body = data.substr(position, record.body_size);
+    if (method == crow::HTTPMethod::Post && request.path == "/login" && !options.email.empty())
+    {
+      body = login_body(options);
+    }
+    raw += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    request.raw = std::move(raw);
+    requests.push_back(std::move(request));
+  }
+  return true;
+}
+
+/**
+ * @brief Per-path results, merged from every connection.
+ */
+struct path_stats
+{
+  std::vector<uint32_t> latencies_us;
+  std::map<int, uint64_t> status_counts;
+};
+
+/**
+ * @brief Sends a request over a keep-alive connection (reconnecting if needed) and returns the response status.
+ */
+int send_request(tcp::socket &socket, tcp::resolver::results_type &endpoints, const std::string &raw)
+{
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    boost::system::error_code ec;
+    if (!socket.is_open())
+    {
+      asio::connect(socket, endpoints, ec);
+      if (ec)
+      {
+        return -1;
+      }
+      socket.set_option(tcp::no_delay(true));
+    }
+
+    asio::streambuf response;
+    asio::write(socket, asio::buffer(raw), ec);
+    size_t header_bytes = ec ? 0 : asio::read_until(socket, response, "\r\n\r\n", ec);
+    if (ec)
+    {
+      // The server closed an idle keep-alive connection, try once more on a new one
+      socket.close(ec);
+      continue;
+    }
+
+    std::string headers(asio::buffers_begin(response.data()), asio::buffers_begin(response.data()) + header_bytes);
+    response.consume(header_bytes);
+    int status = headers.size() > 12 ? std::atoi(headers.c_str() + 9) : 0;
+
+    size_t content_length = 0;
+    size_t position = headers.find("Content-Length: ");
+    if (position == std::string::npos)
+    {
+      position = headers.find("content-length: ");
+    }
+    if (position != std::string::npos)
+    {
+      content_length = std::strtoul(headers.c_str() + position + 16, nullptr, 10);
+    }
+    if (response.size() < content_length)
+    {
+      asio::read(socket, response, asio::transfer_exactly(content_length - response.size()), ec);
+    }
+    if (ec || headers.find("Connection: close") != std::string::npos)
+    {
+      socket.close(ec);
+    }
+    return status;
+  }
+  return -1;
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double quantile)
+{
+  if (sorted.empty())
+  {
+    return 0;
+  }
+  size_t rank = static_cast<size_t>(quantile * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+int main(int argc, const char *argv[])
+{
+  replay_options options;
+  std::string capture_path;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0)
+    {
+      capture_path = arg;
+      continue;
+    }
+    if (i + 1 >= argc)
+    {
+      capture_path.clear();
+      break;
+    }
+    std::string value = argv[++i];
+    if (arg == "--host") options.host = value;
+    else if (arg == "--port") options.port = value;
+    else if (arg == "--speed") options.speed = value == "max" ? 0 : std::atof(value.c_str());
+    else if (arg == "--concurrency") options.concurrency = std::max(1, std::atoi(value.c_str()));
+    else if (arg == "--cookie") options.cookie = value;
+    else if (arg == "--credentials")
+    {
+      size_t colon = value.find(':');
+      options.email = value.substr(0, colon);
+      options.password = colon == std::string::npos ? "" : value.substr(colon + 1);
+    }
+    else
+    {
+      capture_path.clear();
+      break;
+    }
+  }
+  if (capture_path.empty())
+  {
+    std::cerr << "usage: " << argv[0] << " [--host h] [--port p] [--speed 1|10|max] [--concurrency n] [--cookie c]"
+              << " [--credentials email:password] <capture file>" << std::endl;
+    return 1;
+  }
+
+  std::vector<replay_request> requests;
+  if (!load_capture(capture_path, options, requests))
+  {
+    return 1;
+  }
+  std::cerr << "Replaying " << requests.size() << " requests" << std::endl;
+
+  asio::io_service io_service;
+  tcp::resolver resolver(io_service);
+  tcp::resolver::results_type endpoints = resolver.resolve(options.host, options.port);
+
+  std::atomic<size_t> next{0};
+  std::mutex stats_mutex;
+  std::map<std::string, path_stats> stats;
+  uint64_t errors = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < options.concurrency; i++)
+  {
+    workers.emplace_back([&]
+    {
+      tcp::socket socket(io_service);
+      std::map<std::string, path_stats> local;
+      uint64_t local_errors = 0;
+      for (size_t index = next++; index < requests.size(); index = next++)
+      {
+        const replay_request &request = requests[index];
+        if (options.speed > 0)
+        {
+          std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<uint64_t>(request.offset_us / options.speed)));
+        }
+
+        auto sent_at = std::chrono::steady_clock::now();
+        int status = send_request(socket, endpoints, request.raw);
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent_at);
+        if (status < 0)
+        {
+          local_errors++;
+          continue;
+        }
+        path_stats &path = local[request.path];
+        path.latencies_us.push_back(static_cast<uint32_t>(latency.count()));
+        path.status_counts[status]++;
+      }
+
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      errors += local_errors;
+      for (auto &entry : local)
+      {
+        path_stats &merged = stats[entry.first];
+        merged.latencies_us.insert(merged.latencies_us.end(), entry.second.latencies_us.begin(), entry.second.latencies_us.end());
+        for (const auto &status : entry.second.status_counts)
+        {
+          merged.status_counts[status.first] += status.second;
+        }
+      }
+    });
+  }
+  for (auto &worker : workers)
+  {
+    worker.join();
+  }
+  double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::printf("%-32s %8s %10s %10s %10s  %s\n", "path", "requests", "p50_us", "p99_us", "max_us", "statuses");
+  for (auto &entry : stats)
+  {
+    std::vector<uint32_t> &latencies = entry.second.latencies_us;
+    std::sort(latencies.begin(), latencies.end());
+    std::string statuses;
+    for (const auto &status : entry.second.status_counts)
+    {
+      statuses += std::to_string(status.first) + "x" + std::to_string(status.second) + " ";
+    }
+    std::printf("%-32s %8zu %10u %10u %10u  %s\n", entry.first.c_str(), latencies.size(), percentile(latencies, 0.5),
+                percentile(latencies, 0.99), latencies.empty() ? 0 : latencies.back(), statuses.c_str());
+  }
+  std::printf("%zu requests in %.2fs (%.1f req/s), %llu errors\n", requests.size(), elapsed_s, requests.size() / elapsed_s,
+              static_cast<unsigned long long>(errors));
+  return errors ? 2 : 0;
+}